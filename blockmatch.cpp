@@ -0,0 +1,178 @@
+#include "blockmatch.h"
+#include <algorithm>
+#include <limits.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static uint32_t sad8x8Scalar(const uint8_t* a, const uint8_t* b, uint32_t stride) {
+    uint32_t sad = 0;
+    for (uint32_t y = 0; y < BM_BLOCK_SIZE; ++y, a += stride, b += stride)
+        for (uint32_t x = 0; x < BM_BLOCK_SIZE; ++x)
+            sad += abs((int)a[x] - (int)b[x]);
+    return sad;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline int64_t load64(const uint8_t* p) {
+    int64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Two rows of 8 pixels per register
+static uint32_t sad8x8SSE2(const uint8_t* a, const uint8_t* b, uint32_t stride) {
+    __m128i acc = _mm_setzero_si128();
+    for (uint32_t y = 0; y < BM_BLOCK_SIZE; y += 2) {
+        __m128i va = _mm_set_epi64x(load64(a + (y + 1) * stride), load64(a + y * stride));
+        __m128i vb = _mm_set_epi64x(load64(b + (y + 1) * stride), load64(b + y * stride));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    return (uint32_t)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc)));
+}
+
+// Four rows of 8 pixels per register
+__attribute__((target("avx2")))
+static uint32_t sad8x8AVX2(const uint8_t* a, const uint8_t* b, uint32_t stride) {
+    __m256i acc = _mm256_setzero_si256();
+    for (uint32_t y = 0; y < BM_BLOCK_SIZE; y += 4) {
+        __m256i va = _mm256_set_epi64x(load64(a + (y + 3) * stride), load64(a + (y + 2) * stride),
+                                       load64(a + (y + 1) * stride), load64(a + y * stride));
+        __m256i vb = _mm256_set_epi64x(load64(b + (y + 3) * stride), load64(b + (y + 2) * stride),
+                                       load64(b + (y + 1) * stride), load64(b + y * stride));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+    }
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    return (uint32_t)(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum)));
+}
+#endif
+
+// Function to pick the fastest SAD kernel the CPU supports (AVX2, SSE2 or scalar)
+SadFunc selectSadKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+        return sad8x8AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return sad8x8SSE2;
+#endif
+    return sad8x8Scalar;
+}
+
+BlockMatchBackend::BlockMatchBackend(const NV_OF_INIT_PARAMS& initparams, uint32_t numthreads)
+    : CpuFlowBackend(initparams, BM_LEVELS, 2 * BM_BLOCK_SIZE, numthreads), m_sad(selectSadKernel())
+{
+    // Every matched window has to fit into the frame
+    if (initparams.width < BM_BLOCK_SIZE || initparams.height < BM_BLOCK_SIZE)
+        throw std::runtime_error("Block matching needs frames of at least " + std::to_string(BM_BLOCK_SIZE) + "x" +
+                                 std::to_string(BM_BLOCK_SIZE) + " pixels");
+}
+
+void BlockMatchBackend::matchLevel(const GrayImage& prev, const GrayImage& cur, uint32_t level, bool finest) {
+    const int width = (int)prev.width;
+    const int height = (int)prev.height;
+    const uint32_t bw = m_fieldWidths[level];
+    const uint32_t bh = m_fieldHeights[level];
+    NV_OF_FLOW_VECTOR* field = m_fields[level].data();
+    const bool coarsest = level + 1 == m_fields.size();
+    const NV_OF_FLOW_VECTOR* parent = coarsest ? nullptr : m_fields[level + 1].data();
+    const uint32_t pw = coarsest ? 0 : m_fieldWidths[level + 1];
+    const uint32_t ph = coarsest ? 0 : m_fieldHeights[level + 1];
+    const int range = coarsest ? BM_SEARCH_RANGE : BM_REFINE_RANGE;
+
+    m_pool->parallelFor(bh, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t by = begin; by < end; ++by)
+        {
+            const int y0 = std::min(std::max((int)(by * BM_BLOCK_STEP) - (BM_BLOCK_SIZE - BM_BLOCK_STEP) / 2, 0), height - BM_BLOCK_SIZE);
+            for (uint32_t bx = 0; bx < bw; ++bx)
+            {
+                const int x0 = std::min(std::max((int)(bx * BM_BLOCK_STEP) - (BM_BLOCK_SIZE - BM_BLOCK_STEP) / 2, 0), width - BM_BLOCK_SIZE);
+                const uint8_t* src = prev.row(y0) + x0;
+
+                // SAD of the window displaced by (dx, dy), or UINT_MAX if it leaves the image
+                auto cost = [&](int dx, int dy) -> uint32_t {
+                    int cx = x0 + dx, cy = y0 + dy;
+                    if (cx < 0 || cy < 0 || cx > width - BM_BLOCK_SIZE || cy > height - BM_BLOCK_SIZE)
+                        return UINT_MAX;
+                    return m_sad(src, cur.row(cy) + cx, prev.width);
+                };
+
+                // Start from the best of the zero vector, the upsampled coarse vector and the left neighbour
+                int bestx = 0, besty = 0;
+                uint32_t best = cost(0, 0);
+                if (parent) {
+                    const NV_OF_FLOW_VECTOR& p = parent[std::min(by / 2, ph - 1) * pw + std::min(bx / 2, pw - 1)];
+                    uint32_t c = cost(2 * p.flowx, 2 * p.flowy);
+                    if (c < best) { best = c; bestx = 2 * p.flowx; besty = 2 * p.flowy; }
+                }
+                if (bx > 0 && !finest) {
+                    const NV_OF_FLOW_VECTOR& l = field[by * bw + bx - 1];
+                    uint32_t c = cost(l.flowx, l.flowy);
+                    if (c < best) { best = c; bestx = l.flowx; besty = l.flowy; }
+                }
+
+                // Search around it
+                const int cx = bestx, cy = besty;
+                for (int dy = cy - range; dy <= cy + range; ++dy)
+                {
+                    for (int dx = cx - range; dx <= cx + range; ++dx)
+                    {
+                        uint32_t c = cost(dx, dy);
+                        if (c < best) { best = c; bestx = dx; besty = dy; }
+                    }
+                }
+
+                NV_OF_FLOW_VECTOR& v = field[by * bw + bx];
+                if (!finest) {
+                    v.flowx = (int16_t)bestx;
+                    v.flowy = (int16_t)besty;
+                    continue;
+                }
+
+                // Parabola through the costs around the minimum gives the sub-pixel offset
+                float fx = 0.0f, fy = 0.0f;
+                uint32_t l = cost(bestx - 1, besty), r = cost(bestx + 1, besty);
+                if (l != UINT_MAX && r != UINT_MAX && l + r > 2 * best)
+                    fx = std::min(std::max(((float)l - (float)r) / (2.0f * ((float)l + (float)r - 2.0f * best)), -0.5f), 0.5f);
+                uint32_t u = cost(bestx, besty - 1), d = cost(bestx, besty + 1);
+                if (u != UINT_MAX && d != UINT_MAX && u + d > 2 * best)
+                    fy = std::min(std::max(((float)u - (float)d) / (2.0f * ((float)u + (float)d - 2.0f * best)), -0.5f), 0.5f);
+                v.flowx = toFlowS10_5(bestx + fx);
+                v.flowy = toFlowS10_5(besty + fy);
+            }
+        }
+    });
+}
+
+void BlockMatchBackend::estimate(const std::vector<GrayImage>& prev, const std::vector<GrayImage>& cur, NV_OF_FLOW_VECTOR* flowdata) {
+    const size_t numlevels = prev.size();
+    m_fields.resize(numlevels);
+    m_fieldWidths.resize(numlevels);
+    m_fieldHeights.resize(numlevels);
+    for (size_t l = 0; l < numlevels; ++l) {
+        m_fieldWidths[l] = (prev[l].width + BM_BLOCK_STEP - 1) / BM_BLOCK_STEP;
+        m_fieldHeights[l] = (prev[l].height + BM_BLOCK_STEP - 1) / BM_BLOCK_STEP;
+        m_fields[l].resize((size_t)m_fieldWidths[l] * m_fieldHeights[l]);
+    }
+
+    // Coarse to fine
+    for (size_t l = numlevels; l-- > 0;)
+        matchLevel(prev[l], cur[l], (uint32_t)l, l == 0);
+
+    // Spread the block vectors over the output grid
+    const uint32_t grid = m_initparams.outGridSize;
+    const NV_OF_FLOW_VECTOR* field = m_fields[0].data();
+    const uint32_t bw = m_fieldWidths[0];
+    const uint32_t bh = m_fieldHeights[0];
+    m_pool->parallelFor(m_outheight, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            const NV_OF_FLOW_VECTOR* row = field + std::min(y * grid / BM_BLOCK_STEP, bh - 1) * bw;
+            NV_OF_FLOW_VECTOR* out = flowdata + (size_t)y * m_outwidth;
+            for (uint32_t x = 0; x < m_outwidth; ++x)
+                out[x] = row[std::min(x * grid / BM_BLOCK_STEP, bw - 1)];
+        }
+    });
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "cpuflow.h"
+
+#define BM_BLOCK_STEP 4         // spacing of the estimated vectors in pixels of each pyramid level
+#define BM_BLOCK_SIZE 8         // matched window, centered on its BM_BLOCK_STEP cell
+#define BM_LEVELS 3             // pyramid levels, the coarsest one is searched exhaustively
+#define BM_SEARCH_RANGE 8       // exhaustive search range on the coarsest level
+#define BM_REFINE_RANGE 2       // search range around the best predictor on the finer levels
+
+// Sum of absolute differences of two BM_BLOCK_SIZE x BM_BLOCK_SIZE windows sharing a row stride
+typedef uint32_t (*SadFunc)(const uint8_t* a, const uint8_t* b, uint32_t stride);
+
+// Function to pick the fastest SAD kernel the CPU supports (AVX2, SSE2 or scalar)
+SadFunc selectSadKernel();
+
+// CPU engine doing hierarchical block matching on the luma pyramid. The coarsest level is
+// searched exhaustively, finer levels only refine the upsampled coarse vector or the vector of
+// the left neighbour, and the finest level gets a parabolic sub-pixel fit.
+// Block rows are spread over the thread pool.
+class BlockMatchBackend : public CpuFlowBackend {
+public:
+    BlockMatchBackend(const NV_OF_INIT_PARAMS& initparams, uint32_t numthreads);
+
+protected:
+    void estimate(const std::vector<GrayImage>& prev, const std::vector<GrayImage>& cur, NV_OF_FLOW_VECTOR* flowdata);
+
+private:
+    void matchLevel(const GrayImage& prev, const GrayImage& cur, uint32_t level, bool finest);
+
+    SadFunc m_sad;
+    // Block vectors per level, whole pixels on the coarser levels and S10.5 on the finest one
+    std::vector<std::vector<NV_OF_FLOW_VECTOR> > m_fields;
+    std::vector<uint32_t> m_fieldWidths;
+    std::vector<uint32_t> m_fieldHeights;
+};
@@ -0,0 +1,42 @@
+#include "cpuflow.h"
+#include "flowsession.h"
+
+CpuFlowBackend::CpuFlowBackend(const NV_OF_INIT_PARAMS& initparams, uint32_t numlevels, uint32_t minlevelsize, uint32_t numthreads)
+    : m_initparams(initparams), m_pool(new ThreadPool(numthreads)),
+      m_numlevels(numlevels), m_minlevelsize(minlevelsize), m_newest(1), m_frames(0)
+{
+    calculateOutputDimensions(m_initparams, m_outwidth, m_outheight);
+}
+
+void CpuFlowBackend::addFrame(const uint8_t* frame) {
+    // The stale pyramid is overwritten in place, so its storage is reused from frame to frame
+    m_newest ^= 1;
+    std::vector<GrayImage>& pyramid = m_pyramids[m_newest];
+    if (pyramid.empty())
+        pyramid.resize(1);
+    extractLuma(frame, m_initparams.inputBufferFormat, m_initparams.width, m_initparams.height, pyramid[0], m_pool.get());
+    buildPyramid(pyramid, m_numlevels, m_minlevelsize, m_pool.get());
+    ++m_frames;
+}
+
+void CpuFlowBackend::estimatePair(NV_OF_FLOW_VECTOR* flowdata, NV_OF_FLOW_VECTOR* bwddata) {
+    estimate(m_pyramids[m_newest ^ 1], m_pyramids[m_newest], flowdata);
+    if (bwddata && hasBackward())
+        estimate(m_pyramids[m_newest], m_pyramids[m_newest ^ 1], bwddata);
+}
+
+bool CpuFlowBackend::compute(const uint8_t* frame, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata, NV_OF_FLOW_VECTOR* bwddata) {
+    addFrame(frame);
+    if (m_frames < 2)
+        return false;
+
+    estimatePair(flowdata, bwddata);
+    return true;
+}
+
+void CpuFlowBackend::compute(const uint8_t* frame1, const uint8_t* frame2, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata,
+                             NV_OF_FLOW_VECTOR* bwddata) {
+    addFrame(frame1);
+    addFrame(frame2);
+    estimatePair(flowdata, bwddata);
+}
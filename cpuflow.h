@@ -0,0 +1,51 @@
+#pragma once
+#include "flowbackend.h"
+#include "imgproc.h"
+#include "threadpool.h"
+#include <memory>
+
+// Base of the CPU engines. Converts every frame once into a luma pyramid, keeps the previous
+// pyramid around like the hardware session keeps the previous input buffer, and leaves the
+// actual estimation to the derived engine.
+class CpuFlowBackend : public FlowBackend {
+public:
+    CpuFlowBackend(const NV_OF_INIT_PARAMS& initparams, uint32_t numlevels, uint32_t minlevelsize, uint32_t numthreads);
+
+    // The CPU engines have no cost output, costdata is left untouched. The backward grid is a second estimate
+    // with the pyramids swapped, so predicting in both directions doubles the work.
+    bool compute(const uint8_t* frame, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata = nullptr, NV_OF_FLOW_VECTOR* bwddata = nullptr);
+    void advance(const uint8_t* frame) { addFrame(frame); }
+    void compute(const uint8_t* frame1, const uint8_t* frame2, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata = nullptr,
+                 NV_OF_FLOW_VECTOR* bwddata = nullptr);
+
+    const NV_OF_INIT_PARAMS& getInitParams() { return m_initparams; }
+    uint32_t getOutputWidth() { return m_outwidth; }
+    uint32_t getOutputHeight() { return m_outheight; }
+
+protected:
+    // Estimates the flow from prev to cur into the output grid
+    virtual void estimate(const std::vector<GrayImage>& prev, const std::vector<GrayImage>& cur, NV_OF_FLOW_VECTOR* flowdata) = 0;
+
+    NV_OF_INIT_PARAMS m_initparams;
+    uint32_t m_outwidth;
+    uint32_t m_outheight;
+    std::unique_ptr<ThreadPool> m_pool;
+
+private:
+    void addFrame(const uint8_t* frame);
+    // Estimates the flow between the two newest frames, and back when asked to
+    void estimatePair(NV_OF_FLOW_VECTOR* flowdata, NV_OF_FLOW_VECTOR* bwddata);
+
+    uint32_t m_numlevels;
+    uint32_t m_minlevelsize;
+    std::vector<GrayImage> m_pyramids[2];
+    uint32_t m_newest;
+    uint32_t m_frames;
+};
+
+// Function to convert a vector in pixels to the S10.5 format of NV_OF_FLOW_VECTOR
+inline int16_t toFlowS10_5(float v) {
+    float s = v * 32.0f;
+    s = s < -32768.0f ? -32768.0f : (s > 32767.0f ? 32767.0f : s);
+    return (int16_t)(s < 0 ? s - 0.5f : s + 0.5f);
+}
@@ -0,0 +1,176 @@
+#include "flowapi.h"
+#include "flowbackend.h"
+#include "flowcolor.h"
+#include "flowsession.h"
+#include "cuda.h"
+#include <memory>
+#include <mutex>
+#include <string>
+
+static_assert(FLOWVEC_FORMAT_GRAY8 == NV_OF_BUFFER_FORMAT_GRAYSCALE8 && FLOWVEC_FORMAT_NV12 == NV_OF_BUFFER_FORMAT_NV12 &&
+              FLOWVEC_FORMAT_ABGR8 == NV_OF_BUFFER_FORMAT_ABGR8, "FLOWVEC_FORMAT_* must match NV_OF_BUFFER_FORMAT");
+static_assert(sizeof(FlowvecVector) == sizeof(NV_OF_FLOW_VECTOR), "FlowvecVector must match NV_OF_FLOW_VECTOR");
+
+struct FlowvecContext {
+    CUcontext cuContext;
+    CUstream instream;
+    CUstream outstream;
+    std::unique_ptr<FlowBackend> backend;
+    uint32_t outwidth;
+    uint32_t outheight;
+};
+
+static thread_local std::string lastError;
+
+static FlowvecStatus fail(FlowvecStatus status, const std::string& message) {
+    lastError = message;
+    return status;
+}
+
+// Runs fn and turns exceptions into a status, nothing may escape through the C interface
+template <typename F>
+static FlowvecStatus guard(FlowvecStatus failure, F fn) {
+    try
+    {
+        fn();
+        return FLOWVEC_SUCCESS;
+    }
+    catch(const std::exception& e)
+    {
+        return fail(failure, e.what());
+    }
+    catch(...)
+    {
+        return fail(failure, "Unknown error");
+    }
+}
+
+static void destroyCuda(FlowvecContext* context) {
+    if (context->instream)
+        cuStreamDestroy(context->instream);
+    if (context->outstream)
+        cuStreamDestroy(context->outstream);
+    if (context->cuContext)
+        cuCtxDestroy(context->cuContext);
+}
+
+uint32_t flowvecGetVersion(void) {
+    return FLOWVEC_API_VERSION;
+}
+
+const char* flowvecGetLastError(void) {
+    return lastError.c_str();
+}
+
+FlowvecStatus flowvecCreate(const char* backend, int gpu, uint32_t width, uint32_t height, uint32_t format,
+                            uint32_t gridsize, uint32_t numthreads, FlowvecContext** context) {
+    if (!backend || !context)
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Null argument");
+    *context = nullptr;
+    if (format != FLOWVEC_FORMAT_GRAY8 && format != FLOWVEC_FORMAT_NV12 && format != FLOWVEC_FORMAT_ABGR8)
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Unsupported frame format");
+    if (gridsize != 1 && gridsize != 2 && gridsize != 4)
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Grid size must be 1, 2 or 4");
+    if (width < gridsize || height < gridsize)
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Frame smaller than the grid");
+
+    std::unique_ptr<FlowvecContext> created(new FlowvecContext());
+    created->cuContext = nullptr;
+    created->instream = nullptr;
+    created->outstream = nullptr;
+
+    // Same setup as ofvec, only the hardware backend needs a CUDA context
+    std::string name(backend);
+    if (backendNeedsCuda(name)) {
+        CUdevice cuDevice = 0;
+        if (cuInit(0) != CUDA_SUCCESS || cuDeviceGet(&cuDevice, gpu) != CUDA_SUCCESS ||
+            cuCtxCreate(&created->cuContext, 0, cuDevice) != CUDA_SUCCESS) {
+            destroyCuda(created.get());
+            return fail(FLOWVEC_ERROR_UNAVAILABLE, "Failed to create a CUDA context on GPU " + std::to_string(gpu));
+        }
+        if (cuStreamCreate(&created->instream, CU_STREAM_DEFAULT) != CUDA_SUCCESS ||
+            cuStreamCreate(&created->outstream, CU_STREAM_DEFAULT) != CUDA_SUCCESS) {
+            destroyCuda(created.get());
+            return fail(FLOWVEC_ERROR_UNAVAILABLE, "Failed to create the CUDA streams");
+        }
+    }
+
+    FlowvecContext* raw = created.get();
+    FlowvecStatus status = guard(FLOWVEC_ERROR_UNAVAILABLE, [&] {
+        raw->backend.reset(createFlowBackend(name, initializeOFParameters(width, height, gridsize, (NV_OF_BUFFER_FORMAT)format),
+                                             numthreads, raw->cuContext, raw->instream, raw->outstream));
+        raw->outwidth = raw->backend->getOutputWidth();
+        raw->outheight = raw->backend->getOutputHeight();
+    });
+    if (status != FLOWVEC_SUCCESS) {
+        destroyCuda(raw);
+        return status;
+    }
+    *context = created.release();
+    return FLOWVEC_SUCCESS;
+}
+
+void flowvecDestroy(FlowvecContext* context) {
+    if (!context)
+        return;
+    // The backend goes before the streams and context it uses
+    context->backend.reset();
+    destroyCuda(context);
+    delete context;
+}
+
+FlowvecStatus flowvecGetOutputSize(FlowvecContext* context, uint32_t* outwidth, uint32_t* outheight) {
+    if (!context || !outwidth || !outheight)
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Null argument");
+    *outwidth = context->outwidth;
+    *outheight = context->outheight;
+    return FLOWVEC_SUCCESS;
+}
+
+FlowvecStatus flowvecCompute(FlowvecContext* context, const uint8_t* frame1, const uint8_t* frame2, FlowvecVector* flow) {
+    if (!context || !frame1 || !frame2 || !flow)
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Null argument");
+    return guard(FLOWVEC_ERROR_FLOW, [&] {
+        context->backend->compute(frame1, frame2, (NV_OF_FLOW_VECTOR*)flow);
+    });
+}
+
+FlowvecStatus flowvecComputeBatch(FlowvecContext* context, const uint8_t* const* frames1, const uint8_t* const* frames2,
+                                  FlowvecVector* const* flows, uint32_t count) {
+    if (!context || (count > 0 && (!frames1 || !frames2 || !flows)))
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Null argument");
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!frames1[i] || !frames2[i] || !flows[i])
+            return fail(FLOWVEC_ERROR_INVALID_PARAM, "Null frame or flow in pair " + std::to_string(i));
+    }
+    return guard(FLOWVEC_ERROR_FLOW, [&] {
+        for (uint32_t i = 0; i < count; ++i) {
+            // The session still holds the second frame of the previous pair, so a chained pair only uploads its new frame
+            if (i > 0 && frames1[i] == frames2[i - 1])
+                context->backend->compute(frames2[i], (NV_OF_FLOW_VECTOR*)flows[i]);
+            else
+                context->backend->compute(frames1[i], frames2[i], (NV_OF_FLOW_VECTOR*)flows[i]);
+        }
+    });
+}
+
+FlowvecStatus flowvecComputeNext(FlowvecContext* context, const uint8_t* frame, FlowvecVector* flow, int* computed) {
+    if (!context || !frame || !flow)
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Null argument");
+    return guard(FLOWVEC_ERROR_FLOW, [&] {
+        bool done = context->backend->compute(frame, (NV_OF_FLOW_VECTOR*)flow);
+        if (computed)
+            *computed = done ? 1 : 0;
+    });
+}
+
+FlowvecStatus flowvecColorize(const FlowvecVector* flow, uint32_t outwidth, uint32_t outheight, uint8_t* bgr) {
+    if (!flow || !bgr)
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Null argument");
+    if (outwidth > 0xffff || outheight > 0xffff)
+        return fail(FLOWVEC_ERROR_INVALID_PARAM, "Grid too large");
+    static std::once_flag wheel;
+    std::call_once(wheel, MakeColorWheel);
+    postProcessVectors((const NV_OF_FLOW_VECTOR*)flow, bgr, (uint16_t)outwidth, (uint16_t)outheight);
+    return FLOWVEC_SUCCESS;
+}
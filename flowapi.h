@@ -0,0 +1,78 @@
+#pragma once
+/*
+ * C API of libflowvec.so. A context owns a flow session created once, and every call after that
+ * computes flow between frames the caller already holds in memory, into grids the caller owns.
+ * Nothing is copied on the way in or out besides the upload to the flow engine.
+ * A context must not be used by two threads at the same time, separate contexts are independent.
+ */
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define FLOWVEC_EXPORT __attribute__((visibility("default")))
+#else
+#define FLOWVEC_EXPORT
+#endif
+
+#define FLOWVEC_API_VERSION 1
+
+/* Input formats, frames are tightly packed. The values match NV_OF_BUFFER_FORMAT. */
+#define FLOWVEC_FORMAT_GRAY8 1      /* 1 byte per pixel */
+#define FLOWVEC_FORMAT_NV12 2       /* luma plane followed by the interleaved half height chroma plane */
+#define FLOWVEC_FORMAT_ABGR8 3      /* 4 bytes per pixel */
+
+typedef enum {
+    FLOWVEC_SUCCESS = 0,
+    FLOWVEC_ERROR_INVALID_PARAM = 1,    /* bad argument, see flowvecGetLastError() */
+    FLOWVEC_ERROR_UNAVAILABLE = 2,      /* the backend could not be created */
+    FLOWVEC_ERROR_FLOW = 3,             /* the flow engine failed */
+} FlowvecStatus;
+
+/* One vector of the output grid, x and y in S10.5 fixed point pixels, same layout as NV_OF_FLOW_VECTOR */
+typedef struct {
+    int16_t flowx;
+    int16_t flowy;
+} FlowvecVector;
+
+typedef struct FlowvecContext FlowvecContext;
+
+FLOWVEC_EXPORT uint32_t flowvecGetVersion(void);
+
+/* Message of the last failed call on this thread */
+FLOWVEC_EXPORT const char* flowvecGetLastError(void);
+
+/* Creates a context for frames of one size and format. backend is "nvof", "blockmatch" or "lk",
+ * gpu is only used by "nvof", numthreads only by the CPU backends (0 = all hardware threads).
+ * gridsize is 1, 2 or 4. */
+FLOWVEC_EXPORT FlowvecStatus flowvecCreate(const char* backend, int gpu, uint32_t width, uint32_t height, uint32_t format,
+                                           uint32_t gridsize, uint32_t numthreads, FlowvecContext** context);
+
+FLOWVEC_EXPORT void flowvecDestroy(FlowvecContext* context);
+
+/* Size of the output grid, every flow buffer holds outwidth * outheight vectors */
+FLOWVEC_EXPORT FlowvecStatus flowvecGetOutputSize(FlowvecContext* context, uint32_t* outwidth, uint32_t* outheight);
+
+/* Computes the flow from frame1 to frame2 */
+FLOWVEC_EXPORT FlowvecStatus flowvecCompute(FlowvecContext* context, const uint8_t* frame1, const uint8_t* frame2,
+                                            FlowvecVector* flow);
+
+/* Computes count pairs. When a pair starts with the frame the previous pair ended with (the same
+ * pointer), that frame is not uploaded again, so a run of consecutive video frames costs one
+ * upload per frame. Stops at the first failure. */
+FLOWVEC_EXPORT FlowvecStatus flowvecComputeBatch(FlowvecContext* context, const uint8_t* const* frames1,
+                                                 const uint8_t* const* frames2, FlowvecVector* const* flows, uint32_t count);
+
+/* Streaming form: takes the next frame of a video and computes the flow from the previous one.
+ * Sets *computed to 0 for the first frame, which only primes the session. */
+FLOWVEC_EXPORT FlowvecStatus flowvecComputeNext(FlowvecContext* context, const uint8_t* frame, FlowvecVector* flow,
+                                                int* computed);
+
+/* Colors a grid for viewing, writing outwidth * outheight BGR pixels */
+FLOWVEC_EXPORT FlowvecStatus flowvecColorize(const FlowvecVector* flow, uint32_t outwidth, uint32_t outheight, uint8_t* bgr);
+
+#ifdef __cplusplus
+}
+#endif
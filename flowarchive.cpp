@@ -0,0 +1,165 @@
+#include "flowarchive.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Rounds offset up to the payload alignment
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + FLOW_ARCHIVE_ALIGNMENT - 1) / FLOW_ARCHIVE_ALIGNMENT * FLOW_ARCHIVE_ALIGNMENT;
+}
+
+FlowArchiveWriter::FlowArchiveWriter(const std::string& path, uint32_t width, uint32_t height, uint32_t gridsize)
+    : m_fd(-1), m_end(0) {
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_fd < 0)
+        throw std::runtime_error("Failed to open " + path);
+
+    struct stat info;
+    if (fstat(m_fd, &info) == 0 && info.st_size >= (off_t)sizeof(FlowArchiveHeader) &&
+        pread(m_fd, &m_header, sizeof(m_header), 0) == (ssize_t)sizeof(m_header)) {
+        // Continue an existing archive, whatever was written after the last published frame is dropped
+        if (memcmp(m_header.magic, "NVFA", 4) != 0 || m_header.version != FLOW_ARCHIVE_VERSION ||
+            m_header.width != width || m_header.height != height || m_header.gridsize != gridsize) {
+            close(m_fd);
+            throw std::runtime_error(path + " is not a flow archive of the same grid");
+        }
+        m_end = (uint64_t)info.st_size;
+        return;
+    }
+
+    memset(&m_header, 0, sizeof(m_header));
+    memcpy(m_header.magic, "NVFA", 4);
+    m_header.version = FLOW_ARCHIVE_VERSION;
+    m_header.width = width;
+    m_header.height = height;
+    m_header.gridsize = gridsize;
+    m_header.framebytes = (uint64_t)width * height * sizeof(NV_OF_FLOW_VECTOR);
+    if (ftruncate(m_fd, 0) != 0) {
+        close(m_fd);
+        throw std::runtime_error("Failed to truncate " + path);
+    }
+    writeAt(&m_header, sizeof(m_header), 0);
+    m_end = sizeof(m_header);
+}
+
+FlowArchiveWriter::~FlowArchiveWriter() {
+    close(m_fd);
+}
+
+void FlowArchiveWriter::writeAt(const void* data, size_t size, uint64_t offset) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (size > 0) {
+        ssize_t written = pwrite(m_fd, bytes, size, (off_t)offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            throw std::runtime_error("Failed to write the flow archive");
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+void FlowArchiveWriter::append(const NV_OF_FLOW_VECTOR* flowdata) {
+    uint64_t n = m_header.numframes;
+    uint64_t block = n / FLOW_ARCHIVE_INDEX_ENTRIES;
+    if (block >= FLOW_ARCHIVE_MAX_BLOCKS)
+        throw std::runtime_error("The flow archive is full");
+
+    // A new index block comes right before the first frame it indexes
+    if (m_header.blocks[block] == 0) {
+        uint64_t offset = alignOffset(m_end);
+        static const uint64_t empty[FLOW_ARCHIVE_INDEX_ENTRIES] = { 0 };
+        writeAt(empty, sizeof(empty), offset);
+        m_end = offset + sizeof(empty);
+        m_header.blocks[block] = offset;
+        writeAt(&m_header.blocks[block], sizeof(uint64_t), offsetof(FlowArchiveHeader, blocks) + block * sizeof(uint64_t));
+    }
+
+    uint64_t payload = alignOffset(m_end);
+    writeAt(flowdata, m_header.framebytes, payload);
+    m_end = payload + m_header.framebytes;
+    writeAt(&payload, sizeof(payload), m_header.blocks[block] + (n % FLOW_ARCHIVE_INDEX_ENTRIES) * sizeof(uint64_t));
+
+    // Publishing the count last means readers never see a frame before its payload and index entry
+    m_header.numframes = n + 1;
+    writeAt(&m_header.numframes, sizeof(uint64_t), offsetof(FlowArchiveHeader, numframes));
+}
+
+FlowArchiveReader::FlowArchiveReader(const std::string& path)
+    : m_fd(-1), m_data(nullptr), m_size(0), m_numframes(0) {
+    m_fd = open(path.c_str(), O_RDONLY);
+    if (m_fd < 0)
+        throw std::runtime_error("Failed to open " + path);
+    struct stat info;
+    if (fstat(m_fd, &info) != 0 || info.st_size < (off_t)sizeof(FlowArchiveHeader)) {
+        close(m_fd);
+        throw std::runtime_error(path + " is not a flow archive");
+    }
+    map((size_t)info.st_size);
+    if (memcmp(header()->magic, "NVFA", 4) != 0 || header()->version != FLOW_ARCHIVE_VERSION ||
+        header()->framebytes != (uint64_t)header()->width * header()->height * sizeof(NV_OF_FLOW_VECTOR)) {
+        munmap((void*)m_data, m_size);
+        close(m_fd);
+        throw std::runtime_error(path + " is not a flow archive");
+    }
+    refresh();
+}
+
+FlowArchiveReader::~FlowArchiveReader() {
+    munmap((void*)m_data, m_size);
+    close(m_fd);
+}
+
+void FlowArchiveReader::map(size_t size) {
+    if (m_data)
+        munmap((void*)m_data, m_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (mapping == MAP_FAILED) {
+        m_data = nullptr;
+        throw std::runtime_error("Failed to map the flow archive");
+    }
+    m_data = (const uint8_t*)mapping;
+    m_size = size;
+}
+
+// Offset of the payload of frame n from its index entry, 0 if the index block, the entry or the payload
+// is not inside the mapping on the alignment the writer keeps
+uint64_t FlowArchiveReader::payloadOffset(uint64_t n) {
+    if (n / FLOW_ARCHIVE_INDEX_ENTRIES >= FLOW_ARCHIVE_MAX_BLOCKS)
+        return 0;
+    uint64_t block = header()->blocks[n / FLOW_ARCHIVE_INDEX_ENTRIES];
+    uint64_t entry = (n % FLOW_ARCHIVE_INDEX_ENTRIES) * sizeof(uint64_t);
+    if (block == 0 || block % FLOW_ARCHIVE_ALIGNMENT != 0 || block > m_size || m_size - block < entry + sizeof(uint64_t))
+        return 0;
+    uint64_t payload = *(const uint64_t*)(m_data + block + entry);
+    if (payload == 0 || payload % FLOW_ARCHIVE_ALIGNMENT != 0 || payload > m_size || m_size - payload < header()->framebytes)
+        return 0;
+    return payload;
+}
+
+uint64_t FlowArchiveReader::refresh() {
+    uint64_t numframes = __atomic_load_n(&header()->numframes, __ATOMIC_ACQUIRE);
+    if (numframes > m_numframes && numframes > 0) {
+        // The newest frame is the last thing in the file, remap if it lies beyond the mapping
+        if (payloadOffset(numframes - 1) == 0) {
+            struct stat info;
+            if (fstat(m_fd, &info) != 0)
+                throw std::runtime_error("Failed to read the size of the flow archive");
+            map((size_t)info.st_size);
+        }
+    }
+    m_numframes = numframes;
+    return m_numframes;
+}
+
+const NV_OF_FLOW_VECTOR* FlowArchiveReader::frame(uint64_t n) {
+    if (n >= m_numframes)
+        return nullptr;
+    uint64_t payload = payloadOffset(n);
+    return payload ? (const NV_OF_FLOW_VECTOR*)(m_data + payload) : nullptr;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+#include <stddef.h>
+#include <string>
+
+#define FLOW_ARCHIVE_VERSION 1
+#define FLOW_ARCHIVE_INDEX_ENTRIES 4096   // frame offsets per index block
+#define FLOW_ARCHIVE_MAX_BLOCKS 1019      // index blocks the header can point to, fills the header up to 8 KB
+#define FLOW_ARCHIVE_ALIGNMENT 64         // every frame payload starts on this boundary
+
+// Start of a flow archive. The index is a two level table: the header points to index blocks,
+// each block holds the file offsets of FLOW_ARCHIVE_INDEX_ENTRIES frames, so the payload of
+// any frame is found with two lookups. Blocks and payloads are allocated at the end of the file
+// as frames are appended, numframes is only raised once a frame is completely written.
+struct FlowArchiveHeader {
+    char magic[4];          // "NVFA"
+    uint32_t version;
+    uint32_t width;         // vectors per row
+    uint32_t height;        // rows of vectors
+    uint32_t gridsize;      // pixels per vector in each direction
+    uint32_t reserved;
+    uint64_t framebytes;    // size of every payload, width * height NV_OF_FLOW_VECTOR
+    uint64_t numframes;     // frames readers may access
+    uint64_t blocks[FLOW_ARCHIVE_MAX_BLOCKS]; // file offset of each index block, 0 until allocated
+};
+
+// Appends flow frames to an archive with plain positional writes, so readers mapping the same
+// file see every frame as soon as it is published. An existing archive with the same grid is
+// continued instead of overwritten.
+class FlowArchiveWriter {
+public:
+    FlowArchiveWriter(const std::string& path, uint32_t width, uint32_t height, uint32_t gridsize);
+    ~FlowArchiveWriter();
+
+    void append(const NV_OF_FLOW_VECTOR* flowdata);
+    uint64_t getNumFrames() { return m_header.numframes; }
+
+private:
+    void writeAt(const void* data, size_t size, uint64_t offset);
+
+    int m_fd;
+    FlowArchiveHeader m_header;
+    uint64_t m_end;
+};
+
+// Maps an archive read-only and hands out frames in place. refresh() picks up frames appended
+// since the file was opened, so a running archive can be tailed.
+class FlowArchiveReader {
+public:
+    explicit FlowArchiveReader(const std::string& path);
+    ~FlowArchiveReader();
+
+    // Remaps the file if frames were appended beyond the current mapping and returns the frame
+    // count. Pointers returned by frame() before a remap are no longer valid.
+    uint64_t refresh();
+
+    // Vector grid of frame n, nullptr if that frame is not in the archive yet or its index entry or
+    // payload lies outside of the file, as in a truncated or corrupt archive
+    const NV_OF_FLOW_VECTOR* frame(uint64_t n);
+
+    uint64_t getNumFrames() { return m_numframes; }
+    uint32_t getWidth() { return header()->width; }
+    uint32_t getHeight() { return header()->height; }
+    uint32_t getGridSize() { return header()->gridsize; }
+
+private:
+    const FlowArchiveHeader* header() { return (const FlowArchiveHeader*)m_data; }
+    void map(size_t size);
+    uint64_t payloadOffset(uint64_t n);
+
+    int m_fd;
+    const uint8_t* m_data;
+    size_t m_size;
+    uint64_t m_numframes;
+};
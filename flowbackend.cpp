@@ -0,0 +1,22 @@
+#include "flowbackend.h"
+#include "flowsession.h"
+#include "blockmatch.h"
+#include "lucaskanade.h"
+
+// Function to check whether a backend needs a CUDA context
+bool backendNeedsCuda(const std::string& name) {
+    return name == "nvof";
+}
+
+// Function to create a backend by name
+FlowBackend* createFlowBackend(const std::string& name, const NV_OF_INIT_PARAMS& initparams, uint32_t numthreads,
+                               CUcontext context, CUstream instream, CUstream outstream) {
+    if (name == "nvof")
+        return new FlowSession(context, instream, outstream, initparams);
+    if (name == "blockmatch")
+        return new BlockMatchBackend(initparams, numthreads);
+    if (name == "lk")
+        return new LucasKanadeBackend(initparams, numthreads);
+
+    NVOF_THROW_ERROR("Unknown flow backend " + name, NV_OF_ERR_INVALID_PARAM);
+}
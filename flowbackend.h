@@ -0,0 +1,43 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCuda.h"
+#include <string>
+
+// Common interface of every engine that turns frames into NV_OF_FLOW_VECTOR grids.
+// The grid is sized exactly like the hardware output buffer (see calculateOutputDimensions),
+// so the post processing does not care which engine produced it.
+class FlowBackend {
+public:
+    virtual ~FlowBackend() {}
+
+    // Takes the newest frame of a stream. Once two frames have been seen, computes the flow
+    // from the previous frame to this one into flowdata and returns true.
+    // Engines with cost output (see hasCost) also fill costdata when it is given, engines predicting in both
+    // directions (see hasBackward) fill bwddata with the flow from this frame back to the previous one.
+    virtual bool compute(const uint8_t* frame, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata = nullptr,
+                         NV_OF_FLOW_VECTOR* bwddata = nullptr) = 0;
+
+    // Takes the newest frame of a stream without computing any flow, the next compute() pairs with it
+    virtual void advance(const uint8_t* frame) = 0;
+
+    // Computes the flow from frame1 to frame2 of an independent pair into flowdata
+    virtual void compute(const uint8_t* frame1, const uint8_t* frame2, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata = nullptr,
+                         NV_OF_FLOW_VECTOR* bwddata = nullptr) = 0;
+
+    // Whether the engine rates every vector with an 8 bit cost laid out like the grid, higher meaning less confident
+    virtual bool hasCost() { return false; }
+
+    // Whether the engine was set up with NV_OF_PRED_DIRECTION_BOTH and also returns the backward grid
+    bool hasBackward() { return getInitParams().predDirection == NV_OF_PRED_DIRECTION_BOTH; }
+
+    virtual const NV_OF_INIT_PARAMS& getInitParams() = 0;
+    virtual uint32_t getOutputWidth() = 0;
+    virtual uint32_t getOutputHeight() = 0;
+};
+
+// Function to create a backend by name: "nvof" for the hardware engine, "blockmatch" or "lk" for the CPU engines.
+// The CUDA context and streams are only used by the hardware engine, numthreads only by the CPU engines.
+FlowBackend* createFlowBackend(const std::string& name, const NV_OF_INIT_PARAMS& initparams, uint32_t numthreads,
+                               CUcontext context, CUstream instream, CUstream outstream);
+
+// Function to check whether a backend needs a CUDA context
+bool backendNeedsCuda(const std::string& name);
@@ -0,0 +1,125 @@
+#include "flowcheck.h"
+#include "threadpool.h"
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
+// Checks cells [begin, end) of row y one at a time, shift turns S10.5 vectors into whole cells
+static void checkCells(const NV_OF_FLOW_VECTOR* forward, const NV_OF_FLOW_VECTOR* backward, uint32_t outwidth, uint32_t outheight,
+                       uint32_t y, uint32_t begin, uint32_t end, uint32_t shift, float beta, uint8_t* mask)
+{
+    const NV_OF_FLOW_VECTOR* row = forward + (size_t)y * outwidth;
+    uint8_t* maskrow = mask + (size_t)y * outwidth;
+    const int32_t half = 1 << (shift - 1);
+    for (uint32_t x = begin; x < end; ++x)
+    {
+        int32_t fx = row[x].flowx;
+        int32_t fy = row[x].flowy;
+        int32_t lx = (int32_t)x + ((fx + half) >> shift);
+        int32_t ly = (int32_t)y + ((fy + half) >> shift);
+        if (lx < 0 || ly < 0 || lx >= (int32_t)outwidth || ly >= (int32_t)outheight)
+        {
+            maskrow[x] = FLOW_MASK_OCCLUDED;
+            continue;
+        }
+        const NV_OF_FLOW_VECTOR& b = backward[(size_t)ly * outwidth + lx];
+        float sx = (float)(fx + b.flowx);
+        float sy = (float)(fy + b.flowy);
+        float len2 = (float)(fx * fx) + (float)(fy * fy) + (float)(b.flowx * b.flowx) + (float)(b.flowy * b.flowy);
+        if (sx * sx + sy * sy > FLOW_CHECK_ALPHA * len2 + beta)
+            maskrow[x] = FLOW_MASK_OCCLUDED;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Checks row y four cells at a time. The landing cells are computed in the vector lanes, only the gather of
+// the backward vectors goes through memory since SSE2 has no gather.
+static void checkRowSSE2(const NV_OF_FLOW_VECTOR* forward, const NV_OF_FLOW_VECTOR* backward, uint32_t outwidth, uint32_t outheight,
+                         uint32_t y, uint32_t shift, float beta, uint8_t* mask)
+{
+    const NV_OF_FLOW_VECTOR* row = forward + (size_t)y * outwidth;
+    uint8_t* maskrow = mask + (size_t)y * outwidth;
+    const __m128i count = _mm_cvtsi32_si128((int)shift);
+    const __m128i half = _mm_set1_epi32(1 << (shift - 1));
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lastx = _mm_set1_epi32((int32_t)outwidth - 1);
+    const __m128i lasty = _mm_set1_epi32((int32_t)outheight - 1);
+    const __m128i ys = _mm_set1_epi32((int32_t)y);
+    const __m128 alpha = _mm_set1_ps(FLOW_CHECK_ALPHA);
+    const __m128 betas = _mm_set1_ps(beta);
+
+    uint32_t x = 0;
+    for (; x + 4 <= outwidth; x += 4)
+    {
+        __m128i f = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i fx = _mm_srai_epi32(_mm_slli_epi32(f, 16), 16);
+        __m128i fy = _mm_srai_epi32(f, 16);
+        __m128i lx = _mm_add_epi32(_mm_add_epi32(_mm_set1_epi32((int32_t)x), lanes), _mm_sra_epi32(_mm_add_epi32(fx, half), count));
+        __m128i ly = _mm_add_epi32(ys, _mm_sra_epi32(_mm_add_epi32(fy, half), count));
+
+        // Cells leaving the frame fail, their landing cell is clamped so the gather needs no branches
+        __m128i below = _mm_or_si128(_mm_cmplt_epi32(lx, zero), _mm_cmplt_epi32(ly, zero));
+        __m128i abovex = _mm_cmpgt_epi32(lx, lastx);
+        __m128i abovey = _mm_cmpgt_epi32(ly, lasty);
+        __m128i outside = _mm_or_si128(below, _mm_or_si128(abovex, abovey));
+        lx = _mm_or_si128(_mm_andnot_si128(abovex, _mm_andnot_si128(_mm_cmplt_epi32(lx, zero), lx)), _mm_and_si128(abovex, lastx));
+        ly = _mm_or_si128(_mm_andnot_si128(abovey, _mm_andnot_si128(_mm_cmplt_epi32(ly, zero), ly)), _mm_and_si128(abovey, lasty));
+
+        int32_t lxs[4], lys[4];
+        _mm_storeu_si128((__m128i*)lxs, lx);
+        _mm_storeu_si128((__m128i*)lys, ly);
+        const int32_t* cells = (const int32_t*)backward;
+        __m128i b = _mm_setr_epi32(cells[(size_t)lys[0] * outwidth + lxs[0]], cells[(size_t)lys[1] * outwidth + lxs[1]],
+                                   cells[(size_t)lys[2] * outwidth + lxs[2]], cells[(size_t)lys[3] * outwidth + lxs[3]]);
+
+        // Squared lengths in float, summed in the order of checkCells so both give the same bits. Squaring the
+        // int16 pairs with madd would overflow for (-32768, -32768), whose squares add up to 2^31.
+        __m128i bx = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        __m128i by = _mm_srai_epi32(b, 16);
+        __m128 fxf = _mm_cvtepi32_ps(fx), fyf = _mm_cvtepi32_ps(fy);
+        __m128 bxf = _mm_cvtepi32_ps(bx), byf = _mm_cvtepi32_ps(by);
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(fxf, fxf), _mm_mul_ps(fyf, fyf)), _mm_mul_ps(bxf, bxf)),
+                                 _mm_mul_ps(byf, byf));
+        __m128 sx = _mm_cvtepi32_ps(_mm_add_epi32(fx, bx));
+        __m128 sy = _mm_cvtepi32_ps(_mm_add_epi32(fy, by));
+        __m128 err = _mm_add_ps(_mm_mul_ps(sx, sx), _mm_mul_ps(sy, sy));
+        __m128i fail = _mm_or_si128(_mm_castps_si128(_mm_cmpgt_ps(err, _mm_add_ps(_mm_mul_ps(alpha, len2), betas))), outside);
+
+        // The all ones lanes narrow to FLOW_MASK_OCCLUDED bytes and are merged into the mask
+        fail = _mm_packs_epi16(_mm_packs_epi32(fail, fail), fail);
+        uint32_t bytes;
+        memcpy(&bytes, maskrow + x, 4);
+        bytes |= (uint32_t)_mm_cvtsi128_si32(fail);
+        memcpy(maskrow + x, &bytes, 4);
+    }
+    checkCells(forward, backward, outwidth, outheight, y, x, outwidth, shift, beta, mask);
+}
+#endif
+
+// Forward-backward consistency check, see flowcheck.h
+void checkConsistency(const NV_OF_FLOW_VECTOR* forward, const NV_OF_FLOW_VECTOR* backward, uint32_t outwidth, uint32_t outheight,
+                      uint32_t gridsize, float tolerance, uint8_t* mask, ThreadPool* pool) {
+    // S10.5 to whole cells is a rounding shift for power of two grids
+    uint32_t shift = 5;
+    while ((1u << (shift - 5)) < gridsize)
+        ++shift;
+    // The tolerance in squared S10.5 units
+    const float beta = tolerance * tolerance * 1024.0f;
+
+    auto band = [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            checkRowSSE2(forward, backward, outwidth, outheight, y, shift, beta, mask);
+#else
+            checkCells(forward, backward, outwidth, outheight, y, 0, outwidth, shift, beta, mask);
+#endif
+        }
+    };
+    if (pool)
+        pool->parallelFor(outheight, band);
+    else
+        band(0, outheight);
+}
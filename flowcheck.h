@@ -0,0 +1,16 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+
+class ThreadPool;
+
+#define FLOW_CHECK_ALPHA 0.01f      // share of the squared vector lengths the round trip may miss by
+#define FLOW_MASK_OCCLUDED 255      // mask value of vectors failing the consistency check
+
+// Forward-backward consistency check of a bidirectional flow pair sharing one grid of outwidth x outheight
+// cells of gridsize pixels (a power of two). The forward vector f of every cell is followed to the nearest cell
+// of the backward grid, whose vector b has to bring it back:
+//     |f + b|^2 <= FLOW_CHECK_ALPHA * (|f|^2 + |b|^2) + tolerance^2, tolerance in pixels.
+// Cells failing the check or leaving the frame get FLOW_MASK_OCCLUDED in mask, the others keep their value,
+// so the mask can be a cost grid or a cleared one. Rows are split into bands on the pool and checked with SSE2.
+void checkConsistency(const NV_OF_FLOW_VECTOR* forward, const NV_OF_FLOW_VECTOR* backward, uint32_t outwidth, uint32_t outheight,
+                      uint32_t gridsize, float tolerance, uint8_t* mask, ThreadPool* pool = nullptr);
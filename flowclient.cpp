@@ -0,0 +1,109 @@
+#include "flowclient.h"
+#include "imgproc.h"
+#include <fcntl.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+FlowClient::FlowClient(const std::string& path)
+    : m_socket(-1), m_memfd(-1), m_buffer(nullptr), m_buffersize(0), m_newbuffer(false), m_framesize(0),
+      m_framepitch(0), m_outwidth(0), m_outheight(0) {
+    memset(&m_request, 0, sizeof(m_request));
+    memcpy(m_request.magic, "NVRQ", 4);
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path too long: " + path);
+    strcpy(address.sun_path, path.c_str());
+    m_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_socket < 0)
+        throw std::runtime_error("Failed to create the socket");
+    if (connect(m_socket, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(m_socket);
+        throw std::runtime_error("Failed to connect to " + path);
+    }
+}
+
+FlowClient::~FlowClient() {
+    if (m_buffer)
+        munmap(m_buffer, m_buffersize);
+    if (m_memfd >= 0)
+        close(m_memfd);
+    close(m_socket);
+}
+
+void FlowClient::configure(NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height, uint32_t gridsize) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    m_framesize = frameSize(format, width, height);
+    m_framepitch = (m_framesize + page - 1) / page * page;
+    // Same output size as calculateOutputDimensions
+    m_outwidth = gridsize ? width / gridsize : 0;
+    m_outheight = gridsize ? height / gridsize : 0;
+    size_t size = 2 * m_framepitch + (size_t)m_outwidth * m_outheight * sizeof(NV_OF_FLOW_VECTOR);
+
+    if (size > m_buffersize) {
+        if (m_buffer)
+            munmap(m_buffer, m_buffersize);
+        if (m_memfd >= 0)
+            close(m_memfd);
+        m_buffer = nullptr;
+        m_buffersize = 0;
+        // The server only maps buffers that cannot shrink under it
+        m_memfd = memfd_create("flowclient", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (m_memfd < 0 || ftruncate(m_memfd, (off_t)size) != 0 || fcntl(m_memfd, F_ADD_SEALS, F_SEAL_SHRINK) != 0)
+            throw std::runtime_error("Failed to create the shared buffer");
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+        if (mapping == MAP_FAILED)
+            throw std::runtime_error("Failed to map the shared buffer");
+        m_buffer = (uint8_t*)mapping;
+        m_buffersize = size;
+        m_newbuffer = true;
+    }
+
+    m_request.format = format;
+    m_request.width = width;
+    m_request.height = height;
+    m_request.gridsize = gridsize;
+    m_request.frame1 = 0;
+    m_request.frame2 = m_framepitch;
+    m_request.flow = 2 * m_framepitch;
+}
+
+const NV_OF_FLOW_VECTOR* FlowClient::compute() {
+    if (!m_buffer)
+        throw std::runtime_error("FlowClient is not configured");
+    ++m_request.id;
+    m_request.flags = m_newbuffer ? FLOW_REQUEST_BUFFER : 0;
+    m_request.buffersize = m_buffersize;
+    if (!sendMessage(m_socket, &m_request, sizeof(m_request), m_newbuffer ? m_memfd : -1))
+        throw std::runtime_error("Failed to send the request");
+    m_newbuffer = false;
+
+    FlowReply reply;
+    int fd;
+    if (!receiveMessage(m_socket, &reply, sizeof(reply), fd))
+        throw std::runtime_error("The server closed the connection");
+    if (fd >= 0)
+        close(fd);
+    if (memcmp(reply.magic, "NVRP", 4) != 0 || reply.id != m_request.id)
+        throw std::runtime_error("Bad reply from the server");
+    if (reply.status != 0) {
+        reply.error[FLOW_ERROR_SIZE - 1] = 0;
+        throw std::runtime_error(reply.error);
+    }
+    return (const NV_OF_FLOW_VECTOR*)(m_buffer + m_request.flow);
+}
+
+void FlowClient::compute(const uint8_t* frame1, const uint8_t* frame2, NV_OF_FLOW_VECTOR* flowdata) {
+    if (!m_buffer)
+        throw std::runtime_error("FlowClient is not configured");
+    memcpy(getFrame1(), frame1, m_framesize);
+    memcpy(getFrame2(), frame2, m_framesize);
+    const NV_OF_FLOW_VECTOR* flow = compute();
+    memcpy(flowdata, flow, (size_t)m_outwidth * m_outheight * sizeof(NV_OF_FLOW_VECTOR));
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+#include "flowprotocol.h"
+#include <stddef.h>
+#include <string>
+
+// Client of ofserver. Frames are written straight into a memfd buffer shared with the server,
+// so a request only sends offsets over the socket and the flow comes back in the same buffer.
+// One request is in flight per client, use one client per thread.
+class FlowClient {
+public:
+    explicit FlowClient(const std::string& path);
+    ~FlowClient();
+
+    // Sizes the shared buffer for frame pairs of this shape, it is only reallocated when it grows
+    void configure(NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height, uint32_t gridsize);
+
+    // Frames of the next pair, filled in place by the caller
+    uint8_t* getFrame1() { return m_buffer; }
+    uint8_t* getFrame2() { return m_buffer + m_framepitch; }
+
+    // Computes the flow from the first frame to the second, the grid stays valid until the next call.
+    // Throws std::runtime_error with the server's message on failure.
+    const NV_OF_FLOW_VECTOR* compute();
+
+    // Copies both frames in, computes the flow and copies it out
+    void compute(const uint8_t* frame1, const uint8_t* frame2, NV_OF_FLOW_VECTOR* flowdata);
+
+    uint32_t getOutputWidth() { return m_outwidth; }
+    uint32_t getOutputHeight() { return m_outheight; }
+
+private:
+    int m_socket;
+    int m_memfd;
+    uint8_t* m_buffer;
+    size_t m_buffersize;
+    bool m_newbuffer;
+    FlowRequest m_request;
+    size_t m_framesize;
+    size_t m_framepitch;
+    uint32_t m_outwidth;
+    uint32_t m_outheight;
+};
@@ -0,0 +1,377 @@
+#include "flowcodec.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
+#define FLOW_CODEC_PAD 3    // zero bytes closing every band, so unpackBlock may read whole words
+
+enum BandMode {
+    BAND_SPATIAL,   // residuals of the grid itself
+    BAND_TEMPORAL,  // residuals of the difference from the previous grid
+};
+
+// Runs fn over all bands, on the pool if there is one
+static void forEachBand(uint32_t bands, ThreadPool* pool, const std::function<void(uint32_t, uint32_t)>& fn) {
+    if (pool)
+        pool->parallelFor(bands, fn);
+    else
+        fn(0, bands);
+}
+
+static inline int16_t medianPredict(int16_t a, int16_t b, int16_t c) {
+    int16_t g = (int16_t)(uint16_t)(a + b - c);
+    return std::max(std::min(a, b), std::min(std::max(a, b), g));
+}
+
+static inline uint16_t zigzag(int16_t r) {
+    return (uint16_t)(((uint16_t)r << 1) ^ (uint16_t)(r >> 15));
+}
+
+static inline int16_t unzigzag(uint16_t z) {
+    return (int16_t)((z >> 1) ^ (uint16_t)-(int16_t)(z & 1));
+}
+
+// Writes the zigzag residuals of a row of n interleaved components. Each component is predicted from
+// its left, upper and upper left neighbour, or only the left one on the first row of a band (up is nullptr).
+static void predictRow(const int16_t* cur, const int16_t* up, uint32_t n, uint16_t* res) {
+    uint32_t x = 0;
+    for (; x < std::min(2u, n); ++x)
+        res[x] = zigzag((int16_t)(uint16_t)(cur[x] - (up ? up[x] : 0)));
+#if defined(__x86_64__) || defined(__i386__)
+    for (; x + 8 <= n; x += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(cur + x - 2));
+        __m128i v = _mm_loadu_si128((const __m128i*)(cur + x));
+        __m128i pred = a;
+        if (up) {
+            __m128i b = _mm_loadu_si128((const __m128i*)(up + x));
+            __m128i c = _mm_loadu_si128((const __m128i*)(up + x - 2));
+            __m128i g = _mm_sub_epi16(_mm_add_epi16(a, b), c);
+            pred = _mm_max_epi16(_mm_min_epi16(a, b), _mm_min_epi16(_mm_max_epi16(a, b), g));
+        }
+        __m128i r = _mm_sub_epi16(v, pred);
+        _mm_storeu_si128((__m128i*)(res + x), _mm_xor_si128(_mm_slli_epi16(r, 1), _mm_srai_epi16(r, 15)));
+    }
+#endif
+    for (; x < n; ++x) {
+        int16_t pred = up ? medianPredict(cur[x - 2], up[x], up[x - 2]) : cur[x - 2];
+        res[x] = zigzag((int16_t)(uint16_t)(cur[x] - pred));
+    }
+}
+
+// Inverse of predictRow. The left neighbour dependency keeps it serial, but both components of a vector
+// are reconstructed together in the low lanes of an SSE2 register, which also avoids branching on the median.
+// The residuals are turned into differences in place.
+static void reconstructRow(uint16_t* res, const int16_t* up, uint32_t n, int16_t* cur) {
+    int16_t* diff = (int16_t*)res;
+    uint32_t x = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    for (; x + 8 <= n; x += 8) {
+        __m128i z = _mm_loadu_si128((const __m128i*)(res + x));
+        __m128i sign = _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z, _mm_set1_epi16(1)));
+        _mm_storeu_si128((__m128i*)(diff + x), _mm_xor_si128(_mm_srli_epi16(z, 1), sign));
+    }
+#endif
+    for (; x < n; ++x)
+        diff[x] = unzigzag(res[x]);
+
+    x = 0;
+    for (; x < std::min(2u, n); ++x)
+        cur[x] = (int16_t)(uint16_t)(diff[x] + (up ? up[x] : 0));
+    if (!up) {
+        for (; x < n; ++x)
+            cur[x] = (int16_t)(uint16_t)(diff[x] + cur[x - 2]);
+        return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (n >= 2) {
+        int32_t word;
+        memcpy(&word, cur, sizeof(word));
+        __m128i a = _mm_cvtsi32_si128(word);
+        for (; x + 2 <= n; x += 2) {
+            int32_t bw, cw, dw;
+            memcpy(&bw, up + x, sizeof(bw));
+            memcpy(&cw, up + x - 2, sizeof(cw));
+            memcpy(&dw, diff + x, sizeof(dw));
+            __m128i b = _mm_cvtsi32_si128(bw);
+            __m128i g = _mm_sub_epi16(_mm_add_epi16(a, b), _mm_cvtsi32_si128(cw));
+            __m128i pred = _mm_max_epi16(_mm_min_epi16(a, b), _mm_min_epi16(_mm_max_epi16(a, b), g));
+            a = _mm_add_epi16(pred, _mm_cvtsi32_si128(dw));
+            word = _mm_cvtsi128_si32(a);
+            memcpy(cur + x, &word, sizeof(word));
+        }
+    }
+#endif
+    for (; x < n; ++x)
+        cur[x] = (int16_t)(uint16_t)(diff[x] + medianPredict(cur[x - 2], up[x], up[x - 2]));
+}
+
+// Computes a - b (or a + b) over n components
+static void subtractValues(const int16_t* a, const int16_t* b, size_t n, int16_t* out, bool add) {
+    size_t x = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    for (; x + 8 <= n; x += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + x));
+        _mm_storeu_si128((__m128i*)(out + x), add ? _mm_add_epi16(va, vb) : _mm_sub_epi16(va, vb));
+    }
+#endif
+    for (; x < n; ++x)
+        out[x] = (int16_t)(uint16_t)(add ? a[x] + b[x] : a[x] - b[x]);
+}
+
+// Bits needed by the widest of FLOW_CODEC_BLOCK residuals, 15 is widened to 16 so it fits a nibble
+static uint32_t blockBits(const uint16_t* res) {
+    uint32_t bits = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    __m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i*)res), _mm_loadu_si128((const __m128i*)(res + 8))),
+                             _mm_or_si128(_mm_loadu_si128((const __m128i*)(res + 16)), _mm_loadu_si128((const __m128i*)(res + 24))));
+    v = _mm_or_si128(v, _mm_srli_si128(v, 8));
+    v = _mm_or_si128(v, _mm_srli_si128(v, 4));
+    v = _mm_or_si128(v, _mm_srli_si128(v, 2));
+    uint32_t all = (uint32_t)_mm_cvtsi128_si32(v) & 0xffff;
+#else
+    uint32_t all = 0;
+    for (uint32_t i = 0; i < FLOW_CODEC_BLOCK; ++i)
+        all |= res[i];
+#endif
+    if (all)
+        bits = 32 - __builtin_clz(all);
+    return bits == 15 ? 16 : bits;
+}
+
+// Packs FLOW_CODEC_BLOCK residuals at bits each, 32 bits at a time. The block is always a whole number of
+// 32 bit words long.
+static uint8_t* packBlock(const uint16_t* res, uint32_t bits, uint8_t* out) {
+    uint64_t acc = 0;
+    uint32_t fill = 0;
+    for (uint32_t i = 0; i < FLOW_CODEC_BLOCK; ++i) {
+        acc |= (uint64_t)res[i] << fill;
+        fill += bits;
+        if (fill >= 32) {
+            uint32_t word = (uint32_t)acc;
+            memcpy(out, &word, sizeof(word));
+            out += sizeof(word);
+            acc >>= 32;
+            fill -= 32;
+        }
+    }
+    return out;
+}
+
+// Unpacks a block with one unaligned load per residual, reading up to FLOW_CODEC_PAD bytes past its end.
+// A block of zero width takes no bytes and is not read at all, the whole pad could lie beyond it.
+static const uint8_t* unpackBlock(const uint8_t* in, uint32_t bits, uint16_t* res) {
+    if (bits == 0) {
+        memset(res, 0, FLOW_CODEC_BLOCK * sizeof(uint16_t));
+        return in;
+    }
+    uint32_t mask = (1u << bits) - 1;
+    for (uint32_t i = 0; i < FLOW_CODEC_BLOCK; ++i) {
+        uint32_t pos = i * bits;
+        uint32_t word;
+        memcpy(&word, in + (pos >> 3), sizeof(word));
+        res[i] = (uint16_t)((word >> (pos & 7)) & mask);
+    }
+    return in + bits * FLOW_CODEC_BLOCK / 8;
+}
+
+// Rounds the components of a band up to whole blocks
+static size_t paddedBandValues(uint32_t rows, uint32_t width) {
+    size_t n = (size_t)rows * width * 2;
+    return (n + FLOW_CODEC_BLOCK - 1) / FLOW_CODEC_BLOCK * FLOW_CODEC_BLOCK;
+}
+
+FlowEncoder::FlowEncoder(uint32_t width, uint32_t height, ThreadPool* pool)
+    : m_width(width), m_height(height), m_numbands((height + FLOW_CODEC_BAND_ROWS - 1) / FLOW_CODEC_BAND_ROWS),
+      m_pool(pool), m_haveprev(false), m_cur(nullptr),
+      m_prev((size_t)width * height * 2), m_delta((size_t)width * height * 2),
+      m_spatial(m_numbands), m_temporal(m_numbands), m_bands(m_numbands) {
+    for (uint32_t band = 0; band < m_numbands; ++band) {
+        uint32_t rows = std::min((uint32_t)FLOW_CODEC_BAND_ROWS, height - band * FLOW_CODEC_BAND_ROWS);
+        size_t values = paddedBandValues(rows, width);
+        size_t blocks = values / FLOW_CODEC_BLOCK;
+        // Zero padding stays zero, predictRow only writes the real components
+        m_spatial[band].resize(values, 0);
+        m_temporal[band].resize(values, 0);
+        m_bands[band].resize(1 + (blocks + 1) / 2 + blocks * FLOW_CODEC_BLOCK * 2 + FLOW_CODEC_PAD);
+    }
+}
+
+void FlowEncoder::encodeBand(uint32_t band, bool keyframe) {
+    const uint32_t n = m_width * 2;
+    const uint32_t y0 = band * FLOW_CODEC_BAND_ROWS;
+    const uint32_t rows = std::min((uint32_t)FLOW_CODEC_BAND_ROWS, m_height - y0);
+    const size_t offset = (size_t)y0 * n;
+    const size_t blocks = m_spatial[band].size() / FLOW_CODEC_BLOCK;
+
+    uint16_t* spatial = m_spatial[band].data();
+    for (uint32_t y = 0; y < rows; ++y)
+        predictRow(m_cur + offset + (size_t)y * n, y ? m_cur + offset + (size_t)(y - 1) * n : nullptr, n, spatial + (size_t)y * n);
+
+    // Packed size of both predictions, measured in bits per component
+    uint32_t mode = BAND_SPATIAL;
+    const uint16_t* res = spatial;
+    if (!keyframe) {
+        uint16_t* temporal = m_temporal[band].data();
+        const int16_t* delta = m_delta.data() + offset;
+        subtractValues(m_cur + offset, m_prev.data() + offset, (size_t)rows * n, m_delta.data() + offset, false);
+        for (uint32_t y = 0; y < rows; ++y)
+            predictRow(delta + (size_t)y * n, y ? delta + (size_t)(y - 1) * n : nullptr, n, temporal + (size_t)y * n);
+        size_t spatialbits = 0, temporalbits = 0;
+        for (size_t b = 0; b < blocks; ++b) {
+            spatialbits += blockBits(spatial + b * FLOW_CODEC_BLOCK);
+            temporalbits += blockBits(temporal + b * FLOW_CODEC_BLOCK);
+        }
+        if (temporalbits < spatialbits) {
+            mode = BAND_TEMPORAL;
+            res = temporal;
+        }
+    }
+
+    uint8_t* out = m_bands[band].data();
+    uint8_t* widths = out + 1;
+    uint8_t* packed = widths + (blocks + 1) / 2;
+    out[0] = (uint8_t)mode;
+    memset(widths, 0, (blocks + 1) / 2);
+    for (size_t b = 0; b < blocks; ++b) {
+        uint32_t bits = blockBits(res + b * FLOW_CODEC_BLOCK);
+        widths[b / 2] |= (uint8_t)(std::min(bits, 15u) << (4 * (b & 1)));
+        packed = packBlock(res + b * FLOW_CODEC_BLOCK, bits, packed);
+    }
+    memset(packed, 0, FLOW_CODEC_PAD);
+    packed += FLOW_CODEC_PAD;
+    m_bands[band].resize(packed - out);
+}
+
+// Function to compress one grid
+size_t FlowEncoder::encode(const NV_OF_FLOW_VECTOR* flowdata, std::vector<uint8_t>& packet, bool keyframe) {
+    keyframe = keyframe || !m_haveprev;
+    m_cur = (const int16_t*)flowdata;
+    forEachBand(m_numbands, m_pool, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t band = begin; band < end; ++band) {
+            // encodeBand shrinks its buffer to the packed size, grow it back to the worst case first
+            size_t blocks = m_spatial[band].size() / FLOW_CODEC_BLOCK;
+            m_bands[band].resize(1 + (blocks + 1) / 2 + blocks * FLOW_CODEC_BLOCK * 2 + FLOW_CODEC_PAD);
+            encodeBand(band, keyframe);
+        }
+    });
+
+    size_t size = sizeof(FlowPacketHeader) + m_numbands * sizeof(uint32_t);
+    for (uint32_t band = 0; band < m_numbands; ++band)
+        size += m_bands[band].size();
+    packet.resize(size);
+
+    FlowPacketHeader header;
+    memcpy(header.magic, "NVFC", 4);
+    header.width = m_width;
+    header.height = m_height;
+    header.numbands = m_numbands;
+    header.flags = keyframe ? FLOW_PACKET_KEYFRAME : 0;
+    header.size = (uint32_t)(size - sizeof(FlowPacketHeader));
+    memcpy(packet.data(), &header, sizeof(header));
+    uint8_t* out = packet.data() + sizeof(header) + m_numbands * sizeof(uint32_t);
+    for (uint32_t band = 0; band < m_numbands; ++band) {
+        uint32_t bandsize = (uint32_t)m_bands[band].size();
+        memcpy(packet.data() + sizeof(header) + band * sizeof(uint32_t), &bandsize, sizeof(bandsize));
+        memcpy(out, m_bands[band].data(), bandsize);
+        out += bandsize;
+    }
+
+    memcpy(m_prev.data(), flowdata, m_prev.size() * sizeof(int16_t));
+    m_haveprev = true;
+    return size;
+}
+
+FlowDecoder::FlowDecoder(uint32_t width, uint32_t height, ThreadPool* pool)
+    : m_width(width), m_height(height), m_numbands((height + FLOW_CODEC_BAND_ROWS - 1) / FLOW_CODEC_BAND_ROWS),
+      m_pool(pool), m_haveprev(false), m_prev((size_t)width * height * 2), m_residuals(m_numbands), m_modes(m_numbands) {
+    for (uint32_t band = 0; band < m_numbands; ++band) {
+        uint32_t rows = std::min((uint32_t)FLOW_CODEC_BAND_ROWS, height - band * FLOW_CODEC_BAND_ROWS);
+        m_residuals[band].resize(paddedBandValues(rows, width));
+    }
+}
+
+bool FlowDecoder::unpackBand(uint32_t band, const uint8_t* data, size_t size) {
+    uint16_t* res = m_residuals[band].data();
+    const size_t blocks = m_residuals[band].size() / FLOW_CODEC_BLOCK;
+
+    if (size < 1 + (blocks + 1) / 2)
+        return false;
+    uint32_t mode = data[0];
+    if (mode > BAND_TEMPORAL || (mode == BAND_TEMPORAL && !m_haveprev))
+        return false;
+    const uint8_t* widths = data + 1;
+    const uint8_t* packed = widths + (blocks + 1) / 2;
+    const uint8_t* end = data + size;
+    for (size_t b = 0; b < blocks; ++b) {
+        uint32_t bits = (widths[b / 2] >> (4 * (b & 1))) & 15;
+        if (bits == 15)
+            bits = 16;
+        if ((size_t)(end - packed) < bits * FLOW_CODEC_BLOCK / 8 + FLOW_CODEC_PAD)
+            return false;
+        packed = unpackBlock(packed, bits, res + b * FLOW_CODEC_BLOCK);
+    }
+    m_modes[band] = (uint8_t)mode;
+    return true;
+}
+
+void FlowDecoder::reconstructBand(uint32_t band, int16_t* out) {
+    const uint32_t n = m_width * 2;
+    const uint32_t y0 = band * FLOW_CODEC_BAND_ROWS;
+    const uint32_t rows = std::min((uint32_t)FLOW_CODEC_BAND_ROWS, m_height - y0);
+    const size_t offset = (size_t)y0 * n;
+    uint16_t* res = m_residuals[band].data();
+
+    int16_t* cur = out + offset;
+    for (uint32_t y = 0; y < rows; ++y)
+        reconstructRow(res + (size_t)y * n, y ? cur + (size_t)(y - 1) * n : nullptr, n, cur + (size_t)y * n);
+    if (m_modes[band] == BAND_TEMPORAL)
+        subtractValues(cur, m_prev.data() + offset, (size_t)rows * n, cur, true);
+    memcpy(m_prev.data() + offset, cur, (size_t)rows * n * sizeof(int16_t));
+}
+
+// Function to decompress one grid
+void FlowDecoder::decode(const uint8_t* packet, size_t size, NV_OF_FLOW_VECTOR* flowdata) {
+    FlowPacketHeader header;
+    if (size < sizeof(header))
+        throw std::runtime_error("Truncated flow packet");
+    memcpy(&header, packet, sizeof(header));
+    if (memcmp(header.magic, "NVFC", 4) != 0 || header.width != m_width || header.height != m_height ||
+        header.numbands != m_numbands)
+        throw std::runtime_error("Flow packet does not match the grid");
+    if (size - sizeof(header) < header.size || header.size < m_numbands * sizeof(uint32_t))
+        throw std::runtime_error("Truncated flow packet");
+
+    // Band offsets are validated up front so the bands can be decoded independently
+    std::vector<size_t> offsets(m_numbands + 1);
+    offsets[0] = sizeof(header) + m_numbands * sizeof(uint32_t);
+    for (uint32_t band = 0; band < m_numbands; ++band) {
+        uint32_t bandsize;
+        memcpy(&bandsize, packet + sizeof(header) + band * sizeof(uint32_t), sizeof(bandsize));
+        offsets[band + 1] = offsets[band] + bandsize;
+        if (offsets[band + 1] > sizeof(header) + header.size)
+            throw std::runtime_error("Truncated flow packet");
+    }
+
+    // Every band is unpacked and checked before any of them is reconstructed, so a corrupt packet leaves the
+    // previous grid and the output as they were
+    std::atomic<bool> corrupt(false);
+    forEachBand(m_numbands, m_pool, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t band = begin; band < end; ++band) {
+            if (!unpackBand(band, packet + offsets[band], offsets[band + 1] - offsets[band]))
+                corrupt = true;
+        }
+    });
+    if (corrupt)
+        throw std::runtime_error("Corrupt flow packet");
+    forEachBand(m_numbands, m_pool, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t band = begin; band < end; ++band)
+            reconstructBand(band, (int16_t*)flowdata);
+    });
+    m_haveprev = true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+#include <stddef.h>
+#include <vector>
+
+class ThreadPool;
+
+#define FLOW_CODEC_BAND_ROWS 16     // vector rows per band, bands are coded independently
+#define FLOW_CODEC_BLOCK 32         // residuals sharing one bit width, the SSE2 width scan and the packer rely on 32
+#define FLOW_PACKET_KEYFRAME 1      // packet flag, no band refers to the previous grid
+
+// Start of every compressed flow grid, followed by numbands uint32_t band sizes and the bands.
+// A band is a mode byte (spatial or temporal), one nibble per FLOW_CODEC_BLOCK residuals holding
+// their bit width (15 stands for 16), then the residuals bit packed at those widths and 3 zero bytes.
+struct FlowPacketHeader {
+    char magic[4];      // "NVFC"
+    uint32_t width;     // vectors per row
+    uint32_t height;    // rows of vectors
+    uint32_t numbands;
+    uint32_t flags;
+    uint32_t size;      // bytes following the header
+};
+
+// Lossless encoder for sequences of NV_OF_FLOW_VECTOR grids. Every band is predicted either
+// spatially, with the median edge detector of LOCO-I on each component, or temporally, with the
+// same predictor applied to the difference from the previous grid, whichever packs smaller.
+// Residuals are zigzag coded and bit packed in blocks of FLOW_CODEC_BLOCK. Prediction runs on SSE2
+// and bands are spread over the thread pool.
+class FlowEncoder {
+public:
+    FlowEncoder(uint32_t width, uint32_t height, ThreadPool* pool = nullptr);
+
+    // Compresses one grid into packet and returns its size. The first grid and keyframes only
+    // use spatial prediction.
+    size_t encode(const NV_OF_FLOW_VECTOR* flowdata, std::vector<uint8_t>& packet, bool keyframe = false);
+
+private:
+    void encodeBand(uint32_t band, bool keyframe);
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_numbands;
+    ThreadPool* m_pool;
+    bool m_haveprev;
+    const int16_t* m_cur;
+    std::vector<int16_t> m_prev;
+    std::vector<int16_t> m_delta;
+    std::vector<std::vector<uint16_t> > m_spatial;
+    std::vector<std::vector<uint16_t> > m_temporal;
+    std::vector<std::vector<uint8_t> > m_bands;
+};
+
+// Decoder for the packets of FlowEncoder, it keeps the previous grid for temporal prediction.
+// Throws std::runtime_error on packets that do not fit the grid or are corrupt, leaving the previous
+// grid and flowdata untouched, so the next packet still decodes against the last good one.
+class FlowDecoder {
+public:
+    FlowDecoder(uint32_t width, uint32_t height, ThreadPool* pool = nullptr);
+
+    void decode(const uint8_t* packet, size_t size, NV_OF_FLOW_VECTOR* flowdata);
+
+private:
+    bool unpackBand(uint32_t band, const uint8_t* data, size_t size);
+    void reconstructBand(uint32_t band, int16_t* out);
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_numbands;
+    ThreadPool* m_pool;
+    bool m_haveprev;
+    std::vector<int16_t> m_prev;
+    std::vector<std::vector<uint16_t> > m_residuals;
+    std::vector<uint8_t> m_modes;
+};
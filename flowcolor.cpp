@@ -0,0 +1,398 @@
+#include "flowcolor.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+int m_ncols = 0;
+int m_colorwheel[60][3];
+uint8_t m_colorlut[COLOR_LUT_SIZE * COLOR_LUT_SIZE][3];
+
+void SetColors(int r, int g, int b, int k)
+{
+    m_colorwheel[k][0] = r;
+    m_colorwheel[k][1] = g;
+    m_colorwheel[k][2] = b;
+}
+
+void MakeColorWheel()
+{
+    // relative lengths of color transitions:
+    // these are chosen based on perceptual similarity
+    // (e.g. one can distinguish more shades between red and yellow 
+    //  than between yellow and green)
+    int RY = 15;
+    int YG = 6;
+    int GC = 4;
+    int CB = 11;
+    int BM = 13;
+    int MR = 6;
+    m_ncols = RY + YG + GC + CB + BM + MR;
+
+    int i;
+    int k = 0;
+
+    for (i = 0; i < RY; i++) SetColors(255, 255 * i / RY, 0, k++);
+    for (i = 0; i < YG; i++) SetColors(255 - 255 * i / YG, 255, 0, k++);
+    for (i = 0; i < GC; i++) SetColors(0, 255, 255 * i / GC, k++);
+    for (i = 0; i < CB; i++) SetColors(0, 255 - 255 * i / CB, 255, k++);
+    for (i = 0; i < BM; i++) SetColors(255 * i / BM, 0, 255, k++);
+    for (i = 0; i < MR; i++) SetColors(255, 0, 255 - 255 * i / MR, k++);
+
+    MakeColorLUT();
+}
+
+void MakeColorLUT()
+{
+    // Cell (i, j) holds the color of its center in normalized space. The cell edges fall on
+    // the axes, so no cell straddles the hue seam ComputeColor has along the positive x axis.
+    // Normalized vectors never leave the unit disk, so the cells straddling the circle are
+    // clamped onto it instead of taking the darker out of range color.
+    const float step = 2.0f / COLOR_LUT_SIZE;
+    for (int j = 0; j < COLOR_LUT_SIZE; j++)
+    {
+        for (int i = 0; i < COLOR_LUT_SIZE; i++)
+        {
+            float fx = (i + 0.5f) * step - 1.0f;
+            float fy = (j + 0.5f) * step - 1.0f;
+            float rad = sqrtf(fx * fx + fy * fy);
+            if (rad > 1.0f)
+            {
+                fx /= rad;
+                fy /= rad;
+            }
+            ComputeColor(fx, fy, m_colorlut[j * COLOR_LUT_SIZE + i]);
+        }
+    }
+}
+
+void ComputeColor(float fx, float fy, uint8_t* pix)
+{
+    float rad = sqrtf(fx * fx + fy * fy);
+    float a = atan2f(-fy, -fx) / M_PI;
+    float fk = (a + 1.0f) / 2.0f * (m_ncols - 1);
+    int k0 = (int)fk;
+    int k1 = (k0 + 1) % m_ncols;
+    float f = fk - k0;
+    //f = 0; // uncomment to see original color wheel
+    for (int b = 0; b < 3; b++)
+    {
+        float col0 = m_colorwheel[k0][b] / 255.0f;
+        float col1 = m_colorwheel[k1][b] / 255.0f;
+        float col = (1 - f) * col0 + f * col1;
+        if (rad <= 1)
+            col = 1 - rad * (1 - col); // increase saturation with radius
+        else
+            col *= .75f; // out of range
+        pix[2 - b] = (int)(255.0f * col);
+    }
+}
+
+// Reference colorization, one ComputeColor call per vector
+static void colorizeScalar(const NV_OF_FLOW_VECTOR* flow, uint8_t* output, uint32_t count, float scale)
+{
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        ComputeColor(flow[n].flowx * scale, flow[n].flowy * scale, output + 3 * n);
+    }
+}
+
+// Gathers every color from the lookup table
+void colorizeLUT(const NV_OF_FLOW_VECTOR* flow, uint8_t* output, uint32_t count, float scale)
+{
+    // Normalized space to cells. The offset moves the unit disk to the positive cells so the
+    // truncating conversion picks the enclosing cell. Vectors normalized outside of the disk,
+    // the masked ones left out of the largest magnitude, are clamped to the border cells on
+    // both ends before the conversion; only their pixels are blacked out after the gather.
+    const float cellscale = scale * (COLOR_LUT_SIZE / 2.0f);
+    const float offset = COLOR_LUT_SIZE / 2.0f;
+    const float last = (float)(COLOR_LUT_SIZE - 1);
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        int i = (int)std::min(std::max(flow[n].flowx * cellscale + offset, 0.0f), last);
+        int j = (int)std::min(std::max(flow[n].flowy * cellscale + offset, 0.0f), last);
+        const uint8_t* color = m_colorlut[j * COLOR_LUT_SIZE + i];
+        uint8_t* pix = output + 3 * n;
+        pix[0] = color[0];
+        pix[1] = color[1];
+        pix[2] = color[2];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Same math as ComputeColor on 8 vectors per iteration. atan2 is reduced to atan on [0, 1]
+// and evaluated with a minimax polynomial (error below 1e-5 rad), the quadrant is restored
+// from the sign bits so the hue seam and the signed zeros match atan2f.
+__attribute__((target("avx2")))
+static void colorizeAVX2(const NV_OF_FLOW_VECTOR* flow, uint8_t* output, uint32_t count, float scale)
+{
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256 signmask = _mm256_set1_ps(-0.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 pi = _mm256_set1_ps((float)M_PI);
+    const __m256 halfpi = _mm256_set1_ps((float)M_PI_2);
+    const __m256 hue = _mm256_set1_ps((m_ncols - 1) / 2.0f);
+    const __m256 huescale = _mm256_set1_ps((m_ncols - 1) / (2.0f * (float)M_PI));
+    const __m256 maxhue = _mm256_set1_ps((float)(m_ncols - 1));
+    const __m256i ncols = _mm256_set1_epi32(m_ncols);
+    const __m256i bytemask = _mm256_set1_epi32(0xff);
+    const __m256 inv255 = _mm256_set1_ps(1.0f / 255.0f);
+
+    // The three channels of every wheel entry packed in one int, so each vector only needs
+    // two gathers
+    int wheel[60];
+    for (int k = 0; k < m_ncols; k++)
+        wheel[k] = m_colorwheel[k][0] | (m_colorwheel[k][1] << 8) | (m_colorwheel[k][2] << 16);
+    // BGRx pixels to packed BGR, 12 bytes at the bottom of each lane, then both lanes joined
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+    // The last vectors go through a zero padded copy instead of ComputeColor, so every vector gets the same
+    // math whatever chunk it falls in and banded runs give the colors of a single run bit for bit
+    NV_OF_FLOW_VECTOR tail[8];
+    uint8_t tailpix[3 * 8];
+    for (uint32_t n = 0; n < count; n += 8)
+    {
+        const uint32_t num = std::min(count - n, 8u);
+        const NV_OF_FLOW_VECTOR* src = flow + n;
+        uint8_t* pix = output + 3 * n;
+        if (num < 8)
+        {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, src, num * sizeof(NV_OF_FLOW_VECTOR));
+            src = tail;
+            pix = tailpix;
+        }
+
+        __m256i v = _mm256_loadu_si256((const __m256i*)src);
+        __m256 fx = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16)), vscale);
+        __m256 fy = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(v, 16)), vscale);
+        __m256 rad = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy)));
+
+        // atan2(-fy, -fx)
+        __m256 ny = _mm256_xor_ps(fy, signmask);
+        __m256 nx = _mm256_xor_ps(fx, signmask);
+        __m256 ax = _mm256_andnot_ps(signmask, nx);
+        __m256 ay = _mm256_andnot_ps(signmask, ny);
+        __m256 lo = _mm256_min_ps(ax, ay);
+        __m256 hi = _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(1e-30f));
+        // Reciprocal refined by one Newton step, plenty for the colors
+        __m256 rcp = _mm256_rcp_ps(hi);
+        rcp = _mm256_mul_ps(rcp, _mm256_sub_ps(_mm256_set1_ps(2.0f), _mm256_mul_ps(hi, rcp)));
+        __m256 t = _mm256_mul_ps(lo, rcp);
+        __m256 t2 = _mm256_mul_ps(t, t);
+        __m256 p = _mm256_set1_ps(-0.01172120f);
+        p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(0.05265332f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(-0.11643287f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(0.19354346f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(-0.33262347f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(0.99997726f));
+        __m256 angle = _mm256_mul_ps(p, t);
+        angle = _mm256_blendv_ps(angle, _mm256_sub_ps(halfpi, angle), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+        angle = _mm256_blendv_ps(angle, _mm256_sub_ps(pi, angle), nx);
+        angle = _mm256_or_ps(angle, _mm256_and_ps(ny, signmask));
+
+        // Position on the color wheel, angle / pi in [-1, 1] mapped to [0, ncols - 1]
+        __m256 fk = _mm256_add_ps(_mm256_mul_ps(angle, huescale), hue);
+        fk = _mm256_min_ps(_mm256_max_ps(fk, _mm256_setzero_ps()), maxhue);
+        __m256i k0 = _mm256_cvttps_epi32(fk);
+        __m256 f = _mm256_sub_ps(fk, _mm256_cvtepi32_ps(k0));
+        __m256i k1 = _mm256_add_epi32(k0, _mm256_set1_epi32(1));
+        k1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(k1, ncols), k1);
+        __m256i wheel0 = _mm256_i32gather_epi32(wheel, k0, 4);
+        __m256i wheel1 = _mm256_i32gather_epi32(wheel, k1, 4);
+
+        __m256 inrange = _mm256_cmp_ps(rad, one, _CMP_LE_OQ);
+        __m256i bgr = _mm256_setzero_si256();
+        for (int b = 0; b < 3; b++)
+        {
+            __m256i c0 = _mm256_and_si256(_mm256_srli_epi32(wheel0, 8 * b), bytemask);
+            __m256i c1 = _mm256_and_si256(_mm256_srli_epi32(wheel1, 8 * b), bytemask);
+            __m256 col0 = _mm256_mul_ps(_mm256_cvtepi32_ps(c0), inv255);
+            __m256 col1 = _mm256_mul_ps(_mm256_cvtepi32_ps(c1), inv255);
+            __m256 col = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, f), col0), _mm256_mul_ps(f, col1));
+            __m256 sat = _mm256_sub_ps(one, _mm256_mul_ps(rad, _mm256_sub_ps(one, col)));
+            col = _mm256_blendv_ps(_mm256_mul_ps(col, _mm256_set1_ps(.75f)), sat, inrange);
+            __m256i c = _mm256_cvttps_epi32(_mm256_mul_ps(col, _mm256_set1_ps(255.0f)));
+            bgr = _mm256_or_si256(bgr, _mm256_slli_epi32(c, 8 * (2 - b)));
+        }
+
+        bgr = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(bgr, pack), join);
+        _mm_storeu_si128((__m128i*)pix, _mm256_castsi256_si128(bgr));
+        _mm_storel_epi64((__m128i*)(pix + 16), _mm256_extracti128_si256(bgr, 1));
+        if (num < 8)
+            memcpy(output + 3 * n, tailpix, 3 * num);
+    }
+}
+#endif
+
+// Function to pick the fastest kernel computing the colors like ComputeColor (AVX2 or scalar)
+ColorFunc selectColorKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+        return colorizeAVX2;
+#endif
+    return colorizeScalar;
+}
+
+// Largest squared magnitude of count vectors in S10.5 units. Two squared int16 components
+// always fit in 32 unsigned bits.
+static uint32_t maxRadius2(const NV_OF_FLOW_VECTOR* flow, uint32_t count)
+{
+    uint32_t maxrad2 = 0;
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        int32_t fx = flow[n].flowx;
+        int32_t fy = flow[n].flowy;
+        uint32_t rad2 = (uint32_t)(fx * fx) + (uint32_t)(fy * fy);
+        maxrad2 = std::max(maxrad2, rad2);
+    }
+    return maxrad2;
+}
+
+// Factor taking S10.5 vectors to normalized space, the largest magnitude of the grid in squared S10.5 units
+// ending up on the unit circle. The rounding of the scaled components can put the largest vector one ulp
+// outside of it, where ComputeColor switches to the darker out of range colors, so the factor is lowered by
+// two float epsilons, more than the few roundings between the reduction and the colors can add up to.
+static float normalizationScale(uint32_t maxrad2)
+{
+    float maxrad = std::max(sqrtf((float)maxrad2) / 32.0f, 1.0f);
+    return (1.0f - 2.0f * FLT_EPSILON) / (32.0f * maxrad);
+}
+
+// Post processing to get the flow vectors in RGB format for viewing.
+// Works directly on the S10.5 vectors: the magnitude reduction is done on the squared integer
+// components and the colorization kernel scales each vector on the fly, so no float copy of
+// the grid is made and nothing is allocated per frame.
+// With a pool both passes are split into row bands, each band of the reduction folds its
+// maximum into a shared atomic once.
+void postProcessVectors(const NV_OF_FLOW_VECTOR* _flowvectors, uint8_t* output, uint16_t outwidth, uint16_t outheight,
+                        ColorFunc colorize, ThreadPool* pool) {
+    const uint32_t count = (uint32_t)outwidth * outheight;
+
+    uint32_t maxrad2 = 0;
+    if (pool)
+    {
+        std::atomic<uint32_t> shared(0);
+        pool->parallelFor(outheight, [&](uint32_t begin, uint32_t end) {
+            uint32_t local = maxRadius2(_flowvectors + (size_t)begin * outwidth, (end - begin) * outwidth);
+            uint32_t current = shared.load();
+            while (local > current && !shared.compare_exchange_weak(current, local)) {}
+        });
+        maxrad2 = shared.load();
+    }
+    else
+        maxrad2 = maxRadius2(_flowvectors, count);
+
+    // S10.5 to pixels and normalization folded into one factor
+    const float scale = normalizationScale(maxrad2);
+    if (pool)
+    {
+        pool->parallelFor(outheight, [&](uint32_t begin, uint32_t end) {
+            size_t first = (size_t)begin * outwidth;
+            colorize(_flowvectors + first, output + 3 * first, (end - begin) * outwidth, scale);
+        });
+    }
+    else
+        colorize(_flowvectors, output, count, scale);
+}
+
+// Vectors colorized at once before their masked pixels are flagged, so the colors are still in L1
+#define COST_MASK_CHUNK 256
+
+// Largest squared magnitude of the vectors of count whose cost is at most threshold.
+// With zero the others are cleared on the way.
+static uint32_t maskedRadius2(NV_OF_FLOW_VECTOR* flow, const uint8_t* cost, uint8_t threshold, bool zero, uint32_t count)
+{
+    uint32_t maxrad2 = 0;
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        if (cost[n] > threshold)
+        {
+            if (zero)
+                flow[n].flowx = flow[n].flowy = 0;
+            continue;
+        }
+        int32_t fx = flow[n].flowx;
+        int32_t fy = flow[n].flowy;
+        uint32_t rad2 = (uint32_t)(fx * fx) + (uint32_t)(fy * fy);
+        maxrad2 = std::max(maxrad2, rad2);
+    }
+    return maxrad2;
+}
+
+// Function to zero the vectors whose cost is above threshold, for when no colors are needed
+void maskVectors(NV_OF_FLOW_VECTOR* _flowvectors, const uint8_t* cost, uint8_t threshold, uint16_t outwidth, uint16_t outheight,
+                 ThreadPool* pool) {
+    if (pool)
+    {
+        pool->parallelFor(outheight, [&](uint32_t begin, uint32_t end) {
+            size_t first = (size_t)begin * outwidth;
+            maskedRadius2(_flowvectors + first, cost + first, threshold, true, (end - begin) * outwidth);
+        });
+    }
+    else
+        maskedRadius2(_flowvectors, cost, threshold, true, (uint32_t)outwidth * outheight);
+}
+
+// Colorizes a band chunk by chunk and blacks out the flagged pixels of each chunk right after it
+static void colorizeFlagged(const NV_OF_FLOW_VECTOR* flow, const uint8_t* cost, uint8_t threshold, uint8_t* output,
+                            uint32_t count, float scale, ColorFunc colorize)
+{
+    for (uint32_t first = 0; first < count; first += COST_MASK_CHUNK)
+    {
+        uint32_t num = std::min(count - first, (uint32_t)COST_MASK_CHUNK);
+        colorize(flow + first, output + 3 * first, num, scale);
+        for (uint32_t n = first; n < first + num; ++n)
+        {
+            if (cost[n] > threshold)
+                output[3 * n] = output[3 * n + 1] = output[3 * n + 2] = 0;
+        }
+    }
+}
+
+// Post processing fused with the cost masking. The reduction pass skips the masked vectors, so a few wild
+// low confidence vectors do not wash out the colors of the rest, and zeroes them when asked to. Zeroed vectors
+// come out white like any still pixel, flagged ones are blacked out chunk by chunk behind the colorization.
+void postProcessVectors(NV_OF_FLOW_VECTOR* _flowvectors, const uint8_t* cost, uint8_t threshold, CostMask mask,
+                        uint8_t* output, uint16_t outwidth, uint16_t outheight, ColorFunc colorize, ThreadPool* pool) {
+    const uint32_t count = (uint32_t)outwidth * outheight;
+    const bool zero = mask == COST_MASK_ZERO;
+
+    uint32_t maxrad2 = 0;
+    if (pool)
+    {
+        std::atomic<uint32_t> shared(0);
+        pool->parallelFor(outheight, [&](uint32_t begin, uint32_t end) {
+            size_t first = (size_t)begin * outwidth;
+            uint32_t local = maskedRadius2(_flowvectors + first, cost + first, threshold, zero, (end - begin) * outwidth);
+            uint32_t current = shared.load();
+            while (local > current && !shared.compare_exchange_weak(current, local)) {}
+        });
+        maxrad2 = shared.load();
+    }
+    else
+        maxrad2 = maskedRadius2(_flowvectors, cost, threshold, zero, count);
+
+    const float scale = normalizationScale(maxrad2);
+    if (pool)
+    {
+        pool->parallelFor(outheight, [&](uint32_t begin, uint32_t end) {
+            size_t first = (size_t)begin * outwidth;
+            if (zero)
+                colorize(_flowvectors + first, output + 3 * first, (end - begin) * outwidth, scale);
+            else
+                colorizeFlagged(_flowvectors + first, cost + first, threshold, output + 3 * first, (end - begin) * outwidth, scale, colorize);
+        });
+    }
+    else if (zero)
+        colorize(_flowvectors, output, count, scale);
+    else
+        colorizeFlagged(_flowvectors, cost, threshold, output, count, scale, colorize);
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+
+class ThreadPool;
+
+#define COLOR_LUT_SIZE 512    // cells per axis of the colorization table, even so the axes are cell edges
+
+// Color wheel shared by all colorizers, built once by MakeColorWheel()
+extern int m_ncols;
+extern int m_colorwheel[60][3];
+
+// BGR color of every quantized normalized vector, rows are fy and columns fx, both over [-1, 1]
+extern uint8_t m_colorlut[COLOR_LUT_SIZE * COLOR_LUT_SIZE][3];
+
+// Builds the color wheel and the lookup table derived from it
+void MakeColorWheel();
+
+// Function to fill the colorization lookup table from the color wheel
+void MakeColorLUT();
+
+// Reference colorization of one normalized flow vector into a BGR pixel
+void ComputeColor(float fx, float fy, uint8_t* pix);
+
+// Colorizes count S10.5 vectors into BGR pixels, scale takes S10.5 to normalized space. The color of a vector
+// does not depend on the others, so colorizing a grid in bands gives the same pixels as in one call.
+typedef void (*ColorFunc)(const NV_OF_FLOW_VECTOR* flow, uint8_t* output, uint32_t count, float scale);
+
+// Kernel gathering the colors from the lookup table, the fastest one but off by up to 2 per channel.
+// Vectors outside of the unit disk take the color of the nearest border cell of the table.
+void colorizeLUT(const NV_OF_FLOW_VECTOR* flow, uint8_t* output, uint32_t count, float scale);
+
+// Function to pick the fastest kernel computing the colors like ComputeColor (AVX2 or scalar).
+// The AVX2 kernel uses a polynomial atan2 and is off by at most 1 per channel.
+ColorFunc selectColorKernel();
+
+// Post processing to get the flow vectors in RGB format for viewing, split into row bands on the pool if there is one
+void postProcessVectors(const NV_OF_FLOW_VECTOR* _flowvectors, uint8_t* output, uint16_t outwidth, uint16_t outheight,
+                        ColorFunc colorize = colorizeLUT, ThreadPool* pool = nullptr);
+
+// Vectors whose cost is above the threshold are either zeroed in the grid or kept and flagged black in the colors
+enum CostMask { COST_MASK_ZERO, COST_MASK_FLAG };
+
+// Function to zero the vectors whose cost is above threshold, for when no colors are needed
+void maskVectors(NV_OF_FLOW_VECTOR* _flowvectors, const uint8_t* cost, uint8_t threshold, uint16_t outwidth, uint16_t outheight,
+                 ThreadPool* pool = nullptr);
+
+// Post processing fused with the cost masking: masked vectors are left out of the normalization and zeroed or
+// flagged in the same passes that colorize the rest, so the grid is not walked again
+void postProcessVectors(NV_OF_FLOW_VECTOR* _flowvectors, const uint8_t* cost, uint8_t threshold, CostMask mask,
+                        uint8_t* output, uint16_t outwidth, uint16_t outheight, ColorFunc colorize = colorizeLUT,
+                        ThreadPool* pool = nullptr);
@@ -0,0 +1,113 @@
+#include "flowhints.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
+// Rounded mean of the two middle values of four
+static inline int16_t median4(int32_t a, int32_t b, int32_t c, int32_t d)
+{
+    int32_t lo = std::max(std::min(a, b), std::min(c, d));
+    int32_t hi = std::min(std::max(a, b), std::max(c, d));
+    return (int16_t)((lo + hi + 1) >> 1);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Same on eight int16 lanes. The larger of the pair minimums and the smaller of the pair maximums are the two
+// middle values, their mean is taken on values biased to unsigned since SSE2 only averages unsigned words.
+static inline __m128i median4(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    __m128i lo = _mm_max_epi16(_mm_min_epi16(a, b), _mm_min_epi16(c, d));
+    __m128i hi = _mm_min_epi16(_mm_max_epi16(a, b), _mm_max_epi16(c, d));
+    return _mm_xor_si128(_mm_avg_epu16(_mm_xor_si128(lo, bias), _mm_xor_si128(hi, bias)), bias);
+}
+#endif
+
+// Halves rows [begin, end) of the destination
+static void medianHalveRows(const NV_OF_FLOW_VECTOR* src, uint32_t srcwidth, NV_OF_FLOW_VECTOR* dst, uint32_t dstwidth,
+                            uint32_t begin, uint32_t end)
+{
+    for (uint32_t y = begin; y < end; ++y)
+    {
+        const NV_OF_FLOW_VECTOR* row0 = src + (size_t)2 * y * srcwidth;
+        const NV_OF_FLOW_VECTOR* row1 = row0 + srcwidth;
+        NV_OF_FLOW_VECTOR* out = dst + (size_t)y * dstwidth;
+        uint32_t x = 0;
+#if defined(__x86_64__) || defined(__i386__)
+        // Four output vectors from eight input vectors per row, split into the even and odd columns
+        for (; x + 4 <= dstwidth; x += 4)
+        {
+            __m128 a0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(row0 + 2 * x)));
+            __m128 b0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(row0 + 2 * x + 4)));
+            __m128 a1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(row1 + 2 * x)));
+            __m128 b1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(row1 + 2 * x + 4)));
+            __m128i even0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i odd0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+            __m128i even1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i odd1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm_storeu_si128((__m128i*)(out + x), median4(even0, odd0, even1, odd1));
+        }
+#endif
+        for (; x < dstwidth; ++x)
+        {
+            const NV_OF_FLOW_VECTOR* p0 = row0 + 2 * x;
+            const NV_OF_FLOW_VECTOR* p1 = row1 + 2 * x;
+            out[x].flowx = median4(p0[0].flowx, p0[1].flowx, p1[0].flowx, p1[1].flowx);
+            out[x].flowy = median4(p0[0].flowy, p0[1].flowy, p1[0].flowy, p1[1].flowy);
+        }
+    }
+}
+
+// Function to halve a flow grid with a 2x2 median, using SSE2
+void medianHalve(const NV_OF_FLOW_VECTOR* src, uint32_t srcwidth, uint32_t srcheight, NV_OF_FLOW_VECTOR* dst,
+                 ThreadPool* pool) {
+    uint32_t dstwidth = srcwidth / 2;
+    uint32_t dstheight = srcheight / 2;
+    if (pool)
+    {
+        pool->parallelFor(dstheight, [&](uint32_t begin, uint32_t end) {
+            medianHalveRows(src, srcwidth, dst, dstwidth, begin, end);
+        });
+    }
+    else
+        medianHalveRows(src, srcwidth, dst, dstwidth, 0, dstheight);
+}
+
+// Function to turn a flow grid into hints for the next execute
+void downsampleHints(const NV_OF_FLOW_VECTOR* flow, uint32_t width, uint32_t height, uint32_t factor,
+                     NV_OF_FLOW_VECTOR* hints, std::vector<NV_OF_FLOW_VECTOR>& scratch, ThreadPool* pool) {
+    if (factor <= 1)
+    {
+        memcpy(hints, flow, (size_t)width * height * sizeof(NV_OF_FLOW_VECTOR));
+        return;
+    }
+
+    // Every level but the last goes into the scratch, one after the other
+    size_t needed = 0;
+    uint32_t w = width, h = height;
+    for (uint32_t f = factor; f > 2; f /= 2)
+    {
+        w /= 2;
+        h /= 2;
+        needed += (size_t)w * h;
+    }
+    if (scratch.size() < needed)
+        scratch.resize(needed);
+
+    const NV_OF_FLOW_VECTOR* src = flow;
+    NV_OF_FLOW_VECTOR* level = scratch.data();
+    w = width;
+    h = height;
+    for (uint32_t f = factor; f > 2; f /= 2)
+    {
+        medianHalve(src, w, h, level, pool);
+        w /= 2;
+        h /= 2;
+        src = level;
+        level += (size_t)w * h;
+    }
+    medianHalve(src, w, h, hints, pool);
+}
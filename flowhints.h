@@ -0,0 +1,16 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+#include <vector>
+
+class ThreadPool;
+
+// Function to halve a flow grid, every vector becoming the per component median of its 2x2 block
+// (the rounded mean of the two middle values), using SSE2. An odd last row or column is dropped.
+void medianHalve(const NV_OF_FLOW_VECTOR* src, uint32_t srcwidth, uint32_t srcheight, NV_OF_FLOW_VECTOR* dst,
+                 ThreadPool* pool = nullptr);
+
+// Function to turn a flow grid into hints for the next execute, downsampled by factor (1, 2, 4 or 8).
+// Factors above 2 repeat the 2x2 median through the scratch levels, a median of medians that is much cheaper
+// than the true block median and just as robust against a few stray vectors. The vectors stay in S10.5 pixels.
+void downsampleHints(const NV_OF_FLOW_VECTOR* flow, uint32_t width, uint32_t height, uint32_t factor,
+                     NV_OF_FLOW_VECTOR* hints, std::vector<NV_OF_FLOW_VECTOR>& scratch, ThreadPool* pool = nullptr);
@@ -0,0 +1,85 @@
+#include "flowprotocol.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Function to send a message, passing fd along with it
+bool sendMessage(int socket, const void* message, size_t size, int fd) {
+    struct iovec iov;
+    iov.iov_base = (void*)message;
+    iov.iov_len = size;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    // Messages are small, a stream socket still may split them, the descriptor goes with the first part
+    const uint8_t* bytes = (const uint8_t*)message;
+    size_t done = 0;
+    while (done < size) {
+        iov.iov_base = (void*)(bytes + done);
+        iov.iov_len = size - done;
+        ssize_t sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        done += sent;
+        msg.msg_control = nullptr;
+        msg.msg_controllen = 0;
+    }
+    return true;
+}
+
+// Function to receive a message of exactly size bytes
+bool receiveMessage(int socket, void* message, size_t size, int& fd) {
+    fd = -1;
+    uint8_t* bytes = (uint8_t*)message;
+    size_t done = 0;
+    while (done < size) {
+        struct iovec iov;
+        iov.iov_base = bytes + done;
+        iov.iov_len = size - done;
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t got = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0) {
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+            return false;
+        }
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                int passed;
+                memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+                if (fd >= 0)
+                    close(fd);
+                fd = passed;
+            }
+        }
+        done += got;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLOW_ERROR_SIZE 120     // bytes of the error message carried by a reply
+
+// Flags of a request
+#define FLOW_REQUEST_BUFFER 1   // a new shared buffer is attached to this request as a file descriptor, a memfd
+                                // sealed with F_SEAL_SHRINK and at least buffersize bytes long
+
+// Request for the flow of one frame pair, sent over the Unix domain socket of ofserver.
+// The frames and the output grid live in a shared memory buffer the client passed once with
+// SCM_RIGHTS, the request only carries their offsets, so no payload goes through the socket.
+struct FlowRequest {
+    char magic[4];          // "NVRQ"
+    uint32_t id;            // echoed in the reply
+    uint32_t flags;
+    uint32_t format;        // NV_OF_BUFFER_FORMAT of both frames, tightly packed
+    uint32_t width;         // frame size in pixels
+    uint32_t height;
+    uint32_t gridsize;      // output grid size 1, 2 or 4
+    uint32_t reserved;
+    uint64_t buffersize;    // size of the attached buffer, only with FLOW_REQUEST_BUFFER
+    uint64_t frame1;        // offset of the first frame in the buffer
+    uint64_t frame2;        // offset of the second frame
+    uint64_t flow;          // offset of the width / gridsize * height / gridsize output grid
+};
+
+struct FlowReply {
+    char magic[4];          // "NVRP"
+    uint32_t id;
+    int32_t status;         // 0 on success, the output grid is then filled in
+    uint32_t outwidth;
+    uint32_t outheight;
+    char error[FLOW_ERROR_SIZE];    // message when status is not 0
+};
+
+// Function to send a message, passing fd along with it unless it is negative. Returns false on failure.
+bool sendMessage(int socket, const void* message, size_t size, int fd = -1);
+
+// Function to receive a message of exactly size bytes. A passed file descriptor is stored in fd,
+// which is set to -1 otherwise. Returns false on failure or when the peer closed the connection.
+bool receiveMessage(int socket, void* message, size_t size, int& fd);
@@ -0,0 +1,271 @@
+#include "flowserver.h"
+#include "flowsession.h"
+#include "imgproc.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Requests asking for the same session sort next to each other
+static bool sameShape(const FlowRequest& a, const FlowRequest& b) {
+    return a.format == b.format && a.width == b.width && a.height == b.height && a.gridsize == b.gridsize;
+}
+
+static bool shapeLess(const FlowJob* a, const FlowJob* b) {
+    const FlowRequest& x = a->request;
+    const FlowRequest& y = b->request;
+    if (x.format != y.format)
+        return x.format < y.format;
+    if (x.width != y.width)
+        return x.width < y.width;
+    if (x.height != y.height)
+        return x.height < y.height;
+    return x.gridsize < y.gridsize;
+}
+
+static void setError(FlowReply& reply, const char* message) {
+    reply.status = -1;
+    strncpy(reply.error, message, FLOW_ERROR_SIZE - 1);
+    reply.error[FLOW_ERROR_SIZE - 1] = 0;
+}
+
+// Checks that a region lies within the buffer without overflowing
+static bool inBuffer(uint64_t offset, uint64_t size, uint64_t buffersize) {
+    return offset <= buffersize && size <= buffersize - offset;
+}
+
+FlowServer::FlowServer(const std::string& backend, uint32_t numthreads, CUcontext context, CUstream instream,
+                       CUstream outstream, uint32_t batchsize)
+    : m_backend(backend), m_numthreads(numthreads), m_context(context), m_instream(instream), m_outstream(outstream),
+      m_batchsize(std::max(1u, batchsize)), m_listener(-1), m_stopping(false), m_jobs(FLOW_SERVER_QUEUE), m_clock(0),
+      m_served(0), m_batches(0) {
+}
+
+FlowServer::~FlowServer() {
+    m_jobs.close();
+    if (m_worker.joinable())
+        m_worker.join();
+}
+
+void FlowServer::stop() {
+    m_stopping = true;
+    // Wakes up accept()
+    if (m_listener >= 0)
+        shutdown(m_listener, SHUT_RDWR);
+}
+
+void FlowServer::run(const std::string& path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path too long: " + path);
+    strcpy(address.sun_path, path.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        throw std::runtime_error("Failed to create the socket");
+    // A socket file left behind by a previous run would make bind fail
+    unlink(path.c_str());
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, FLOW_SERVER_BACKLOG) != 0) {
+        close(listener);
+        throw std::runtime_error("Failed to listen on " + path);
+    }
+    m_listener = listener;
+    if (m_stopping)
+        shutdown(m_listener, SHUT_RDWR);
+
+    m_worker = std::thread(&FlowServer::workerLoop, this);
+    while (!m_stopping) {
+        int fd = accept4(m_listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        reapConnections(false);
+        Connection* connection = new Connection();
+        connection->fd = fd;
+        connection->finished = false;
+        connection->thread = std::thread(&FlowServer::serveConnection, this, connection);
+        m_connections.push_back(connection);
+    }
+
+    // Connections are ended first, the worker finishes whatever they still queued
+    m_listener = -1;
+    close(listener);
+    unlink(path.c_str());
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        reapConnections(true);
+    }
+    m_jobs.close();
+    m_worker.join();
+}
+
+// Joins finished connection threads, or all of them after shutting their sockets down. Called with m_mutex held.
+void FlowServer::reapConnections(bool all) {
+    std::vector<Connection*> alive;
+    for (size_t i = 0; i < m_connections.size(); ++i) {
+        Connection* connection = m_connections[i];
+        if (all)
+            shutdown(connection->fd, SHUT_RDWR);
+        if (all || connection->finished) {
+            connection->thread.join();
+            close(connection->fd);
+            delete connection;
+        }
+        else
+            alive.push_back(connection);
+    }
+    m_connections.swap(alive);
+}
+
+void FlowServer::serveConnection(Connection* connection) {
+    uint8_t* buffer = nullptr;
+    uint64_t buffersize = 0;
+    BoundedQueue<FlowJob*> done(1);
+    FlowJob job;
+    job.done = &done;
+
+    FlowRequest request;
+    int fd;
+    while (receiveMessage(connection->fd, &request, sizeof(request), fd)) {
+        FlowReply reply;
+        memset(&reply, 0, sizeof(reply));
+        memcpy(reply.magic, "NVRP", 4);
+        reply.id = request.id;
+
+        // A new buffer replaces the old one, the descriptor is not needed once it is mapped. Touching pages beyond
+        // the end of the file raises SIGBUS, so the buffer has to cover the size the client claims and be sealed
+        // against shrinking, otherwise the client could truncate it under a running request.
+        const char* buffererror = "No shared buffer";
+        if ((request.flags & FLOW_REQUEST_BUFFER) && fd >= 0) {
+            if (buffer)
+                munmap(buffer, buffersize);
+            buffer = nullptr;
+            buffersize = 0;
+            struct stat info;
+            int seals = fcntl(fd, F_GET_SEALS);
+            if (seals < 0 || !(seals & F_SEAL_SHRINK))
+                buffererror = "The shared buffer is not sealed against shrinking";
+            else if (request.buffersize == 0 || fstat(fd, &info) != 0 || (uint64_t)info.st_size < request.buffersize)
+                buffererror = "The shared buffer is smaller than its size";
+            else {
+                void* mapping = mmap(nullptr, request.buffersize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (mapping != MAP_FAILED) {
+                    buffer = (uint8_t*)mapping;
+                    buffersize = request.buffersize;
+                }
+                else
+                    buffererror = "Failed to map the shared buffer";
+            }
+        }
+        if (fd >= 0)
+            close(fd);
+
+        uint32_t outwidth = 0, outheight = 0;
+        bool validformat = request.format == NV_OF_BUFFER_FORMAT_ABGR8 || request.format == NV_OF_BUFFER_FORMAT_NV12 ||
+                           request.format == NV_OF_BUFFER_FORMAT_GRAYSCALE8;
+        bool validgrid = request.gridsize == 1 || request.gridsize == 2 || request.gridsize == 4;
+        if (validgrid)
+            calculateOutputDimensions(initializeOFParameters(request.width, request.height, request.gridsize), outwidth, outheight);
+        size_t framesize = validformat ? frameSize((NV_OF_BUFFER_FORMAT)request.format, request.width, request.height) : 0;
+        uint64_t flowsize = (uint64_t)outwidth * outheight * sizeof(NV_OF_FLOW_VECTOR);
+
+        if (memcmp(request.magic, "NVRQ", 4) != 0)
+            setError(reply, "Bad request");
+        else if (!buffer)
+            setError(reply, buffererror);
+        else if (!validformat || !validgrid || outwidth == 0 || outheight == 0)
+            setError(reply, "Unsupported format, size or grid size");
+        else if (!inBuffer(request.frame1, framesize, buffersize) || !inBuffer(request.frame2, framesize, buffersize) ||
+                 !inBuffer(request.flow, flowsize, buffersize))
+            setError(reply, "Request does not fit the shared buffer");
+        else {
+            job.request = request;
+            job.frame1 = buffer + request.frame1;
+            job.frame2 = buffer + request.frame2;
+            job.flow = (NV_OF_FLOW_VECTOR*)(buffer + request.flow);
+            job.reply = reply;
+            FlowJob* finished;
+            if (m_jobs.push(&job) && done.pop(finished))
+                reply = job.reply;
+            else
+                setError(reply, "Server is shutting down");
+        }
+        if (!sendMessage(connection->fd, &reply, sizeof(reply)))
+            break;
+    }
+
+    if (buffer)
+        munmap(buffer, buffersize);
+    connection->finished = true;
+}
+
+// Function to get the warm session for the shape of a request, creating it on first use
+FlowBackend* FlowServer::getSession(const FlowRequest& request) {
+    ++m_clock;
+    for (size_t i = 0; i < m_sessions.size(); ++i) {
+        if (sameShape(m_sessions[i].shape, request)) {
+            m_sessions[i].lastused = m_clock;
+            return m_sessions[i].backend.get();
+        }
+    }
+
+    if (m_sessions.size() >= FLOW_SERVER_MAX_SESSIONS) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < m_sessions.size(); ++i) {
+            if (m_sessions[i].lastused < m_sessions[oldest].lastused)
+                oldest = i;
+        }
+        m_sessions.erase(m_sessions.begin() + oldest);
+    }
+
+    Session session;
+    session.shape = request;
+    session.lastused = m_clock;
+    session.backend.reset(createFlowBackend(m_backend, initializeOFParameters(request.width, request.height, request.gridsize,
+                                                                              (NV_OF_BUFFER_FORMAT)request.format),
+                                            m_numthreads, m_context, m_instream, m_outstream));
+    m_sessions.push_back(std::move(session));
+    return m_sessions.back().backend.get();
+}
+
+void FlowServer::workerLoop() {
+    std::vector<FlowJob*> batch;
+    FlowJob* job;
+    while (m_jobs.pop(job)) {
+        // Everything already queued goes into the batch, and requests for the same session run back to back
+        batch.assign(1, job);
+        while (batch.size() < m_batchsize && m_jobs.tryPop(job))
+            batch.push_back(job);
+        std::stable_sort(batch.begin(), batch.end(), shapeLess);
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            FlowJob* current = batch[i];
+            try
+            {
+                FlowBackend* backend = getSession(current->request);
+                backend->compute(current->frame1, current->frame2, current->flow);
+                current->reply.status = 0;
+                current->reply.outwidth = backend->getOutputWidth();
+                current->reply.outheight = backend->getOutputHeight();
+            }
+            catch(const std::exception& e)
+            {
+                setError(current->reply, e.what());
+            }
+            current->done->push(current);
+        }
+        m_served += batch.size();
+        ++m_batches;
+    }
+}
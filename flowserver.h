@@ -0,0 +1,78 @@
+#pragma once
+#include "flowbackend.h"
+#include "flowprotocol.h"
+#include "pipeline.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FLOW_SERVER_QUEUE 64            // requests waiting for the flow engine
+#define FLOW_SERVER_BATCH 16            // default for the requests taken off the queue at once
+#define FLOW_SERVER_MAX_SESSIONS 4      // warm sessions kept, the least recently used one is dropped first
+#define FLOW_SERVER_BACKLOG 64          // pending connections on the listening socket
+
+// A request handed from a connection thread to the worker, the reply comes back through done
+struct FlowJob {
+    FlowRequest request;
+    const uint8_t* frame1;
+    const uint8_t* frame2;
+    NV_OF_FLOW_VECTOR* flow;
+    FlowReply reply;
+    BoundedQueue<FlowJob*>* done;
+};
+
+// Daemon side of the flow service. Every client connection gets a thread that maps the client's
+// shared buffer and queues its requests; a single worker owns the warm flow sessions, one per
+// frame format, size and grid size, and runs whatever is queued in batches grouped by session.
+class FlowServer {
+public:
+    FlowServer(const std::string& backend, uint32_t numthreads, CUcontext context, CUstream instream, CUstream outstream,
+               uint32_t batchsize = FLOW_SERVER_BATCH);
+    ~FlowServer();
+
+    // Accepts connections on a Unix domain socket at path until stop() is called
+    void run(const std::string& path);
+
+    // Makes run() return, safe to call from a signal handler
+    void stop();
+
+    uint64_t getServed() { return m_served; }
+    uint64_t getBatches() { return m_batches; }
+
+private:
+    struct Connection {
+        int fd;
+        std::thread thread;
+        std::atomic<bool> finished;
+    };
+    struct Session {
+        FlowRequest shape;
+        std::unique_ptr<FlowBackend> backend;
+        uint64_t lastused;
+    };
+
+    void serveConnection(Connection* connection);
+    void workerLoop();
+    FlowBackend* getSession(const FlowRequest& request);
+    void reapConnections(bool all);
+
+    std::string m_backend;
+    uint32_t m_numthreads;
+    CUcontext m_context;
+    CUstream m_instream;
+    CUstream m_outstream;
+    uint32_t m_batchsize;
+    int m_listener;
+    std::atomic<bool> m_stopping;
+    BoundedQueue<FlowJob*> m_jobs;
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::vector<Connection*> m_connections;
+    std::vector<Session> m_sessions;
+    uint64_t m_clock;
+    std::atomic<uint64_t> m_served;
+    std::atomic<uint64_t> m_batches;
+};
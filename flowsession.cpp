@@ -0,0 +1,225 @@
+#include "flowsession.h"
+#include "flowhints.h"
+#include <algorithm>
+
+// Function to initialize NVOF parameters
+NV_OF_INIT_PARAMS initializeOFParameters(uint32_t width, uint32_t height, uint8_t gridsize, NV_OF_BUFFER_FORMAT format,
+                                         bool outputcost) {
+    NV_OF_INIT_PARAMS initparams = { 0 };
+    initparams.width = width;
+    initparams.height = height;
+    initparams.inputBufferFormat = format;
+    initparams.mode = NV_OF_MODE_OPTICALFLOW;
+    initparams.outGridSize = (NV_OF_OUTPUT_VECTOR_GRID_SIZE)gridsize;
+    initparams.enableOutputCost = outputcost ? NV_OF_TRUE : NV_OF_FALSE;
+    initparams.predDirection = NV_OF_PRED_DIRECTION_FORWARD;
+    initparams.perfLevel = NV_OF_PERF_LEVEL_SLOW;
+    initparams.enableExternalHints = NV_OF_FALSE;
+    initparams.enableRoi = NV_OF_FALSE;
+    initparams.enableGlobalFlow = NV_OF_FALSE;
+    initparams.hintGridSize = (NV_OF_HINT_VECTOR_GRID_SIZE)0;
+
+    return initparams;
+}
+
+// Function to calculate output buffer dimensions
+void calculateOutputDimensions(const NV_OF_INIT_PARAMS& initparams, uint32_t& outwidth, uint32_t& outheight) {
+    outheight = initparams.height / initparams.outGridSize;
+    outwidth = initparams.width / initparams.outGridSize;
+}
+
+// Function to create an input buffer matching the session parameters
+NvOFCudaBuffer* createInputBuffer(API* nvofobj, const NV_OF_INIT_PARAMS& initparams) {
+    NV_OF_BUFFER_DESCRIPTOR bufferDesc;
+    bufferDesc.width = initparams.width;
+    bufferDesc.height = initparams.height;
+    bufferDesc.bufferUsage = NV_OF_BUFFER_USAGE_INPUT;
+    bufferDesc.bufferFormat = initparams.inputBufferFormat;
+
+    return new NvOFCudaBuffer(nvofobj, bufferDesc);
+}
+
+// Function to create output buffer
+NvOFCudaBuffer* createOutputBuffer(API* nvofobj, uint32_t outwidth, uint32_t outheight) {
+    NV_OF_BUFFER_DESCRIPTOR outbufferDesc;
+    outbufferDesc.width = outwidth;
+    outbufferDesc.height = outheight;
+    outbufferDesc.bufferUsage = NV_OF_BUFFER_USAGE_OUTPUT;
+    outbufferDesc.bufferFormat = NV_OF_BUFFER_FORMAT_SHORT2;
+
+    return new NvOFCudaBuffer(nvofobj, outbufferDesc);
+}
+
+// Function to create the 8 bit cost buffer matching the output buffer
+NvOFCudaBuffer* createCostBuffer(API* nvofobj, uint32_t outwidth, uint32_t outheight) {
+    NV_OF_BUFFER_DESCRIPTOR costbufferDesc;
+    costbufferDesc.width = outwidth;
+    costbufferDesc.height = outheight;
+    costbufferDesc.bufferUsage = NV_OF_BUFFER_USAGE_COST;
+    costbufferDesc.bufferFormat = NV_OF_BUFFER_FORMAT_UINT8;
+
+    return new NvOFCudaBuffer(nvofobj, costbufferDesc);
+}
+
+// Function to calculate hint buffer dimensions
+void calculateHintDimensions(const NV_OF_INIT_PARAMS& initparams, uint32_t& hintwidth, uint32_t& hintheight) {
+    hintheight = initparams.height / initparams.hintGridSize;
+    hintwidth = initparams.width / initparams.hintGridSize;
+}
+
+// Function to create the external hint buffer matching the session parameters
+NvOFCudaBuffer* createHintBuffer(API* nvofobj, const NV_OF_INIT_PARAMS& initparams) {
+    NV_OF_BUFFER_DESCRIPTOR hintbufferDesc;
+    calculateHintDimensions(initparams, hintbufferDesc.width, hintbufferDesc.height);
+    hintbufferDesc.bufferUsage = NV_OF_BUFFER_USAGE_HINT;
+    hintbufferDesc.bufferFormat = NV_OF_BUFFER_FORMAT_SHORT2;
+
+    return new NvOFCudaBuffer(nvofobj, hintbufferDesc);
+}
+
+// Function to prepare execution input parameters
+NV_OF_EXECUTE_INPUT_PARAMS prepareExecutionInputParams(NvOFCudaBuffer* inbuffer, NvOFCudaBuffer* refbuffer,
+                                                       NvOFCudaBuffer* hintbuffer) {
+    NV_OF_EXECUTE_INPUT_PARAMS inparams;
+    memset(&inparams, 0, sizeof(NV_OF_EXECUTE_INPUT_PARAMS));
+
+    inparams.inputFrame = inbuffer->getOFBufferHandle();
+    inparams.referenceFrame = refbuffer->getOFBufferHandle();
+    inparams.externalHints = hintbuffer ? hintbuffer->getOFBufferHandle() : (NvOFGPUBufferHandle)nullptr;
+    inparams.disableTemporalHints = NV_OF_FALSE;
+    inparams.hPrivData = (NvOFPrivDataHandle)nullptr;
+    inparams.numRois = 0;
+    inparams.padding = 0;
+    inparams.padding2 = 0;
+
+    return inparams;
+}
+
+// Function to prepare execution output parameters
+NV_OF_EXECUTE_OUTPUT_PARAMS prepareExecutionOutputParams(NvOFCudaBuffer* outbuffer, NvOFCudaBuffer* costbuffer,
+                                                         NvOFCudaBuffer* bwdbuffer, NvOFCudaBuffer* bwdcostbuffer) {
+    NV_OF_EXECUTE_OUTPUT_PARAMS outparams;
+    memset(&outparams, 0, sizeof(NV_OF_EXECUTE_OUTPUT_PARAMS));
+
+    outparams.bwdOutputBuffer = bwdbuffer ? bwdbuffer->getOFBufferHandle() : nullptr;
+    outparams.bwdOutputCostBuffer = bwdcostbuffer ? bwdcostbuffer->getOFBufferHandle() : nullptr;
+    outparams.globalFlowBuffer = nullptr;
+    outparams.hPrivData = nullptr;
+    outparams.outputBuffer = outbuffer->getOFBufferHandle();
+    outparams.outputCostBuffer = costbuffer ? costbuffer->getOFBufferHandle() : nullptr;
+
+    return outparams;
+}
+
+// Makes the session context current on the calling thread for the duration of a call,
+// so a session can be driven from a pipeline thread other than the one that created it
+class ScopedContext {
+public:
+    explicit ScopedContext(CUcontext ctx) { CUDA_DRVAPI_CALL(cuCtxPushCurrent(ctx)); }
+    ~ScopedContext() { CUcontext ctx; cuCtxPopCurrent(&ctx); }
+};
+
+FlowSession::FlowSession(CUcontext context, CUstream instream, CUstream outstream, const NV_OF_INIT_PARAMS& initparams)
+    : m_initparams(initparams), m_newest(NUM_INPUT_BUFFERS - 1), m_uploaded(0), m_hintfactor(1), m_hinted(false)
+{
+    // Load the library and create the handle once for the whole stream
+    m_api.reset(new API(context, instream, outstream));
+    if (!m_api->getHandle()) {
+        NVOF_THROW_ERROR("Failed to create the optical flow handle", NV_OF_ERR_OF_NOT_AVAILABLE);
+    }
+    NVOF_API_CALL(m_api->getAPI()->nvOFInit(m_api->getHandle(), &m_initparams));
+
+    // The buffers only depend on the init parameters, so they are allocated up front
+    calculateOutputDimensions(m_initparams, m_outwidth, m_outheight);
+    for (uint32_t i = 0; i < NUM_INPUT_BUFFERS; ++i)
+        m_inbuffers[i].reset(createInputBuffer(m_api.get(), m_initparams));
+    m_outbuffer.reset(createOutputBuffer(m_api.get(), m_outwidth, m_outheight));
+    if (m_initparams.enableOutputCost)
+        m_costbuffer.reset(createCostBuffer(m_api.get(), m_outwidth, m_outheight));
+    if (m_initparams.predDirection == NV_OF_PRED_DIRECTION_BOTH) {
+        m_bwdbuffer.reset(createOutputBuffer(m_api.get(), m_outwidth, m_outheight));
+        if (m_initparams.enableOutputCost)
+            m_bwdcostbuffer.reset(createCostBuffer(m_api.get(), m_outwidth, m_outheight));
+    }
+    if (m_initparams.enableExternalHints) {
+        // The hints are the output downsampled by a power of two, so their grid may not be finer
+        uint32_t hintgrid = m_initparams.hintGridSize;
+        uint32_t outgrid = m_initparams.outGridSize;
+        m_hintfactor = hintgrid / outgrid;
+        if (hintgrid < outgrid || hintgrid % outgrid) {
+            NVOF_THROW_ERROR("The hint grid size has to be a multiple of the output grid size", NV_OF_ERR_INVALID_PARAM);
+        }
+        m_hintbuffer.reset(createHintBuffer(m_api.get(), m_initparams));
+        m_hints.resize((size_t)m_hintbuffer->getWidth() * m_hintbuffer->getHeight());
+        ScopedContext scopedctx(m_api->getContext());
+        uploadHints(nullptr);
+    }
+}
+
+void FlowSession::uploadHints(const NV_OF_FLOW_VECTOR* flowdata) {
+    if (flowdata)
+        downsampleHints(flowdata, m_outwidth, m_outheight, m_hintfactor, m_hints.data(), m_hintscratch);
+    else
+        std::fill(m_hints.begin(), m_hints.end(), NV_OF_FLOW_VECTOR());
+    m_hintbuffer->UploadData(m_hints.data());
+    m_hinted = flowdata != nullptr;
+}
+
+void FlowSession::upload(const uint8_t* frame) {
+    m_newest = (m_newest + 1) % NUM_INPUT_BUFFERS;
+    m_inbuffers[m_newest]->UploadData(frame);
+    ++m_uploaded;
+}
+
+void FlowSession::execute(NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata, NV_OF_FLOW_VECTOR* bwddata) {
+    // The previous frame is the input and the newest one is the reference, the handles just swap roles
+    uint32_t previous = (m_newest + NUM_INPUT_BUFFERS - 1) % NUM_INPUT_BUFFERS;
+    NV_OF_EXECUTE_INPUT_PARAMS inparams = prepareExecutionInputParams(m_inbuffers[previous].get(), m_inbuffers[m_newest].get(),
+                                                                         m_hintbuffer.get());
+    NV_OF_EXECUTE_OUTPUT_PARAMS outparams = prepareExecutionOutputParams(m_outbuffer.get(), m_costbuffer.get(),
+                                                                           m_bwdbuffer.get(), m_bwdcostbuffer.get());
+
+    // Run Optical Flow
+    NVOF_API_CALL(m_api->getAPI()->nvOFExecute(m_api->getHandle(), &inparams, &outparams));
+
+    // Download flow vectors. All output buffers copy on the output stream, so the cost and the backward
+    // vectors ride on the same synchronization
+    m_outbuffer->DownloadData(flowdata, false);
+    if (costdata && m_costbuffer)
+        m_costbuffer->DownloadData(costdata, false);
+    if (bwddata && m_bwdbuffer)
+        m_bwdbuffer->DownloadData(bwddata, false);
+    CUDA_DRVAPI_CALL(cuStreamSynchronize(m_api->getCudaStream(NV_OF_BUFFER_USAGE_OUTPUT)));
+
+    // This flow predicts the next pair of the stream
+    if (m_hintbuffer)
+        uploadHints(flowdata);
+}
+
+bool FlowSession::compute(const uint8_t* frame, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata, NV_OF_FLOW_VECTOR* bwddata) {
+    ScopedContext scopedctx(m_api->getContext());
+    upload(frame);
+    if (m_uploaded < 2)
+        return false;
+
+    execute(flowdata, costdata, bwddata);
+    return true;
+}
+
+void FlowSession::advance(const uint8_t* frame) {
+    ScopedContext scopedctx(m_api->getContext());
+    // The pair computed next starts frames after the flow the hints came from, so it starts over from zero
+    if (m_hinted)
+        uploadHints(nullptr);
+    upload(frame);
+}
+
+void FlowSession::compute(const uint8_t* frame1, const uint8_t* frame2, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata,
+                          NV_OF_FLOW_VECTOR* bwddata) {
+    ScopedContext scopedctx(m_api->getContext());
+    if (m_hinted)
+        uploadHints(nullptr);
+    upload(frame1);
+    upload(frame2);
+    execute(flowdata, costdata, bwddata);
+}
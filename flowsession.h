@@ -0,0 +1,96 @@
+#pragma once
+#include "flowvec.h"
+#include "flowbackend.h"
+#include <memory>
+#include <vector>
+
+// Function to initialize NVOF parameters, outputcost makes the engine rate every vector
+NV_OF_INIT_PARAMS initializeOFParameters(uint32_t width, uint32_t height, uint8_t gridsize,
+                                         NV_OF_BUFFER_FORMAT format = NV_OF_BUFFER_FORMAT_ABGR8, bool outputcost = false);
+
+// Function to calculate output buffer dimensions
+void calculateOutputDimensions(const NV_OF_INIT_PARAMS& initparams, uint32_t& outwidth, uint32_t& outheight);
+
+// Function to create an input buffer matching the session parameters
+NvOFCudaBuffer* createInputBuffer(API* nvofobj, const NV_OF_INIT_PARAMS& initparams);
+
+// Function to create output buffer
+NvOFCudaBuffer* createOutputBuffer(API* nvofobj, uint32_t outwidth, uint32_t outheight);
+
+// Function to create the 8 bit cost buffer matching the output buffer
+NvOFCudaBuffer* createCostBuffer(API* nvofobj, uint32_t outwidth, uint32_t outheight);
+
+// Function to calculate hint buffer dimensions
+void calculateHintDimensions(const NV_OF_INIT_PARAMS& initparams, uint32_t& hintwidth, uint32_t& hintheight);
+
+// Function to create the external hint buffer matching the session parameters
+NvOFCudaBuffer* createHintBuffer(API* nvofobj, const NV_OF_INIT_PARAMS& initparams);
+
+// Function to prepare execution input parameters, the hint buffer is only passed when the session takes external hints
+NV_OF_EXECUTE_INPUT_PARAMS prepareExecutionInputParams(NvOFCudaBuffer* inbuffer, NvOFCudaBuffer* refbuffer,
+                                                       NvOFCudaBuffer* hintbuffer = nullptr);
+
+// Function to prepare execution output parameters. The cost buffers are only passed when the session outputs cost,
+// the backward ones only when it predicts in both directions.
+NV_OF_EXECUTE_OUTPUT_PARAMS prepareExecutionOutputParams(NvOFCudaBuffer* outbuffer, NvOFCudaBuffer* costbuffer = nullptr,
+                                                         NvOFCudaBuffer* bwdbuffer = nullptr, NvOFCudaBuffer* bwdcostbuffer = nullptr);
+
+// Number of input buffers rotated between the input and reference roles
+#define NUM_INPUT_BUFFERS 2
+
+// Owns the loaded API, the initialized NVOF handle and the GPU buffers for the lifetime of a stream,
+// so that every frame pair only pays for upload, execute and download.
+// With external hints enabled, the output of every execute is median downsampled to the hint grid and
+// uploaded as the hints of the next one, so a fast perf level still tracks large motion. Independent
+// pairs and the first pair after frames were only advanced over start over from zero hints.
+class FlowSession : public FlowBackend {
+public:
+    FlowSession(CUcontext context, CUstream instream, CUstream outstream, const NV_OF_INIT_PARAMS& initparams);
+
+    // Uploads the newest frame of a stream into the stale input buffer. Once two frames have been seen,
+    // runs optical flow between the previous frame and this one and returns true.
+    bool compute(const uint8_t* frame, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata = nullptr, NV_OF_FLOW_VECTOR* bwddata = nullptr);
+
+    // Only uploads the frame into the next input buffer. The hints go back to zero, the last flow is
+    // too old to predict the pair computed next.
+    void advance(const uint8_t* frame);
+
+    // Uploads both frames of an independent pair, runs optical flow and downloads the vectors into flowdata
+    void compute(const uint8_t* frame1, const uint8_t* frame2, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata = nullptr,
+                 NV_OF_FLOW_VECTOR* bwddata = nullptr);
+
+    bool hasCost() { return m_costbuffer != nullptr; }
+
+    const NV_OF_INIT_PARAMS& getInitParams() { return m_initparams; }
+    uint32_t getOutputWidth() { return m_outwidth; }
+    uint32_t getOutputHeight() { return m_outheight; }
+
+private:
+    // Uploads a frame into the stale slot, which then becomes the newest one
+    void upload(const uint8_t* frame);
+    // Runs optical flow from the previous slot to the newest slot
+    void execute(NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata, NV_OF_FLOW_VECTOR* bwddata);
+    // Uploads the hints for the next execute, from the flow just computed or zero without one
+    void uploadHints(const NV_OF_FLOW_VECTOR* flowdata);
+
+    // Declared first so that the buffers are destroyed before the handle and library go away
+    std::unique_ptr<API> m_api;
+    NV_OF_INIT_PARAMS m_initparams;
+    uint32_t m_outwidth;
+    uint32_t m_outheight;
+    std::unique_ptr<NvOFCudaBuffer> m_inbuffers[NUM_INPUT_BUFFERS];
+    uint32_t m_newest;
+    uint32_t m_uploaded;
+    std::unique_ptr<NvOFCudaBuffer> m_outbuffer;
+    // Only allocated when the session was initialized with enableOutputCost
+    std::unique_ptr<NvOFCudaBuffer> m_costbuffer;
+    // Only allocated when the session predicts in both directions, the backward cost is not downloaded
+    std::unique_ptr<NvOFCudaBuffer> m_bwdbuffer;
+    std::unique_ptr<NvOFCudaBuffer> m_bwdcostbuffer;
+    // Only allocated when the session takes external hints, with the host grid they are built in
+    std::unique_ptr<NvOFCudaBuffer> m_hintbuffer;
+    std::vector<NV_OF_FLOW_VECTOR> m_hints;
+    std::vector<NV_OF_FLOW_VECTOR> m_hintscratch;
+    uint32_t m_hintfactor;
+    bool m_hinted;
+};
@@ -0,0 +1,197 @@
+#include "flowshm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Rounds size up to a multiple of alignment
+static size_t alignSize(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Offset of the flow and the visualization within a slot
+static size_t flowOffset() {
+    return alignSize(sizeof(FlowShmSlot), FLOW_SHM_ALIGNMENT);
+}
+
+static size_t visualOffset(uint64_t flowbytes) {
+    return flowOffset() + alignSize(flowbytes, FLOW_SHM_ALIGNMENT);
+}
+
+// The futex word lives in memory shared between processes, so the private flag must not be used
+static long futex(const uint32_t* word, int op, uint32_t value, const struct timespec* timeout) {
+    return syscall(SYS_futex, word, op, value, timeout, nullptr, 0);
+}
+
+FlowShmPublisher::FlowShmPublisher(const std::string& name, uint32_t width, uint32_t height, uint32_t gridsize,
+                                   bool visual, uint32_t numslots)
+    : m_name(name), m_header(nullptr), m_memory(nullptr), m_size(0), m_device(0), m_inode(0) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uint64_t flowbytes = (uint64_t)width * height * sizeof(NV_OF_FLOW_VECTOR);
+    uint64_t visualbytes = visual ? (uint64_t)width * height * 3 : 0;
+    size_t slotbytes = alignSize(visualOffset(flowbytes) + visualbytes, page);
+    size_t headerbytes = alignSize(sizeof(FlowShmHeader), page);
+    m_size = headerbytes + slotbytes * numslots;
+
+    // A segment left behind under the name, by a crashed run or one still publishing, is unlinked rather than
+    // truncated: its publisher and readers keep their own object, and new readers only ever see the new one
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Failed to create shared memory " + name);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || ftruncate(fd, (off_t)m_size) != 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Failed to size shared memory " + name);
+    }
+    m_device = (uint64_t)info.st_dev;
+    m_inode = (uint64_t)info.st_ino;
+    void* mapping = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Failed to map shared memory " + name);
+    }
+    m_header = (FlowShmHeader*)mapping;
+    m_memory = (uint8_t*)mapping + headerbytes;
+
+    m_header->version = FLOW_SHM_VERSION;
+    m_header->width = width;
+    m_header->height = height;
+    m_header->gridsize = gridsize;
+    m_header->numslots = numslots;
+    m_header->flowbytes = flowbytes;
+    m_header->visualbytes = visualbytes;
+    m_header->slotbytes = slotbytes;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(m_header->magic, "NVSH", 4);
+}
+
+FlowShmPublisher::~FlowShmPublisher() {
+    __atomic_store_n(&m_header->closed, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&m_header->wakeup, 1, __ATOMIC_RELEASE);
+    futex(&m_header->wakeup, FUTEX_WAKE, INT_MAX, nullptr);
+    munmap(m_header, m_size);
+    // Readers keep their mappings, the name is free for the next run unless a newer publisher already took it
+    int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+    if (fd >= 0) {
+        struct stat info;
+        bool ours = fstat(fd, &info) == 0 && (uint64_t)info.st_dev == m_device && (uint64_t)info.st_ino == m_inode;
+        close(fd);
+        if (ours)
+            shm_unlink(m_name.c_str());
+    }
+}
+
+void FlowShmPublisher::publish(const NV_OF_FLOW_VECTOR* flowdata, const uint8_t* visual) {
+    uint64_t frame = m_header->published;
+    uint8_t* base = m_memory + (frame % m_header->numslots) * m_header->slotbytes;
+    FlowShmSlot* slot = (FlowShmSlot*)base;
+
+    // Odd while the payload changes, the fence keeps the payload stores after it
+    __atomic_store_n(&slot->seq, 2 * frame + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->frame = frame;
+    memcpy(base + flowOffset(), flowdata, m_header->flowbytes);
+    if (m_header->visualbytes && visual)
+        memcpy(base + visualOffset(m_header->flowbytes), visual, m_header->visualbytes);
+    __atomic_store_n(&slot->seq, 2 * frame + 2, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&m_header->published, frame + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&m_header->wakeup, 1, __ATOMIC_RELEASE);
+    futex(&m_header->wakeup, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+FlowShmReader::FlowShmReader(const std::string& name)
+    : m_header(nullptr), m_memory(nullptr), m_size(0) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open shared memory " + name);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(FlowShmHeader)) {
+        close(fd);
+        throw std::runtime_error(name + " is not a flow ring");
+    }
+    m_size = (size_t)info.st_size;
+    void* mapping = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Failed to map shared memory " + name);
+    m_header = (const FlowShmHeader*)mapping;
+
+    uint32_t magic;
+    memcpy(&magic, m_header->magic, 4);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    size_t headerbytes = alignSize(sizeof(FlowShmHeader), (size_t)sysconf(_SC_PAGESIZE));
+    if (memcmp(&magic, "NVSH", 4) != 0 || m_header->version != FLOW_SHM_VERSION || m_header->numslots == 0 ||
+        headerbytes + m_header->slotbytes * m_header->numslots > m_size) {
+        munmap(mapping, m_size);
+        throw std::runtime_error(name + " is not a flow ring");
+    }
+    m_memory = (const uint8_t*)mapping + headerbytes;
+}
+
+FlowShmReader::~FlowShmReader() {
+    munmap((void*)m_header, m_size);
+}
+
+const FlowShmSlot* FlowShmReader::slot(uint64_t frame) {
+    return (const FlowShmSlot*)(m_memory + (frame % m_header->numslots) * m_header->slotbytes);
+}
+
+FlowShmStatus FlowShmReader::acquire(uint64_t frame, const NV_OF_FLOW_VECTOR*& flowdata, const uint8_t*& visual) {
+    uint64_t seq = __atomic_load_n(&slot(frame)->seq, __ATOMIC_ACQUIRE);
+    if (seq > 2 * frame + 2)
+        return FLOW_SHM_OVERRUN;
+    if (seq != 2 * frame + 2)
+        return FLOW_SHM_PENDING;
+    const uint8_t* base = (const uint8_t*)slot(frame);
+    flowdata = (const NV_OF_FLOW_VECTOR*)(base + flowOffset());
+    visual = m_header->visualbytes ? base + visualOffset(m_header->flowbytes) : nullptr;
+    return FLOW_SHM_READY;
+}
+
+bool FlowShmReader::validate(uint64_t frame) {
+    // Orders the reads of the payload before the second look at the sequence
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot(frame)->seq, __ATOMIC_RELAXED) == 2 * frame + 2;
+}
+
+bool FlowShmReader::wait(uint64_t frame, int timeoutms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutms / 1000;
+    deadline.tv_nsec += (long)(timeoutms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while (true) {
+        // The word is read before the count, so a publish in between changes it and the futex returns at once
+        uint32_t word = __atomic_load_n(&m_header->wakeup, __ATOMIC_ACQUIRE);
+        if (getPublished() > frame)
+            return true;
+        if (isClosed())
+            return false;
+        struct timespec now, left;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left.tv_sec = deadline.tv_sec - now.tv_sec;
+        left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (left.tv_nsec < 0) {
+            --left.tv_sec;
+            left.tv_nsec += 1000000000;
+        }
+        if (left.tv_sec < 0)
+            return false;
+        if (futex(&m_header->wakeup, FUTEX_WAIT, word, &left) != 0 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+            return false;
+    }
+}
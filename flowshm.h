@@ -0,0 +1,94 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+#include <stddef.h>
+#include <string>
+
+#define FLOW_SHM_VERSION 1
+#define FLOW_SHM_SLOTS 8            // frames kept in the ring, a reader may lag this far behind
+#define FLOW_SHM_ALIGNMENT 64       // payloads start on a cache line
+
+// Start of the shared memory object, followed by numslots slots of slotbytes each. The counters
+// are only accessed with atomic builtins, the other fields never change once magic is set.
+struct FlowShmHeader {
+    char magic[4];          // "NVSH", written last by the publisher
+    uint32_t version;
+    uint32_t width;         // vectors per row, also the width of the visualization
+    uint32_t height;        // rows of vectors, also the height of the visualization
+    uint32_t gridsize;      // pixels per vector in each direction
+    uint32_t numslots;
+    uint64_t flowbytes;     // width * height NV_OF_FLOW_VECTOR
+    uint64_t visualbytes;   // width * height BGR24 pixels, 0 if only the flow is published
+    uint64_t slotbytes;     // distance between two slots, whole pages
+    uint64_t published;     // frames published so far
+    uint32_t wakeup;        // futex word bumped on every publish and on close
+    uint32_t closed;        // set once the publisher is gone
+};
+
+// Start of every slot, the flow follows at FLOW_SHM_ALIGNMENT and the visualization after it.
+// seq is a seqlock: 2 * frame + 1 while the frame is written, 2 * frame + 2 once it is complete.
+struct FlowShmSlot {
+    uint64_t seq;
+    uint64_t frame;
+};
+
+// Publishes flow grids, and optionally their BGR visualization, into a POSIX shared memory ring
+// that any number of local processes can map read-only. The publisher never waits for readers:
+// frame n goes to slot n % numslots, and a reader that falls behind sees the slot sequence move
+// past its frame instead of holding the producer back. An object already under the name is unlinked,
+// not reused, so a second publisher never pulls the ring from under the first one and its readers.
+class FlowShmPublisher {
+public:
+    FlowShmPublisher(const std::string& name, uint32_t width, uint32_t height, uint32_t gridsize, bool visual,
+                     uint32_t numslots = FLOW_SHM_SLOTS);
+    ~FlowShmPublisher();
+
+    // Copies one frame into the ring and wakes waiting readers, visual is ignored without a visualization
+    void publish(const NV_OF_FLOW_VECTOR* flowdata, const uint8_t* visual);
+
+    bool hasVisual() { return m_header->visualbytes != 0; }
+
+private:
+    std::string m_name;
+    FlowShmHeader* m_header;
+    uint8_t* m_memory;
+    size_t m_size;
+    // Identity of the object, the name is only unlinked on close while it still refers to it
+    uint64_t m_device;
+    uint64_t m_inode;
+};
+
+enum FlowShmStatus {
+    FLOW_SHM_READY,     // the frame is in its slot
+    FLOW_SHM_PENDING,   // the frame is not published yet
+    FLOW_SHM_OVERRUN,   // the frame was already overwritten by a newer one
+};
+
+// Read-only view of a ring created by FlowShmPublisher. Frames are used in place: acquire() returns
+// pointers into the slot, and validate() afterwards tells whether the publisher overwrote the slot
+// while the reader was using it.
+class FlowShmReader {
+public:
+    explicit FlowShmReader(const std::string& name);
+    ~FlowShmReader();
+
+    FlowShmStatus acquire(uint64_t frame, const NV_OF_FLOW_VECTOR*& flowdata, const uint8_t*& visual);
+    bool validate(uint64_t frame);
+
+    // Blocks until frame is published, the publisher closes or timeoutms passes, returns whether it was published
+    bool wait(uint64_t frame, int timeoutms);
+
+    uint64_t getPublished() { return __atomic_load_n(&m_header->published, __ATOMIC_ACQUIRE); }
+    bool isClosed() { return __atomic_load_n(&m_header->closed, __ATOMIC_ACQUIRE) != 0; }
+    uint32_t getNumSlots() { return m_header->numslots; }
+    uint32_t getWidth() { return m_header->width; }
+    uint32_t getHeight() { return m_header->height; }
+    uint32_t getGridSize() { return m_header->gridsize; }
+    bool hasVisual() { return m_header->visualbytes != 0; }
+
+private:
+    const FlowShmSlot* slot(uint64_t frame);
+
+    const FlowShmHeader* m_header;
+    const uint8_t* m_memory;
+    size_t m_size;
+};
@@ -6,7 +6,7 @@
 
 
 // Constructor for loading the library
-API::API(CUcontext context, CUstream input, CUstream output ) : ctx(context), inputFrame(input), outputFrame(output) {
+API::API(CUcontext context, CUstream input, CUstream output ) : libHandle(nullptr), ctx(context), inputFrame(input), outputFrame(output), handle(nullptr) {
     // Load the library
     try
     {
@@ -40,7 +40,8 @@ API::API(CUcontext context, CUstream input, CUstream output ) : ctx(context), in
 }
 
 CUstream API::getCudaStream(NV_OF_BUFFER_USAGE use) {
-    if (use == NV_OF_BUFFER_USAGE_INPUT)
+    // Hints are uploaded like the frames, so the execute waits for them on the same stream
+    if (use == NV_OF_BUFFER_USAGE_INPUT || use == NV_OF_BUFFER_USAGE_HINT)
         return inputFrame;
     else
         return outputFrame;
@@ -62,14 +63,15 @@ void NvOFCudaBuffer::UploadData(const void* data) {
 
     if (getBufferFormat() == NV_OF_BUFFER_FORMAT_NV12)
     {
+        // the interleaved chroma plane follows the luma plane in host memory
+        cuCopy2d.srcHost  = ((const uint8_t *)data + (cuCopy2d.srcPitch * getHeight()));
         cuCopy2d.Height   = (getHeight() + 1)/2;
-        cuCopy2d.srcHost  = ((const uint8_t *)data + (cuCopy2d.srcPitch * cuCopy2d.Height));
         cuCopy2d.dstY     = m_strideInfo.strideInfo[0].strideYInBytes;
         CUDA_DRVAPI_CALL(cuMemcpy2DAsync(&cuCopy2d, stream));
     }
 }
 
-void NvOFCudaBuffer::DownloadData(void* data) {
+void NvOFCudaBuffer::DownloadData(void* data, bool sync) {
     CUstream stream = apihandler->getCudaStream(getBufferUsage());
     CUDA_MEMCPY2D cuCopy2d;
     memset(&cuCopy2d, 0, sizeof(cuCopy2d));
@@ -80,16 +82,17 @@ void NvOFCudaBuffer::DownloadData(void* data) {
     cuCopy2d.srcMemoryType = CU_MEMORYTYPE_DEVICE;
     cuCopy2d.srcDevice = this->getCudaDevicePtr();
     cuCopy2d.srcPitch = m_strideInfo.strideInfo[0].strideXInBytes;
-    cuCopy2d.Height = getBufferFormat() == NV_OF_BUFFER_FORMAT_NV12 ? (getHeight() + getHeight() /2) : getHeight();
+    cuCopy2d.Height = getHeight();
     CUDA_DRVAPI_CALL(cuMemcpy2DAsync(&cuCopy2d, stream));
     if (getBufferFormat() == NV_OF_BUFFER_FORMAT_NV12)
     {
+        cuCopy2d.dstHost = ((uint8_t *)data + (cuCopy2d.dstPitch * getHeight()));
         cuCopy2d.Height = (getHeight() + 1) / 2;
-        cuCopy2d.dstHost = ((uint8_t *)data + (cuCopy2d.dstPitch * cuCopy2d.Height));
         cuCopy2d.srcY = m_strideInfo.strideInfo[0].strideYInBytes;
         CUDA_DRVAPI_CALL(cuMemcpy2DAsync(&cuCopy2d, stream));
     }
-    CUDA_DRVAPI_CALL(cuStreamSynchronize(stream));
+    if (sync)
+        CUDA_DRVAPI_CALL(cuStreamSynchronize(stream));
 }
 
 // Destructor for unloading the library
@@ -5,11 +5,6 @@
 #include <sstream>
 #include <string.h>
 
-#define H_BUFF 1080
-#define W_BUFF 1920
-
-extern uint8_t gridsize;
-
 class NvOFException : public std::exception
 {
 public:
@@ -98,7 +93,8 @@ public:
 
     void UploadData(const void* pData);
 
-    void DownloadData(void* pData);
+    // Without sync the copy is only queued on the buffer's stream, so several downloads can share one synchronization
+    void DownloadData(void* pData, bool sync = true);
 
     void* getAPIResourceHandle() { return m_hGPUBuffer; }
     NvOFGPUBufferHandle getOFBufferHandle() { return m_hGPUBuffer; }
@@ -134,6 +130,14 @@ public:
         {
             m_elementSize = 1;
         }
+        else if (m_eBufFmt == NV_OF_BUFFER_FORMAT_GRAYSCALE8)
+        {
+            m_elementSize = 1;
+        }
+        else if (m_eBufFmt == NV_OF_BUFFER_FORMAT_UINT8)
+        {
+            m_elementSize = 1;
+        }
     }
 
     ~NvOFCudaBuffer() {
@@ -0,0 +1,177 @@
+#include "flowwriter.h"
+#include <ctype.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLOW_WRITER_MAX_DIGITS 20       // widest zero padding of a frame number, a uint64_t has 20 digits
+
+// Function to split a path around its first %d or %0Nd conversion, returns false if there is none
+static bool splitFramePattern(const std::string& path, std::string& prefix, std::string& suffix, uint32_t& digits) {
+    for (size_t pos = path.find('%'); pos != std::string::npos; pos = path.find('%', pos + 1)) {
+        size_t end = pos + 1;
+        digits = 0;
+        if (end < path.size() && path[end] == '0') {
+            ++end;
+            size_t first = end;
+            while (end < path.size() && isdigit((unsigned char)path[end]) && end - first < 2)
+                ++end;
+            if (end == first)
+                continue;
+            digits = (uint32_t)atoi(path.substr(first, end - first).c_str());
+        }
+        if (end < path.size() && path[end] == 'd' && digits <= FLOW_WRITER_MAX_DIGITS) {
+            prefix = path.substr(0, pos);
+            suffix = path.substr(end + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+FlowWriter::FlowWriter(const std::string& path, FlowFileFormat format, uint32_t width, uint32_t height, uint32_t gridsize)
+    : m_path(path), m_digits(0), m_format(format), m_width(width), m_height(height), m_gridsize(gridsize),
+      m_perframe(format != FLOW_FILE_ARCHIVE && splitFramePattern(path, m_prefix, m_suffix, m_digits)), m_file(nullptr),
+      m_buffers(FLOW_WRITER_BUFFERS, std::vector<NV_OF_FLOW_VECTOR>((size_t)width * height)),
+      m_free(FLOW_WRITER_BUFFERS), m_ready(FLOW_WRITER_BUFFERS), m_closed(false) {
+    if (m_format == FLOW_FILE_FLO)
+        m_converted.resize((size_t)width * height * 2);
+    if (m_format == FLOW_FILE_COMPRESSED) {
+        m_codecpool.reset(new ThreadPool(FLOW_WRITER_CODEC_THREADS));
+        m_encoder.reset(new FlowEncoder(width, height, m_codecpool.get()));
+    }
+    if (m_format == FLOW_FILE_ARCHIVE)
+        m_archive.reset(new FlowArchiveWriter(path, width, height, gridsize));
+    else if (!m_perframe)
+        m_file = openFile(0);
+    for (uint32_t i = 0; i < FLOW_WRITER_BUFFERS; ++i)
+        m_free.push(i);
+    m_thread = std::thread(&FlowWriter::writerLoop, this);
+}
+
+FlowWriter::~FlowWriter() {
+    try
+    {
+        close();
+    }
+    catch(const std::exception&)
+    {
+    }
+}
+
+FILE* FlowWriter::openFile(uint64_t frame) {
+    std::string name = m_path;
+    if (m_perframe) {
+        std::string number = std::to_string(frame);
+        if (number.size() < m_digits)
+            number.insert(0, m_digits - number.size(), '0');
+        name = m_prefix + number + m_suffix;
+    }
+    FILE* file = fopen(name.c_str(), "wb");
+    if (!file)
+        throw std::runtime_error("Failed to open " + name);
+    setvbuf(file, nullptr, _IOFBF, FLOW_WRITER_IO_BUFFER);
+    return file;
+}
+
+void FlowWriter::write(const NV_OF_FLOW_VECTOR* flowdata) {
+    uint32_t index;
+    if (!m_free.pop(index)) {
+        // The writer thread only gives up on failure
+        close();
+        return;
+    }
+    memcpy(m_buffers[index].data(), flowdata, m_buffers[index].size() * sizeof(NV_OF_FLOW_VECTOR));
+    m_ready.push(index);
+}
+
+void FlowWriter::close() {
+    if (!m_closed) {
+        m_closed = true;
+        m_ready.close();
+        m_thread.join();
+        if (m_file)
+            fclose(m_file);
+        m_file = nullptr;
+        m_archive.reset();
+    }
+    if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void FlowWriter::writerLoop() {
+    try
+    {
+        uint32_t index;
+        uint64_t frame = 0;
+        while (m_ready.pop(index)) {
+            if (m_perframe) {
+                FILE* file = openFile(frame);
+                writeFrame(file, m_buffers[index].data(), frame);
+                if (fclose(file) != 0)
+                    throw std::runtime_error("Failed to write flow frame " + std::to_string(frame));
+            }
+            else if (m_archive)
+                m_archive->append(m_buffers[index].data());
+            else
+                writeFrame(m_file, m_buffers[index].data(), frame);
+            m_free.push(index);
+            ++frame;
+        }
+        if (m_file && fflush(m_file) != 0)
+            throw std::runtime_error("Failed to write " + m_path);
+    }
+    catch(...)
+    {
+        m_error = std::current_exception();
+    }
+    m_free.close();
+}
+
+void FlowWriter::writeFrame(FILE* file, const NV_OF_FLOW_VECTOR* flowdata, uint64_t frame) {
+    const size_t count = (size_t)m_width * m_height;
+    bool ok;
+    if (m_format == FLOW_FILE_FLO) {
+        // "PIEH" tag, width and height, then u and v of every vector in pixels
+        float magic = FLO_MAGIC;
+        int32_t size[2] = { (int32_t)m_width, (int32_t)m_height };
+        for (size_t n = 0; n < count; ++n) {
+            m_converted[2 * n] = flowdata[n].flowx / 32.0f;
+            m_converted[2 * n + 1] = flowdata[n].flowy / 32.0f;
+        }
+        ok = fwrite(&magic, sizeof(magic), 1, file) == 1 && fwrite(size, sizeof(size), 1, file) == 1 &&
+             fwrite(m_converted.data(), sizeof(float), 2 * count, file) == 2 * count;
+    }
+    else if (m_format == FLOW_FILE_COMPRESSED) {
+        // Every file of a per frame pattern has to decode on its own
+        bool keyframe = m_perframe || frame % FLOW_WRITER_KEYFRAME_INTERVAL == 0;
+        size_t size = m_encoder->encode(flowdata, m_packet, keyframe);
+        ok = fwrite(m_packet.data(), 1, size, file) == size;
+    }
+    else {
+        FlowFrameHeader header;
+        memcpy(header.magic, "NVFL", 4);
+        header.width = m_width;
+        header.height = m_height;
+        header.gridsize = m_gridsize;
+        header.frame = frame;
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(flowdata, sizeof(NV_OF_FLOW_VECTOR), count, file) == count;
+    }
+    if (!ok)
+        throw std::runtime_error("Failed to write flow frame " + std::to_string(frame));
+}
+
+// Function to pick the flow file format from the extension
+FlowFileFormat flowFileFormat(const std::string& path) {
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".flo") == 0)
+        return FLOW_FILE_FLO;
+    if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".nvfa") == 0)
+        return FLOW_FILE_ARCHIVE;
+    if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".nvfc") == 0)
+        return FLOW_FILE_COMPRESSED;
+    return FLOW_FILE_RAW;
+}
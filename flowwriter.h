@@ -0,0 +1,86 @@
+#pragma once
+#include "flowarchive.h"
+#include "flowcodec.h"
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+#include "pipeline.h"
+#include "threadpool.h"
+#include <exception>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FLOW_WRITER_BUFFERS 8           // flow frames that may wait for the disk
+#define FLOW_WRITER_IO_BUFFER (1 << 20) // stdio buffer of the output file
+#define FLO_MAGIC 202021.25f            // tag at the start of every Middlebury .flo frame
+#define FLOW_WRITER_KEYFRAME_INTERVAL 300 // compressed frames between keyframes
+#define FLOW_WRITER_CODEC_THREADS 4     // threads compressing one frame
+
+// Header written in front of every frame of a raw flow file, followed by width * height
+// NV_OF_FLOW_VECTOR in S10.5 format
+struct FlowFrameHeader {
+    char magic[4];      // "NVFL"
+    uint32_t width;     // vectors per row
+    uint32_t height;    // rows of vectors
+    uint32_t gridsize;  // pixels per vector in each direction
+    uint64_t frame;     // index of the flow frame in the stream
+};
+
+enum FlowFileFormat {
+    FLOW_FILE_RAW,  // FlowFrameHeader and the S10.5 grid per frame
+    FLOW_FILE_FLO,  // Middlebury .flo, float vectors in pixels
+    FLOW_FILE_ARCHIVE, // indexed flow archive, see FlowArchiveWriter
+    FLOW_FILE_COMPRESSED, // FlowEncoder packets, each one starting with a FlowPacketHeader
+};
+
+// Streams flow frames to disk on a background thread. write() copies the grid into one of a few
+// preallocated buffers and returns, the thread converts and writes them through a large stdio
+// buffer, so disk I/O never runs on the caller's thread unless the disk falls behind by more than
+// FLOW_WRITER_BUFFERS frames.
+// A path containing a frame number conversion, %d or %0Nd as in flow_%06d.flo, gets one file per frame,
+// otherwise all frames are appended to one file. Only the first such conversion is replaced, every other
+// character of the path is taken literally, % included. An archive is always a single file.
+class FlowWriter {
+public:
+    FlowWriter(const std::string& path, FlowFileFormat format, uint32_t width, uint32_t height, uint32_t gridsize);
+    ~FlowWriter();
+
+    // Queues one flow frame, rethrows a failure of the writer thread
+    void write(const NV_OF_FLOW_VECTOR* flowdata);
+
+    // Writes out everything queued and closes the file, rethrows a failure of the writer thread
+    void close();
+
+private:
+    void writerLoop();
+    void writeFrame(FILE* file, const NV_OF_FLOW_VECTOR* flowdata, uint64_t frame);
+    FILE* openFile(uint64_t frame);
+
+    std::string m_path;
+    // The path split around the frame number of per frame files, padded with zeros to m_digits
+    std::string m_prefix;
+    std::string m_suffix;
+    uint32_t m_digits;
+    FlowFileFormat m_format;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_gridsize;
+    bool m_perframe;
+    FILE* m_file;
+    std::unique_ptr<FlowArchiveWriter> m_archive;
+    std::vector<std::vector<NV_OF_FLOW_VECTOR> > m_buffers;
+    std::vector<float> m_converted;
+    std::unique_ptr<ThreadPool> m_codecpool;
+    std::unique_ptr<FlowEncoder> m_encoder;
+    std::vector<uint8_t> m_packet;
+    BoundedQueue<uint32_t> m_free;
+    BoundedQueue<uint32_t> m_ready;
+    std::thread m_thread;
+    std::exception_ptr m_error;
+    bool m_closed;
+};
+
+// Function to pick the flow file format from the extension, .flo for Middlebury, .nvfa for an archive,
+// .nvfc for compressed and raw otherwise
+FlowFileFormat flowFileFormat(const std::string& path);
@@ -0,0 +1,67 @@
+#include "frameskip.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
+// Sum of absolute differences of two byte rows. Only the bytes set in the repeating four byte mask count,
+// so the alpha of ABGR pixels can be left out.
+static uint64_t rowSad(const uint8_t* a, const uint8_t* b, size_t count, uint32_t mask) {
+    uint64_t sad = 0;
+    size_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    const __m128i bytes = _mm_set1_epi32((int)mask);
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_and_si128(_mm_loadu_si128((const __m128i*)(a + i)), bytes);
+        __m128i vb = _mm_and_si128(_mm_loadu_si128((const __m128i*)(b + i)), bytes);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    sad = (uint64_t)_mm_cvtsi128_si64(acc) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+#endif
+    for (; i < count; ++i) {
+        if ((mask >> (8 * (i % 4))) & 0xff)
+            sad += (uint64_t)abs(a[i] - b[i]);
+    }
+    return sad;
+}
+
+FrameSkipper::FrameSkipper(NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height, float threshold, uint32_t stride)
+    : m_threshold(threshold), m_stride(stride ? stride : 1), m_haveReference(false), m_pairs(0), m_static(0), m_strided(0) {
+    // Raw bytes are compared, for ABGR the three color channels but not the alpha in the lowest byte of every
+    // pixel, for NV12 and gray the luma plane. The threshold is per compared byte in every format.
+    const bool abgr = format == NV_OF_BUFFER_FORMAT_ABGR8;
+    m_rowbytes = abgr ? (size_t)width * 4 : width;
+    m_mask = abgr ? 0xffffff00u : 0xffffffffu;
+    m_rows = (height + SKIP_ROW_STEP - 1) / SKIP_ROW_STEP;
+    m_signature.resize(m_rowbytes * m_rows);
+    m_samples = (size_t)m_rows * width * (abgr ? 3 : 1);
+}
+
+FrameAction FrameSkipper::classify(const uint8_t* frame) {
+    if (m_threshold > 0 && m_haveReference) {
+        uint64_t sad = 0;
+        for (uint32_t r = 0; r < m_rows; ++r)
+            sad += rowSad(frame + (size_t)r * SKIP_ROW_STEP * m_rowbytes, m_signature.data() + r * m_rowbytes, m_rowbytes, m_mask);
+        if (sad < m_threshold * m_samples) {
+            ++m_static;
+            return FRAME_STATIC;
+        }
+    }
+
+    // The frame goes to the backend and becomes the new reference
+    if (m_threshold > 0) {
+        for (uint32_t r = 0; r < m_rows; ++r)
+            memcpy(m_signature.data() + r * m_rowbytes, frame + (size_t)r * SKIP_ROW_STEP * m_rowbytes, m_rowbytes);
+    }
+    if (!m_haveReference) {
+        m_haveReference = true;
+        return FRAME_COMPUTE;
+    }
+    if (m_pairs++ % m_stride != 0) {
+        ++m_strided;
+        return FRAME_ADVANCE;
+    }
+    return FRAME_COMPUTE;
+}
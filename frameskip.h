@@ -0,0 +1,45 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+#include <stddef.h>
+#include <vector>
+
+#define SKIP_ROW_STEP 8     // every SKIP_ROW_STEP-th row of the first plane goes into the change check
+
+// What the flow stage does with a frame
+enum FrameAction {
+    FRAME_COMPUTE,  // hand it to the backend and compute the flow
+    FRAME_ADVANCE,  // hand it to the backend without computing, the last flow is repeated
+    FRAME_STATIC,   // leave the backend alone and emit zero flow, nothing moved
+};
+
+// Decides per frame whether the flow engine has to run, for mostly static content.
+// A frame is static when the mean absolute difference of a row subsample against the last frame
+// given to the backend stays below the threshold; the backend keeps its reference so slow drift
+// still adds up. In stride mode only every stride-th pair is computed, the frames in between are
+// still handed over so every computed pair spans neighbouring frames.
+class FrameSkipper {
+public:
+    // threshold is in 8 bit levels per sampled color or luma byte, the same in every format (0 turns the check off),
+    // stride 1 computes every pair
+    FrameSkipper(NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height, float threshold, uint32_t stride);
+
+    FrameAction classify(const uint8_t* frame);
+
+    uint64_t getStaticFrames() { return m_static; }
+    uint64_t getStridedFrames() { return m_strided; }
+
+private:
+    float m_threshold;
+    uint32_t m_stride;
+    size_t m_rowbytes;
+    uint32_t m_rows;
+    // Bytes of every four that are compared, and how many are compared per frame
+    uint32_t m_mask;
+    size_t m_samples;
+    // Sampled rows of the last frame handed to the backend
+    std::vector<uint8_t> m_signature;
+    bool m_haveReference;
+    uint64_t m_pairs;
+    uint64_t m_static;
+    uint64_t m_strided;
+};
@@ -0,0 +1,376 @@
+#include "framesource.h"
+#include "imgproc.h"
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Function to read the resolution of the first video stream with ffprobe
+static void probeResolution(const std::string& path, uint32_t& width, uint32_t& height) {
+    std::string command = "ffprobe -v error -select_streams v:0 -show_entries stream=width,height -of csv=p=0:s=x \"" + path + "\"";
+    FILE* probe = popen(command.c_str(), "r");
+    if (!probe) {
+        throw std::runtime_error("Failed to run ffprobe");
+    }
+    unsigned int w = 0, h = 0;
+    int fields = fscanf(probe, "%ux%u", &w, &h);
+    pclose(probe);
+    if (fields != 2 || w == 0 || h == 0)
+        throw std::runtime_error("Failed to probe the resolution of " + path);
+    width = w;
+    height = h;
+}
+
+PipeFrameSource::PipeFrameSource(const std::string& path, NV_OF_BUFFER_FORMAT format)
+    : m_width(0), m_height(0), m_bufferformat(format), m_pipe(nullptr), m_fd(-1), m_framesize(0) {
+    probeResolution(path, m_width, m_height);
+    m_framesize = frameSize(format, m_width, m_height);
+
+    std::string ffmpeg_path = "ffmpeg";
+    std::string pixfmt = format == NV_OF_BUFFER_FORMAT_NV12 ? "nv12" :
+                         format == NV_OF_BUFFER_FORMAT_GRAYSCALE8 ? "gray" : "abgr";
+
+    // command to run ffmpeg
+    std::string command = ffmpeg_path + " -i " + "\"" + path + "\"" + " -f image2pipe -pix_fmt " + pixfmt + " -vcodec rawvideo -";
+    m_pipe = popen(command.c_str(), "r");
+    if (!m_pipe) {
+        throw std::runtime_error("Failed to open pipe");
+    }
+    m_fd = fileno(m_pipe);
+#ifdef F_SETPIPE_SZ
+    // Best effort, the kernel caps it at /proc/sys/fs/pipe-max-size
+    fcntl(m_fd, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+#endif
+}
+
+PipeFrameSource::~PipeFrameSource() {
+    pclose(m_pipe);
+}
+
+// Reads bypass stdio and go straight into the frame, each one as large as the pipe hands out
+bool PipeFrameSource::read(uint8_t* frame) {
+    size_t done = 0;
+    while (done < m_framesize) {
+        ssize_t got = ::read(m_fd, frame + done, m_framesize - done);
+        if (got > 0)
+            done += got;
+        else if (got < 0 && errno == EINTR)
+            continue;
+        else
+            return false;
+    }
+    return true;
+}
+
+#ifdef HAVE_LIBAV
+LibavFrameSource::LibavFrameSource(const std::string& path, NV_OF_BUFFER_FORMAT format)
+    : m_width(0), m_height(0), m_bufferformat(format),
+      m_pixfmt(format == NV_OF_BUFFER_FORMAT_NV12 ? AV_PIX_FMT_NV12 :
+               format == NV_OF_BUFFER_FORMAT_GRAYSCALE8 ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_ABGR), m_format(nullptr), m_codec(nullptr), m_packet(nullptr), m_decoded(nullptr),
+      m_scaler(nullptr), m_stream(-1), m_flushed(false) {
+    if (avformat_open_input(&m_format, path.c_str(), nullptr, nullptr) < 0)
+        throw std::runtime_error("Failed to open " + path);
+    try
+    {
+        if (avformat_find_stream_info(m_format, nullptr) < 0)
+            throw std::runtime_error("Failed to read the stream info of " + path);
+        m_stream = av_find_best_stream(m_format, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (m_stream < 0)
+            throw std::runtime_error("No video stream in " + path);
+
+        AVCodecParameters* codecpar = m_format->streams[m_stream]->codecpar;
+        const AVCodec* decoder = avcodec_find_decoder(codecpar->codec_id);
+        if (!decoder)
+            throw std::runtime_error("No decoder for the video stream of " + path);
+        m_codec = avcodec_alloc_context3(decoder);
+        if (!m_codec || avcodec_parameters_to_context(m_codec, codecpar) < 0)
+            throw std::runtime_error("Failed to set up the decoder");
+        // Let the decoder use as many threads as it likes, it runs on the reader stage anyway
+        m_codec->thread_count = 0;
+        if (avcodec_open2(m_codec, decoder, nullptr) < 0)
+            throw std::runtime_error("Failed to open the decoder");
+        if (m_codec->width <= 0 || m_codec->height <= 0)
+            throw std::runtime_error("Unknown resolution of " + path);
+        m_width = m_codec->width;
+        m_height = m_codec->height;
+
+        m_packet = av_packet_alloc();
+        m_decoded = av_frame_alloc();
+        if (!m_packet || !m_decoded)
+            throw std::runtime_error("Failed to allocate the decoder buffers");
+    }
+    catch(...)
+    {
+        av_frame_free(&m_decoded);
+        av_packet_free(&m_packet);
+        avcodec_free_context(&m_codec);
+        avformat_close_input(&m_format);
+        throw;
+    }
+}
+
+LibavFrameSource::~LibavFrameSource() {
+    sws_freeContext(m_scaler);
+    av_frame_free(&m_decoded);
+    av_packet_free(&m_packet);
+    avcodec_free_context(&m_codec);
+    avformat_close_input(&m_format);
+}
+
+bool LibavFrameSource::read(uint8_t* frame) {
+    while (true) {
+        int ret = avcodec_receive_frame(m_codec, m_decoded);
+        if (ret == 0) {
+            // The scaler is only rebuilt if the decoded size or format changes mid stream
+            m_scaler = sws_getCachedContext(m_scaler, m_decoded->width, m_decoded->height, (AVPixelFormat)m_decoded->format,
+                                            m_width, m_height, m_pixfmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
+            if (!m_scaler)
+                throw std::runtime_error("Failed to set up the frame conversion");
+            // Packed ABGR is one plane, NV12 has its interleaved chroma right after the luma
+            uint8_t* planes[4] = { frame, nullptr, nullptr, nullptr };
+            int strides[4] = { (int)m_width, 0, 0, 0 };
+            if (m_pixfmt == AV_PIX_FMT_ABGR)
+                strides[0] = (int)m_width * 4;
+            else if (m_pixfmt == AV_PIX_FMT_NV12) {
+                planes[1] = frame + (size_t)m_width * m_height;
+                strides[1] = (int)m_width;
+            }
+            sws_scale(m_scaler, m_decoded->data, m_decoded->linesize, 0, m_decoded->height, planes, strides);
+            av_frame_unref(m_decoded);
+            return true;
+        }
+        if (ret == AVERROR_EOF)
+            return false;
+        if (ret != AVERROR(EAGAIN))
+            throw std::runtime_error("Failed to decode a frame");
+
+        // The decoder wants more input, at the end of the file it gets drained instead
+        if (m_flushed)
+            return false;
+        if (av_read_frame(m_format, m_packet) < 0) {
+            avcodec_send_packet(m_codec, nullptr);
+            m_flushed = true;
+            continue;
+        }
+        if (m_packet->stream_index == m_stream)
+            ret = avcodec_send_packet(m_codec, m_packet);
+        av_packet_unref(m_packet);
+        if (ret < 0 && ret != AVERROR(EAGAIN))
+            throw std::runtime_error("Failed to send a packet to the decoder");
+    }
+}
+#endif
+
+// Returns the lower case extension of path, without the dot
+static std::string fileExtension(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+        return "";
+    std::string ext = path.substr(dot + 1);
+    for (size_t i = 0; i < ext.size(); ++i)
+        ext[i] = (char)tolower((unsigned char)ext[i]);
+    return ext;
+}
+
+// Function to check whether a file holds raw frames for MappedFrameSource
+bool isRawVideoFile(const std::string& path) {
+    std::string ext = fileExtension(path);
+    return ext == "abgr" || ext == "rgba" || ext == "nv12" || ext == "gray" || ext == "y4m";
+}
+
+MappedFrameSource::MappedFrameSource(const std::string& path, uint32_t width, uint32_t height)
+    : m_width(width), m_height(height), m_bufferformat(NV_OF_BUFFER_FORMAT_ABGR8), m_data(nullptr), m_size(0),
+      m_offset(0), m_framesize(0), m_filesize(0), m_y4m(false), m_swizzle(false) {
+    std::string ext = fileExtension(path);
+    if (ext == "nv12")
+        m_bufferformat = NV_OF_BUFFER_FORMAT_NV12;
+    else if (ext == "gray" || ext == "y4m")
+        m_bufferformat = NV_OF_BUFFER_FORMAT_GRAYSCALE8;
+    else if (ext != "abgr" && ext != "rgba")
+        throw std::runtime_error("Unknown raw video file type " + path);
+    m_y4m = ext == "y4m";
+    m_swizzle = ext == "rgba";
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open " + path);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Failed to read the size of " + path);
+    }
+    m_size = (size_t)info.st_size;
+    void* mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file referenced on its own
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Failed to map " + path);
+    m_data = (const uint8_t*)mapping;
+    madvise(mapping, m_size, MADV_SEQUENTIAL);
+
+    if (m_y4m)
+        parseY4MHeader();
+    if (m_width == 0 || m_height == 0) {
+        munmap((void*)m_data, m_size);
+        throw std::runtime_error("The resolution of " + path + " has to be given");
+    }
+    m_framesize = frameSize(m_bufferformat, m_width, m_height);
+    if (!m_y4m)
+        m_filesize = m_framesize;
+}
+
+MappedFrameSource::~MappedFrameSource() {
+    munmap((void*)m_data, m_size);
+}
+
+// Reads "YUV4MPEG2 W<width> H<height> ... C<colorspace>\n" and works out how large a frame is in the file
+void MappedFrameSource::parseY4MHeader() {
+    const char* begin = (const char*)m_data;
+    const char* end = (const char*)memchr(begin, '\n', m_size);
+    if (m_size < 9 || memcmp(begin, "YUV4MPEG2", 9) != 0 || !end) {
+        munmap((void*)m_data, m_size);
+        throw std::runtime_error("Not a y4m file");
+    }
+    std::string header(begin, end);
+    std::string colorspace = "420";
+    size_t pos = 0;
+    while ((pos = header.find(' ', pos)) != std::string::npos) {
+        ++pos;
+        if (pos >= header.size())
+            break;
+        if (header[pos] == 'W')
+            m_width = (uint32_t)strtoul(header.c_str() + pos + 1, nullptr, 10);
+        else if (header[pos] == 'H')
+            m_height = (uint32_t)strtoul(header.c_str() + pos + 1, nullptr, 10);
+        else if (header[pos] == 'C')
+            colorspace = header.substr(pos + 1, header.find(' ', pos) - pos - 1);
+    }
+
+    // Only the 8 bit colorspaces, the deeper ones (420p10, 444p16, mono16...) and 444alpha have other frame sizes
+    size_t luma = (size_t)m_width * m_height;
+    size_t chroma = (size_t)((m_width + 1) / 2) * ((m_height + 1) / 2);
+    if (colorspace == "mono")
+        chroma = 0;
+    else if (colorspace == "444")
+        chroma = luma;
+    else if (colorspace == "422")
+        chroma = (size_t)((m_width + 1) / 2) * m_height;
+    else if (colorspace != "420" && colorspace != "420jpeg" && colorspace != "420mpeg2" && colorspace != "420paldv") {
+        munmap((void*)m_data, m_size);
+        throw std::runtime_error("Unsupported y4m colorspace " + colorspace);
+    }
+    m_filesize = luma + 2 * chroma;
+    m_offset = end + 1 - begin;
+}
+
+const uint8_t* MappedFrameSource::next() {
+    size_t offset = m_offset;
+    // Every y4m frame starts with its own "FRAME ...\n" line
+    if (m_y4m) {
+        if (m_size - offset < 5 || memcmp(m_data + offset, "FRAME", 5) != 0)
+            return nullptr;
+        const uint8_t* end = (const uint8_t*)memchr(m_data + offset, '\n', m_size - offset);
+        if (!end)
+            return nullptr;
+        offset = end + 1 - m_data;
+    }
+    if (m_size - offset < m_filesize)
+        return nullptr;
+    m_offset = offset + m_filesize;
+
+    // Ask for the frames coming up so the page faults are taken by the kernel's read ahead
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t ahead = m_offset / page * page;
+    size_t length = std::min(m_size - ahead, (m_filesize + 64) * MAPPED_PREFETCH_FRAMES);
+    if (length > 0)
+        madvise((void*)(m_data + ahead), length, MADV_WILLNEED);
+    return m_data + offset;
+}
+
+bool MappedFrameSource::read(uint8_t* frame) {
+    const uint8_t* data = next();
+    if (!data)
+        return false;
+    if (m_swizzle)
+        swizzleRGBAtoABGR(data, frame, (size_t)m_width * m_height);
+    else
+        memcpy(frame, data, m_framesize);
+    return true;
+}
+
+ScaledFrameSource::ScaledFrameSource(FrameSource* source, uint32_t factor)
+    : m_source(source), m_format(source->getFormat()) {
+    const NV_OF_BUFFER_FORMAT format = m_format;
+    m_widths.push_back(source->getWidth());
+    m_heights.push_back(source->getHeight());
+    for (uint32_t f = factor; f > 1; f /= 2) {
+        uint32_t width, height;
+        halvedFrameSize(format, m_widths.back(), m_heights.back(), width, height);
+        m_widths.push_back(width);
+        m_heights.push_back(height);
+    }
+    if (!source->isMapped())
+        m_full.resize(frameSize(format, m_widths[0], m_heights[0]));
+    if (m_widths.size() > 2)
+        m_half.resize(frameSize(format, m_widths[1], m_heights[1]));
+}
+
+bool ScaledFrameSource::read(uint8_t* frame) {
+    // Mapped frames are filtered in place, the others are read into the full size buffer first
+    const uint8_t* src = m_full.data();
+    if (m_source->isMapped())
+        src = m_source->next();
+    else if (!m_source->read(m_full.data()))
+        src = nullptr;
+    if (!src)
+        return false;
+    // Every halving but the last goes through the intermediate buffer
+    for (size_t i = 1; i < m_widths.size(); ++i) {
+        uint8_t* dst = i + 1 == m_widths.size() ? frame : m_half.data();
+        halveFrame(src, dst, m_format, m_widths[i - 1], m_heights[i - 1]);
+        src = dst;
+    }
+    return true;
+}
+
+// Function to check whether this build can decode in process
+bool haveLibav() {
+#ifdef HAVE_LIBAV
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Function to create a frame source by name
+FrameSource* createFrameSource(const std::string& name, const std::string& path, NV_OF_BUFFER_FORMAT format,
+                               uint32_t downscale, uint32_t width, uint32_t height) {
+    if (downscale != 1 && downscale != 2 && downscale != 4)
+        throw std::runtime_error("Unsupported downscale factor " + std::to_string(downscale));
+
+    std::string kind = name;
+    if (kind == "auto")
+        kind = isRawVideoFile(path) ? "mmap" : haveLibav() ? "libav" : "pipe";
+
+    FrameSource* source = nullptr;
+#ifdef HAVE_LIBAV
+    if (kind == "libav")
+        source = new LibavFrameSource(path, format);
+#endif
+    if (kind == "pipe")
+        source = new PipeFrameSource(path, format);
+    if (kind == "mmap")
+        source = new MappedFrameSource(path, width, height);
+    if (!source)
+        throw std::runtime_error("Unknown frame source " + name);
+
+    if (downscale == 1)
+        return source;
+    return new ScaledFrameSource(source, downscale);
+}
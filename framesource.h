@@ -0,0 +1,154 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_LIBAV
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+// Source of decoded video frames, delivered tightly packed in an NVOF input format (ABGR8, NV12 or
+// GRAYSCALE8). The frame size and format are known once the source is created.
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    // Fills frame with the next frame of the video, returns false at the end of the stream
+    virtual bool read(uint8_t* frame) = 0;
+
+    // Sources whose frames already sit in memory hand them out in place instead: next() returns
+    // the next frame, valid for the lifetime of the source, or nullptr at the end of the stream
+    virtual bool isMapped() { return false; }
+    virtual const uint8_t* next() { return nullptr; }
+
+    virtual uint32_t getWidth() = 0;
+    virtual uint32_t getHeight() = 0;
+    virtual NV_OF_BUFFER_FORMAT getFormat() = 0;
+};
+
+#define PIPE_BUFFER_SIZE (1 << 20)  // requested capacity of the ffmpeg pipe, Linux defaults to 64 KB
+
+// Frames decoded by an ffmpeg process and read through a pipe, the resolution is probed with ffprobe
+class PipeFrameSource : public FrameSource {
+public:
+    PipeFrameSource(const std::string& path, NV_OF_BUFFER_FORMAT format);
+    ~PipeFrameSource();
+
+    bool read(uint8_t* frame);
+    uint32_t getWidth() { return m_width; }
+    uint32_t getHeight() { return m_height; }
+    NV_OF_BUFFER_FORMAT getFormat() { return m_bufferformat; }
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    NV_OF_BUFFER_FORMAT m_bufferformat;
+    FILE* m_pipe;
+    int m_fd;
+    size_t m_framesize;
+};
+
+#ifdef HAVE_LIBAV
+// Frames decoded in process with libavformat/libavcodec at the resolution of the video stream.
+// Each decoded picture is converted by libswscale straight into the caller's buffer, so there is
+// no pipe, no extra process and no intermediate copy.
+class LibavFrameSource : public FrameSource {
+public:
+    LibavFrameSource(const std::string& path, NV_OF_BUFFER_FORMAT format);
+    ~LibavFrameSource();
+
+    bool read(uint8_t* frame);
+    uint32_t getWidth() { return m_width; }
+    uint32_t getHeight() { return m_height; }
+    NV_OF_BUFFER_FORMAT getFormat() { return m_bufferformat; }
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    NV_OF_BUFFER_FORMAT m_bufferformat;
+    AVPixelFormat m_pixfmt;
+    AVFormatContext* m_format;
+    AVCodecContext* m_codec;
+    AVPacket* m_packet;
+    AVFrame* m_decoded;
+    SwsContext* m_scaler;
+    int m_stream;
+    bool m_flushed;
+};
+#endif
+
+#define MAPPED_PREFETCH_FRAMES 4  // frames a mapped source asks the kernel to read ahead
+
+// Raw frames stored on disk, mapped into memory and handed out in place, so there is no decode,
+// no pipe and no copy. Takes tightly packed .abgr/.rgba, .nv12 and .gray files, whose
+// resolution has to be given, and .y4m files, whose header is parsed. y4m frames are planar
+// YUV, so only their luma plane is used, as GRAYSCALE8. .rgba frames have their bytes in the
+// opposite order of ABGR8, so they are swizzled into the caller's buffer by read() instead.
+class MappedFrameSource : public FrameSource {
+public:
+    MappedFrameSource(const std::string& path, uint32_t width, uint32_t height);
+    ~MappedFrameSource();
+
+    bool read(uint8_t* frame);
+    bool isMapped() { return !m_swizzle; }
+    const uint8_t* next();
+    uint32_t getWidth() { return m_width; }
+    uint32_t getHeight() { return m_height; }
+    NV_OF_BUFFER_FORMAT getFormat() { return m_bufferformat; }
+
+private:
+    void parseY4MHeader();
+
+    uint32_t m_width;
+    uint32_t m_height;
+    NV_OF_BUFFER_FORMAT m_bufferformat;
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_offset;
+    // Bytes handed out per frame and bytes a frame takes in the file, they differ for y4m
+    size_t m_framesize;
+    size_t m_filesize;
+    bool m_y4m;
+    bool m_swizzle;
+};
+
+// Function to check whether a file holds raw frames for MappedFrameSource, judging by its extension
+bool isRawVideoFile(const std::string& path);
+
+// Frames of another source shrunk by 2 or 4 with SSE2 box filters before they are handed on
+// (see halveFrame). The full size frames land in a buffer owned by this source.
+class ScaledFrameSource : public FrameSource {
+public:
+    ScaledFrameSource(FrameSource* source, uint32_t factor);
+
+    bool read(uint8_t* frame);
+    uint32_t getWidth() { return m_widths.back(); }
+    uint32_t getHeight() { return m_heights.back(); }
+    NV_OF_BUFFER_FORMAT getFormat() { return m_format; }
+
+private:
+    std::unique_ptr<FrameSource> m_source;
+    NV_OF_BUFFER_FORMAT m_format;
+    // Size after every halving, the first entry is the size of the source
+    std::vector<uint32_t> m_widths;
+    std::vector<uint32_t> m_heights;
+    std::vector<uint8_t> m_full;
+    std::vector<uint8_t> m_half;
+};
+
+// Function to check whether this build can decode in process
+bool haveLibav();
+
+// Function to create a frame source by name: "libav" for the in-process decoder, "pipe" for the ffmpeg process,
+// "mmap" for raw frame files and "auto" to pick mmap for raw frame files and the best decoder otherwise.
+// Decoders deliver the requested format, raw files their own; width and height are only needed for raw files
+// without a header. A downscale factor of 2 or 4 puts a ScaledFrameSource on top.
+FrameSource* createFrameSource(const std::string& name, const std::string& path, NV_OF_BUFFER_FORMAT format,
+                               uint32_t downscale = 1, uint32_t width = 0, uint32_t height = 0);
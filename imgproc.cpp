@@ -0,0 +1,167 @@
+#include "imgproc.h"
+#include "threadpool.h"
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
+// Runs fn over all rows, on the pool if there is one
+static void forEachRow(uint32_t rows, ThreadPool* pool, const std::function<void(uint32_t, uint32_t)>& fn) {
+    if (pool)
+        pool->parallelFor(rows, fn);
+    else
+        fn(0, rows);
+}
+
+// Function to get the size in bytes of a tightly packed frame
+size_t frameSize(NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height) {
+    size_t plane = (size_t)width * height;
+    if (format == NV_OF_BUFFER_FORMAT_NV12)
+        return plane + (size_t)width * ((height + 1) / 2);
+    if (format == NV_OF_BUFFER_FORMAT_GRAYSCALE8)
+        return plane;
+    return plane * 4;
+}
+
+// Function to extract the luma plane of an input frame in any of the NVOF input formats
+void extractLuma(const uint8_t* frame, NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height,
+                 GrayImage& luma, ThreadPool* pool) {
+    luma.resize(width, height);
+
+    // NV12 and grayscale frames start with the luma plane
+    if (format != NV_OF_BUFFER_FORMAT_ABGR8) {
+        memcpy(luma.data.data(), frame, (size_t)width * height);
+        return;
+    }
+
+    forEachRow(height, pool, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            const uint8_t* src = frame + (size_t)y * width * 4;
+            uint8_t* dst = luma.row(y);
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                // bytes are A, B, G, R; BT.601 weights in 8 bit fixed point
+                uint32_t b = src[4 * x + 1], g = src[4 * x + 2], r = src[4 * x + 3];
+                dst[x] = (uint8_t)((77 * r + 150 * g + 29 * b + 128) >> 8);
+            }
+        }
+    });
+}
+
+// Function to halve an image with a 2x2 box filter
+#if defined(__x86_64__) || defined(__i386__)
+// 2x2 box filter of 16 bytes from two rows into 8 bytes, on elements of E bytes (1 for planar
+// pixels, 2 for NV12 chroma pairs, 4 for ABGR). Rows are summed in 16 bits, then each element is
+// added to its right neighbour and the low element of every pair is kept.
+template<int E>
+static inline __m128i halvePairSums(__m128i sums) {
+    if (E == 1)
+        return _mm_and_si128(_mm_add_epi16(sums, _mm_srli_epi32(sums, 16)), _mm_set1_epi32(0xffff));
+    if (E == 2)
+        return _mm_shuffle_epi32(_mm_add_epi16(sums, _mm_srli_epi64(sums, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_add_epi16(sums, _mm_srli_si128(sums, 8));
+}
+
+template<int E>
+static inline __m128i halve16(__m128i r0, __m128i r1) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = halvePairSums<E>(_mm_add_epi16(_mm_unpacklo_epi8(r0, zero), _mm_unpacklo_epi8(r1, zero)));
+    __m128i hi = halvePairSums<E>(_mm_add_epi16(_mm_unpackhi_epi8(r0, zero), _mm_unpackhi_epi8(r1, zero)));
+    // Sums are at most 1020, so the signed 32 bit pack is safe
+    __m128i words = E == 1 ? _mm_packs_epi32(lo, hi) : _mm_unpacklo_epi64(lo, hi);
+    words = _mm_srli_epi16(_mm_add_epi16(words, _mm_set1_epi16(2)), 2);
+    return _mm_packus_epi16(words, words);
+}
+#endif
+
+// Halves a plane of outwidth x outheight elements of E bytes with a 2x2 box filter
+template<int E>
+static void halvePlane(const uint8_t* src, size_t srcpitch, uint8_t* dst, size_t dstpitch,
+                       uint32_t outwidth, uint32_t outheight, ThreadPool* pool) {
+    const uint32_t rowbytes = outwidth * E;
+    forEachRow(outheight, pool, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            const uint8_t* r0 = src + 2 * y * srcpitch;
+            const uint8_t* r1 = r0 + srcpitch;
+            uint8_t* out = dst + y * dstpitch;
+            uint32_t x = 0;
+#if defined(__x86_64__) || defined(__i386__)
+            for (; x + 8 <= rowbytes; x += 8)
+            {
+                __m128i v0 = _mm_loadu_si128((const __m128i*)(r0 + 2 * x));
+                __m128i v1 = _mm_loadu_si128((const __m128i*)(r1 + 2 * x));
+                _mm_storel_epi64((__m128i*)(out + x), halve16<E>(v0, v1));
+            }
+#endif
+            for (; x < rowbytes; ++x)
+            {
+                uint32_t i = (x / E) * 2 * E + x % E;
+                out[x] = (uint8_t)((r0[i] + r0[i + E] + r1[i] + r1[i + E] + 2) >> 2);
+            }
+        }
+    });
+}
+
+void downsample2x(const GrayImage& src, GrayImage& dst, ThreadPool* pool) {
+    dst.resize(src.width / 2, src.height / 2);
+    halvePlane<1>(src.data.data(), src.width, dst.data.data(), dst.width, dst.width, dst.height, pool);
+}
+
+// Function to get the size of a frame halved by halveFrame
+void halvedFrameSize(NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height, uint32_t& outwidth, uint32_t& outheight) {
+    outwidth = width / 2;
+    outheight = height / 2;
+    // NV12 chroma is subsampled 2x2, keep whole chroma samples
+    if (format == NV_OF_BUFFER_FORMAT_NV12) {
+        outwidth &= ~1u;
+        outheight &= ~1u;
+    }
+}
+
+// Function to halve a tightly packed frame in any of the NVOF input formats with a 2x2 box filter
+void halveFrame(const uint8_t* src, uint8_t* dst, NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height,
+                ThreadPool* pool) {
+    uint32_t outwidth, outheight;
+    halvedFrameSize(format, width, height, outwidth, outheight);
+    if (format == NV_OF_BUFFER_FORMAT_ABGR8) {
+        halvePlane<4>(src, (size_t)width * 4, dst, (size_t)outwidth * 4, outwidth, outheight, pool);
+        return;
+    }
+    halvePlane<1>(src, width, dst, outwidth, outwidth, outheight, pool);
+    if (format == NV_OF_BUFFER_FORMAT_NV12)
+        halvePlane<2>(src + (size_t)width * height, width, dst + (size_t)outwidth * outheight, outwidth,
+                      outwidth / 2, outheight / 2, pool);
+}
+
+// Function to turn R, G, B, A pixels into A, B, G, R ones, a byte reversal of every pixel
+void swizzleRGBAtoABGR(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t n = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    // Bytes swapped within the 16 bit words, then the two words of every pixel swapped
+    for (; n + 4 <= count; n += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + 4 * n));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i*)(dst + 4 * n), v);
+    }
+#endif
+    for (; n < count; ++n) {
+        dst[4 * n] = src[4 * n + 3];
+        dst[4 * n + 1] = src[4 * n + 2];
+        dst[4 * n + 2] = src[4 * n + 1];
+        dst[4 * n + 3] = src[4 * n];
+    }
+}
+
+// Function to build a pyramid of up to numlevels levels from a luma image in levels[0]
+void buildPyramid(std::vector<GrayImage>& levels, uint32_t numlevels, uint32_t minsize, ThreadPool* pool) {
+    levels.resize(numlevels);
+    uint32_t n = 1;
+    while (n < numlevels && levels[n - 1].width / 2 >= minsize && levels[n - 1].height / 2 >= minsize) {
+        downsample2x(levels[n - 1], levels[n], pool);
+        ++n;
+    }
+    levels.resize(n);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+#include <stddef.h>
+#include <vector>
+
+class ThreadPool;
+
+// 8 bit single channel image, rows are tightly packed
+struct GrayImage {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> data;
+
+    GrayImage() : width(0), height(0) {}
+    void resize(uint32_t w, uint32_t h) { width = w; height = h; data.resize((size_t)w * h); }
+    uint8_t* row(uint32_t y) { return data.data() + (size_t)y * width; }
+    const uint8_t* row(uint32_t y) const { return data.data() + (size_t)y * width; }
+};
+
+// Function to get the size in bytes of a tightly packed frame in one of the NVOF input formats
+size_t frameSize(NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height);
+
+// Function to extract the luma plane of an input frame in any of the NVOF input formats
+void extractLuma(const uint8_t* frame, NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height,
+                 GrayImage& luma, ThreadPool* pool = nullptr);
+
+// Function to halve an image with a 2x2 box filter
+void downsample2x(const GrayImage& src, GrayImage& dst, ThreadPool* pool = nullptr);
+
+// Function to get the size of a frame halved by halveFrame
+void halvedFrameSize(NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height, uint32_t& outwidth, uint32_t& outheight);
+
+// Function to halve a tightly packed frame in any of the NVOF input formats with a 2x2 box filter, using SSE2.
+// NV12 chroma is filtered as interleaved pairs and ABGR per channel.
+void halveFrame(const uint8_t* src, uint8_t* dst, NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height,
+                ThreadPool* pool = nullptr);
+
+// Function to turn count R, G, B, A pixels into the A, B, G, R byte order of NV_OF_BUFFER_FORMAT_ABGR8, using SSE2
+void swizzleRGBAtoABGR(const uint8_t* src, uint8_t* dst, size_t count);
+
+// Function to build a pyramid of up to numlevels levels from a luma image in levels[0].
+// Stops early once a level would be smaller than minsize in either direction.
+void buildPyramid(std::vector<GrayImage>& levels, uint32_t numlevels, uint32_t minsize, ThreadPool* pool = nullptr);
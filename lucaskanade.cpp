@@ -0,0 +1,345 @@
+#include "lucaskanade.h"
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+LucasKanadeBackend::LucasKanadeBackend(const NV_OF_INIT_PARAMS& initparams, uint32_t numthreads)
+    : CpuFlowBackend(initparams, LK_LEVELS, LK_MIN_LEVEL_SIZE, numthreads)
+{
+    // The full resolution level is never smaller than the coarsest one the pyramid allows
+    if (initparams.width < LK_MIN_LEVEL_SIZE || initparams.height < LK_MIN_LEVEL_SIZE)
+        throw std::runtime_error("Lucas-Kanade needs frames of at least " + std::to_string(LK_MIN_LEVEL_SIZE) + "x" +
+                                 std::to_string(LK_MIN_LEVEL_SIZE) + " pixels");
+}
+
+// Sums src over a (2r+1)^2 window with clamped borders, separably through m_tmp.
+// The window sums are not normalized since they cancel out in the 2x2 solve.
+void LucasKanadeBackend::boxFilter(const FloatImage& src, FloatImage& dst) {
+    const int w = (int)src.width, h = (int)src.height, r = LK_WINDOW_RADIUS;
+    m_tmp.resize(src.width, src.height);
+    dst.resize(src.width, src.height);
+
+    m_pool->parallelFor(src.height, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            const float* s = src.row(y);
+            float* t = m_tmp.row(y);
+            int x = 0;
+            for (; x < std::min(r, w); ++x) {
+                float acc = 0.0f;
+                for (int k = -r; k <= r; ++k)
+                    acc += s[std::min(std::max(x + k, 0), w - 1)];
+                t[x] = acc;
+            }
+#if defined(__SSE2__)
+            for (; x + 4 <= w - r; x += 4) {
+                __m128 acc = _mm_loadu_ps(s + x - r);
+                for (int k = -r + 1; k <= r; ++k)
+                    acc = _mm_add_ps(acc, _mm_loadu_ps(s + x + k));
+                _mm_storeu_ps(t + x, acc);
+            }
+#endif
+            for (; x < w; ++x) {
+                float acc = 0.0f;
+                for (int k = -r; k <= r; ++k)
+                    acc += s[std::min(std::max(x + k, 0), w - 1)];
+                t[x] = acc;
+            }
+        }
+    });
+
+    m_pool->parallelFor(src.height, [&](uint32_t begin, uint32_t end) {
+        const float* rows[2 * LK_WINDOW_RADIUS + 1];
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            for (int k = -r; k <= r; ++k)
+                rows[k + r] = m_tmp.row(std::min(std::max((int)y + k, 0), h - 1));
+            float* d = dst.row(y);
+            int x = 0;
+#if defined(__SSE2__)
+            for (; x + 4 <= w; x += 4) {
+                __m128 acc = _mm_loadu_ps(rows[0] + x);
+                for (int k = 1; k <= 2 * r; ++k)
+                    acc = _mm_add_ps(acc, _mm_loadu_ps(rows[k] + x));
+                _mm_storeu_ps(d + x, acc);
+            }
+#endif
+            for (; x < w; ++x) {
+                float acc = 0.0f;
+                for (int k = 0; k <= 2 * r; ++k)
+                    acc += rows[k][x];
+                d[x] = acc;
+            }
+        }
+    });
+}
+
+// Replaces a flow component by its window average
+void LucasKanadeBackend::smoothFlow(FloatImage& flow) {
+    const float norm = 1.0f / ((2 * LK_WINDOW_RADIUS + 1) * (2 * LK_WINDOW_RADIUS + 1));
+    boxFilter(flow, m_sumx);
+    m_pool->parallelFor(flow.height, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            const float* s = m_sumx.row(y);
+            float* d = flow.row(y);
+            for (uint32_t x = 0; x < flow.width; ++x)
+                d[x] = s[x] * norm;
+        }
+    });
+}
+
+void LucasKanadeBackend::solveLevel(const GrayImage& prev, const GrayImage& cur, bool coarsest) {
+    const uint32_t w = prev.width, h = prev.height;
+    m_i1.resize(w, h);
+    m_ix.resize(w, h);
+    m_iy.resize(w, h);
+    m_prodx.resize(w, h);
+    m_prody.resize(w, h);
+
+    // Previous frame as float and its central difference gradients
+    m_pool->parallelFor(h, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            const uint8_t* s = prev.row(y);
+            float* d = m_i1.row(y);
+            for (uint32_t x = 0; x < w; ++x)
+                d[x] = s[x];
+        }
+    });
+    m_pool->parallelFor(h, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            const float* up = m_i1.row(y > 0 ? y - 1 : y);
+            const float* mid = m_i1.row(y);
+            const float* down = m_i1.row(y + 1 < h ? y + 1 : y);
+            float* gx = m_ix.row(y);
+            float* gy = m_iy.row(y);
+            gx[0] = mid[std::min(1u, w - 1)] - mid[0];
+            uint32_t x = 1;
+#if defined(__SSE2__)
+            const __m128 half = _mm_set1_ps(0.5f);
+            for (; x + 4 < w; x += 4) {
+                _mm_storeu_ps(gx + x, _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(mid + x + 1), _mm_loadu_ps(mid + x - 1))));
+            }
+#endif
+            for (; x + 1 < w; ++x)
+                gx[x] = 0.5f * (mid[x + 1] - mid[x - 1]);
+            if (w > 1)
+                gx[w - 1] = mid[w - 1] - mid[w - 2];
+
+            float scale = (y > 0 && y + 1 < h) ? 0.5f : 1.0f;
+            x = 0;
+#if defined(__SSE2__)
+            const __m128 vscale = _mm_set1_ps(scale);
+            for (; x + 4 <= w; x += 4)
+                _mm_storeu_ps(gy + x, _mm_mul_ps(vscale, _mm_sub_ps(_mm_loadu_ps(down + x), _mm_loadu_ps(up + x))));
+#endif
+            for (; x < w; ++x)
+                gy[x] = scale * (down[x] - up[x]);
+        }
+    });
+
+    // Structure tensor products, box filtered and inverted once per level
+    m_pool->parallelFor(h, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            const float* gx = m_ix.row(y);
+            const float* gy = m_iy.row(y);
+            float* pxx = m_prodx.row(y);
+            float* pyy = m_prody.row(y);
+            uint32_t x = 0;
+#if defined(__SSE2__)
+            for (; x + 4 <= w; x += 4) {
+                __m128 vx = _mm_loadu_ps(gx + x), vy = _mm_loadu_ps(gy + x);
+                _mm_storeu_ps(pxx + x, _mm_mul_ps(vx, vx));
+                _mm_storeu_ps(pyy + x, _mm_mul_ps(vy, vy));
+            }
+#endif
+            for (; x < w; ++x) {
+                pxx[x] = gx[x] * gx[x];
+                pyy[x] = gy[x] * gy[x];
+            }
+        }
+    });
+    boxFilter(m_prodx, m_invxx);
+    boxFilter(m_prody, m_invyy);
+    m_pool->parallelFor(h, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            const float* gx = m_ix.row(y);
+            const float* gy = m_iy.row(y);
+            float* pxy = m_prodx.row(y);
+            uint32_t x = 0;
+#if defined(__SSE2__)
+            for (; x + 4 <= w; x += 4)
+                _mm_storeu_ps(pxy + x, _mm_mul_ps(_mm_loadu_ps(gx + x), _mm_loadu_ps(gy + x)));
+#endif
+            for (; x < w; ++x)
+                pxy[x] = gx[x] * gy[x];
+        }
+    });
+    boxFilter(m_prodx, m_invxy);
+
+    // The regularization keeps the determinant positive since xx * yy >= xy^2
+    m_pool->parallelFor(h, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            float* a = m_invxx.row(y);
+            float* b = m_invxy.row(y);
+            float* c = m_invyy.row(y);
+            uint32_t x = 0;
+#if defined(__SSE2__)
+            const __m128 reg = _mm_set1_ps(LK_REGULARIZATION);
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 sign = _mm_set1_ps(-0.0f);
+            for (; x + 4 <= w; x += 4) {
+                __m128 va = _mm_add_ps(_mm_loadu_ps(a + x), reg);
+                __m128 vb = _mm_loadu_ps(b + x);
+                __m128 vc = _mm_add_ps(_mm_loadu_ps(c + x), reg);
+                __m128 inv = _mm_div_ps(one, _mm_sub_ps(_mm_mul_ps(va, vc), _mm_mul_ps(vb, vb)));
+                _mm_storeu_ps(a + x, _mm_mul_ps(vc, inv));
+                _mm_storeu_ps(b + x, _mm_xor_ps(_mm_mul_ps(vb, inv), sign));
+                _mm_storeu_ps(c + x, _mm_mul_ps(va, inv));
+            }
+#endif
+            for (; x < w; ++x) {
+                float va = a[x] + LK_REGULARIZATION, vb = b[x], vc = c[x] + LK_REGULARIZATION;
+                float inv = 1.0f / (va * vc - vb * vb);
+                a[x] = vc * inv;
+                b[x] = -vb * inv;
+                c[x] = va * inv;
+            }
+        }
+    });
+
+    // Start from the upsampled flow of the coarser level
+    m_u.resize(w, h);
+    m_v.resize(w, h);
+    if (coarsest) {
+        std::fill(m_u.data.begin(), m_u.data.end(), 0.0f);
+        std::fill(m_v.data.begin(), m_v.data.end(), 0.0f);
+    }
+    else {
+        m_pool->parallelFor(h, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t y = begin; y < end; ++y)
+            {
+                uint32_t cy = std::min(y / 2, m_coarseu.height - 1);
+                const float* cu = m_coarseu.row(cy);
+                const float* cv = m_coarsev.row(cy);
+                float* u = m_u.row(y);
+                float* v = m_v.row(y);
+                for (uint32_t x = 0; x < w; ++x) {
+                    uint32_t cx = std::min(x / 2, m_coarseu.width - 1);
+                    u[x] = 2.0f * cu[cx];
+                    v[x] = 2.0f * cv[cx];
+                }
+            }
+        });
+    }
+
+    for (int it = 0; it < LK_ITERATIONS; ++it) {
+        // Mismatch against the warped current frame, times the gradients
+        m_pool->parallelFor(h, [&](uint32_t begin, uint32_t end) {
+            const float maxx = (float)(w - 1), maxy = (float)(h - 1);
+            for (uint32_t y = begin; y < end; ++y)
+            {
+                const float* i1 = m_i1.row(y);
+                const float* gx = m_ix.row(y);
+                const float* gy = m_iy.row(y);
+                const float* u = m_u.row(y);
+                const float* v = m_v.row(y);
+                float* px = m_prodx.row(y);
+                float* py = m_prody.row(y);
+                for (uint32_t x = 0; x < w; ++x) {
+                    float sx = std::min(std::max(x + u[x], 0.0f), maxx);
+                    float sy = std::min(std::max(y + v[x], 0.0f), maxy);
+                    uint32_t x0 = (uint32_t)sx, y0 = (uint32_t)sy;
+                    uint32_t x1 = std::min(x0 + 1, w - 1), y1 = std::min(y0 + 1, h - 1);
+                    float fx = sx - x0, fy = sy - y0;
+                    const uint8_t* r0 = cur.row(y0);
+                    const uint8_t* r1 = cur.row(y1);
+                    float top = r0[x0] + fx * (r0[x1] - r0[x0]);
+                    float bottom = r1[x0] + fx * (r1[x1] - r1[x0]);
+                    float diff = top + fy * (bottom - top) - i1[x];
+                    px[x] = gx[x] * diff;
+                    py[x] = gy[x] * diff;
+                }
+            }
+        });
+        boxFilter(m_prodx, m_sumx);
+        boxFilter(m_prody, m_sumy);
+
+        // Gauss-Newton step with the inverted tensor
+        m_pool->parallelFor(h, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t y = begin; y < end; ++y)
+            {
+                const float* a = m_invxx.row(y);
+                const float* b = m_invxy.row(y);
+                const float* c = m_invyy.row(y);
+                const float* sx = m_sumx.row(y);
+                const float* sy = m_sumy.row(y);
+                float* u = m_u.row(y);
+                float* v = m_v.row(y);
+                uint32_t x = 0;
+#if defined(__SSE2__)
+                const __m128 lo = _mm_set1_ps(-LK_MAX_STEP), hi = _mm_set1_ps(LK_MAX_STEP);
+                for (; x + 4 <= w; x += 4) {
+                    __m128 vsx = _mm_loadu_ps(sx + x), vsy = _mm_loadu_ps(sy + x), vb = _mm_loadu_ps(b + x);
+                    __m128 du = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + x), vsx), _mm_mul_ps(vb, vsy));
+                    __m128 dv = _mm_add_ps(_mm_mul_ps(vb, vsx), _mm_mul_ps(_mm_loadu_ps(c + x), vsy));
+                    du = _mm_min_ps(_mm_max_ps(du, lo), hi);
+                    dv = _mm_min_ps(_mm_max_ps(dv, lo), hi);
+                    _mm_storeu_ps(u + x, _mm_sub_ps(_mm_loadu_ps(u + x), du));
+                    _mm_storeu_ps(v + x, _mm_sub_ps(_mm_loadu_ps(v + x), dv));
+                }
+#endif
+                for (; x < w; ++x) {
+                    u[x] -= std::min(std::max(a[x] * sx[x] + b[x] * sy[x], -LK_MAX_STEP), LK_MAX_STEP);
+                    v[x] -= std::min(std::max(b[x] * sx[x] + c[x] * sy[x], -LK_MAX_STEP), LK_MAX_STEP);
+                }
+            }
+        });
+
+        // Average the flow over the same window so every pixel agrees with the neighbours it was solved with
+        smoothFlow(m_u);
+        smoothFlow(m_v);
+    }
+}
+
+void LucasKanadeBackend::estimate(const std::vector<GrayImage>& prev, const std::vector<GrayImage>& cur, NV_OF_FLOW_VECTOR* flowdata) {
+    // Stop at the level whose pixels are the output grid cells
+    const uint32_t grid = m_initparams.outGridSize;
+    uint32_t finest = 0;
+    while ((2u << finest) <= grid && finest + 1 < prev.size())
+        ++finest;
+
+    const uint32_t top = (uint32_t)prev.size() - 1;
+    for (uint32_t l = top + 1; l-- > finest;) {
+        if (l != top) {
+            std::swap(m_u, m_coarseu);
+            std::swap(m_v, m_coarsev);
+        }
+        solveLevel(prev[l], cur[l], l == top);
+    }
+
+    // Sample the flow at every output cell and scale it back to full resolution pixels
+    const float scale = (float)(1u << finest);
+    m_pool->parallelFor(m_outheight, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; ++y)
+        {
+            uint32_t sy = std::min((y * grid) >> finest, m_u.height - 1);
+            const float* u = m_u.row(sy);
+            const float* v = m_v.row(sy);
+            NV_OF_FLOW_VECTOR* out = flowdata + (size_t)y * m_outwidth;
+            for (uint32_t x = 0; x < m_outwidth; ++x) {
+                uint32_t sx = std::min((x * grid) >> finest, m_u.width - 1);
+                out[x].flowx = toFlowS10_5(scale * u[sx]);
+                out[x].flowy = toFlowS10_5(scale * v[sx]);
+            }
+        }
+    });
+}
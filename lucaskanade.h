@@ -0,0 +1,45 @@
+#pragma once
+#include "cpuflow.h"
+
+#define LK_LEVELS 6             // pyramid levels, enough for ~60 pixel motion
+#define LK_MIN_LEVEL_SIZE 16    // smallest pyramid level in pixels
+#define LK_WINDOW_RADIUS 3      // the structure tensor is summed over a (2r+1)^2 window
+#define LK_ITERATIONS 3         // Gauss-Newton iterations per level
+#define LK_REGULARIZATION 10.0f // added to the tensor diagonal so flat areas do not blow up
+#define LK_MAX_STEP 1.0f        // largest update per iteration in pixels of the level
+
+// Single channel float image, rows are tightly packed
+struct FloatImage {
+    uint32_t width;
+    uint32_t height;
+    std::vector<float> data;
+
+    FloatImage() : width(0), height(0) {}
+    void resize(uint32_t w, uint32_t h) { width = w; height = h; data.resize((size_t)w * h); }
+    float* row(uint32_t y) { return data.data() + (size_t)y * width; }
+    const float* row(uint32_t y) const { return data.data() + (size_t)y * width; }
+};
+
+// CPU engine doing coarse-to-fine dense Lucas-Kanade. On every level the structure tensor of the
+// previous frame is box filtered and inverted once, then each iteration only warps the current
+// frame, box filters the mismatch terms, applies the 2x2 solve and averages the flow over the same
+// window. The pyramid is only descended down to the level matching the output grid size, so grid
+// sizes 2 and 4 never touch full resolution.
+// Every pass is split into row bands on the thread pool and the inner loops use SSE.
+class LucasKanadeBackend : public CpuFlowBackend {
+public:
+    LucasKanadeBackend(const NV_OF_INIT_PARAMS& initparams, uint32_t numthreads);
+
+protected:
+    void estimate(const std::vector<GrayImage>& prev, const std::vector<GrayImage>& cur, NV_OF_FLOW_VECTOR* flowdata);
+
+private:
+    void solveLevel(const GrayImage& prev, const GrayImage& cur, bool coarsest);
+    void boxFilter(const FloatImage& src, FloatImage& dst);
+    void smoothFlow(FloatImage& flow);
+
+    FloatImage m_i1, m_ix, m_iy;
+    FloatImage m_invxx, m_invxy, m_invyy;
+    FloatImage m_u, m_v, m_coarseu, m_coarsev;
+    FloatImage m_prodx, m_prody, m_sumx, m_sumy, m_tmp;
+};
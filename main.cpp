@@ -2,283 +2,161 @@
 #include <string>
 #include <opencv2/opencv.hpp>
 #include "flowvec.h"
+#include "flowbackend.h"
+#include "flowsession.h"
+#include "flowcolor.h"
+#include "flowcheck.h"
+#include "framesource.h"
+#include "imgproc.h"
+#include "frameskip.h"
+#include "flowwriter.h"
+#include "videowriter.h"
+#include "flowshm.h"
+#include "pipeline.h"
+#include "threadpool.h"
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <math.h>
+#include <thread>
 #include "cuda_runtime.h"
 #include "cuda.h"
 
-
-#define UNKNOWN_FLOW_THRESH 1e9
-int m_ncols = 0;
-int m_colorwheel[60][3];
-uint8_t gridsize = 0;
-
-void writeFlowtoFile(float* flowvec, uint16_t width, uint16_t height) {
-    std::ofstream flowfile;
-    flowfile.open("flowvec.txt", std::ios::app);
-    for (uint32_t y = 0; y < height; ++y)
-    {
-        for (uint32_t x = 0; x < width; ++x)
-        {
-            flowfile << flowvec[(y * 2 * width) + 2 * x] << " " << flowvec[(y * 2 * width) + 2 * x + 1] << " ";
-        }
-    }
-    flowfile << std::endl;
-    flowfile.close();
-}
-
-static inline bool unknown_flow(float u, float v)
-{
-    return (fabs(u) >  UNKNOWN_FLOW_THRESH)
-        || (fabs(v) >  UNKNOWN_FLOW_THRESH)
-        || std::isnan(u) || std::isnan(v);
+// Main function to calculate optical flow between the previous frame and this one
+bool calculateFlow(FlowBackend& backend, const uint8_t* frame, NV_OF_FLOW_VECTOR* flowdata, uint8_t* costdata, NV_OF_FLOW_VECTOR* bwddata) {
+    // On the hardware backend this only uploads, executes and downloads on the already initialized session
+    return backend.compute(frame, flowdata, costdata, bwddata);
 }
 
-void SetColors(int r, int g, int b, int k)
-{
-    m_colorwheel[k][0] = r;
-    m_colorwheel[k][1] = g;
-    m_colorwheel[k][2] = b;
+#define NO_SLOT 0xffffffffu
+
+// Frame handed from the reader to the flow stage, either a slot of the ring or a frame of a mapped
+// file that is used in place (slot is NO_SLOT)
+struct FrameRef {
+    const uint8_t* data;
+    uint32_t slot;
+};
+
+// Flow handed from the flow stage to the sink, with the cost of every vector when the backend outputs cost
+// or the consistency check marks into it, and the backward flow when the backend predicts both directions
+struct FlowRef {
+    NV_OF_FLOW_VECTOR* flow;
+    uint8_t* cost;
+    NV_OF_FLOW_VECTOR* backward;
+};
+
+// Function to copy whichever grids both flows have
+void copyFlow(const FlowRef& src, FlowRef& dst, size_t flowsize) {
+    memcpy(dst.flow, src.flow, flowsize * sizeof(NV_OF_FLOW_VECTOR));
+    if (src.cost && dst.cost)
+        memcpy(dst.cost, src.cost, flowsize);
+    if (src.backward && dst.backward)
+        memcpy(dst.backward, src.backward, flowsize * sizeof(NV_OF_FLOW_VECTOR));
 }
 
-void MakeColorWheel()
-{
-    // relative lengths of color transitions:
-    // these are chosen based on perceptual similarity
-    // (e.g. one can distinguish more shades between red and yellow 
-    //  than between yellow and green)
-    int RY = 15;
-    int YG = 6;
-    int GC = 4;
-    int CB = 11;
-    int BM = 13;
-    int MR = 6;
-    m_ncols = RY + YG + GC + CB + BM + MR;
-
-    int i;
-    int k = 0;
-
-    for (i = 0; i < RY; i++) SetColors(255, 255 * i / RY, 0, k++);
-    for (i = 0; i < YG; i++) SetColors(255 - 255 * i / YG, 255, 0, k++);
-    for (i = 0; i < GC; i++) SetColors(0, 255, 255 * i / GC, k++);
-    for (i = 0; i < CB; i++) SetColors(0, 255 - 255 * i / CB, 255, k++);
-    for (i = 0; i < BM; i++) SetColors(255 * i / BM, 0, 255, k++);
-    for (i = 0; i < MR; i++) SetColors(255, 0, 255 - 255 * i / MR, k++);
+// Function to fill a flow for a still frame: zero vectors both ways, which is as confident as a vector gets
+void clearFlow(FlowRef& flow, size_t flowsize) {
+    memset(flow.flow, 0, flowsize * sizeof(NV_OF_FLOW_VECTOR));
+    if (flow.cost)
+        memset(flow.cost, 0, flowsize);
+    if (flow.backward)
+        memset(flow.backward, 0, flowsize * sizeof(NV_OF_FLOW_VECTOR));
 }
 
-void ComputeColor(float fx, float fy, uint8_t* pix)
-{
-    float rad = sqrtf(fx * fx + fy * fy);
-    float a = atan2f(-fy, -fx) / M_PI;
-    float fk = (a + 1.0f) / 2.0f * (m_ncols - 1);
-    int k0 = (int)fk;
-    int k1 = (k0 + 1) % m_ncols;
-    float f = fk - k0;
-    //f = 0; // uncomment to see original color wheel
-    for (int b = 0; b < 3; b++)
+// Reader stage: fills free frame slots from the frame source, ahead of the flow stage.
+// Mapped sources skip the slots and pass their frames on directly.
+void readFrames(FrameSource& source, SlotRing& frames, BoundedQueue<uint32_t>& freeFrames, BoundedQueue<FrameRef>& readyFrames,
+                std::exception_ptr& error) {
+    try
     {
-        float col0 = m_colorwheel[k0][b] / 255.0f;
-        float col1 = m_colorwheel[k1][b] / 255.0f;
-        float col = (1 - f) * col0 + f * col1;
-        if (rad <= 1)
-            col = 1 - rad * (1 - col); // increase saturation with radius
-        else
-            col *= .75f; // out of range
-        pix[2 - b] = (int)(255.0f * col);
-    }
-}
-
-// Post processing to get the flow vectors in RGB format for viewing
-void postProcessVectors(const NV_OF_FLOW_VECTOR* _flowvectors, uint8_t* output, uint16_t outwidth, uint16_t outheight) {
-    // converting them to normal float values first
-    std::unique_ptr<float[]> flowvec;
-    flowvec.reset(new float[outwidth * outheight * 2]);
-
-    for (uint32_t y = 0; y < outheight; ++y)
-    {
-        for (uint32_t x = 0; x < outwidth; ++x)
-        {
-            flowvec[(y * 2 * outwidth) + 2 * x] = (float)(_flowvectors[y * outwidth + x].flowx / 32.0f);
-            flowvec[(y * 2 * outwidth) + 2 * x + 1] = (float)(_flowvectors[y * outwidth + x].flowy / 32.0f);
+        if (source.isMapped()) {
+            const uint8_t* data;
+            while ((data = source.next()) != nullptr) {
+                FrameRef frame = { data, NO_SLOT };
+                if (!readyFrames.push(frame))
+                    break;
+            }
+        }
+        else {
+            uint32_t slot;
+            while (freeFrames.pop(slot)) {
+                if (!source.read(frames.slot(slot)))
+                    break;
+                FrameRef frame = { frames.slot(slot), slot };
+                if (!readyFrames.push(frame))
+                    break;
+            }
         }
     }
-
-    // writeFlowtoFile(flowvec.get(), outwidth, outheight);
-    // exit(0);
-
-    float maxx = -999.0f;
-    float maxy = -999.0f;
-    float minx = 999.0f, miny = 999.0f;
-    float maxrad = -1.0f;
-    for (uint32_t n = 0; n < (outheight * outwidth); ++n)
+    catch(...)
     {
-        float fx = flowvec[2 * n];
-        float fy = flowvec[(2 * n) + 1];
-
-        if (unknown_flow(fx, fy))
-            return;
-        maxx = std::max(maxx, fx);
-        maxy = std::max(maxy, fy);
-        minx = std::min(minx, fx);
-        miny = std::min(miny, fy);
-        float rad = sqrt(fx * fx + fy * fy);
-        maxrad = std::max(maxrad, rad);
+        error = std::current_exception();
     }
-    maxrad = std::max(maxrad, 1.0f);
+    readyFrames.close();
+}
 
-    // post processing to get the flow vectors in RGB format for viewing
-    for (uint32_t y = 0; y < outheight; ++y)
+// Flow stage: runs the backend on every frame and hands the vectors to the sink.
+// With a skipper, static frames get zero flow and strided frames repeat the last computed flow.
+void executeFlow(FlowBackend& backend, FrameSkipper* skipper, BoundedQueue<FrameRef>& readyFrames, BoundedQueue<uint32_t>& freeFrames,
+                 BoundedQueue<FlowRef>& freeFlows, BoundedQueue<FlowRef>& readyFlows,
+                 uint64_t& executed, std::exception_ptr& error) {
+    try
     {
-        for (uint32_t x = 0; x < outwidth; ++x)
-        {
-            float fx = flowvec[(y * outwidth * 2) + (2 * x)];
-            float fy = flowvec[(y * outwidth * 2) + (2 * x) + 1];
-            uint8_t pix[3];
-            if (unknown_flow(fx, fy))
-            {
-                pix[0] = pix[1] = pix[2] = 0;
+        size_t flowsize = (size_t)backend.getOutputWidth() * backend.getOutputHeight();
+        // Storage for the last computed flow, with the same grids as the buffers
+        std::vector<NV_OF_FLOW_VECTOR> lastflow, lastbackward;
+        std::vector<uint8_t> lastcost;
+        FlowRef last = { nullptr, nullptr, nullptr };
+        bool havelast = false;
+
+        FrameRef frame;
+        FlowRef flowdata;
+        while (readyFrames.pop(frame) && freeFlows.pop(flowdata)) {
+            FrameAction action = skipper ? skipper->classify(frame.data) : FRAME_COMPUTE;
+            bool computed = true;
+            if (action == FRAME_STATIC)
+                clearFlow(flowdata, flowsize);
+            else if (action == FRAME_ADVANCE) {
+                backend.advance(frame.data);
+                if (havelast)
+                    copyFlow(last, flowdata, flowsize);
+                computed = havelast;
             }
-            else
-            {
-                ComputeColor(fx / maxrad, fy / maxrad, pix);
+            else {
+                computed = calculateFlow(backend, frame.data, flowdata.flow, flowdata.cost, flowdata.backward);
+                if (computed) {
+                    ++executed;
+                    if (skipper) {
+                        if (!havelast) {
+                            lastflow.resize(flowsize);
+                            last.flow = lastflow.data();
+                            if (flowdata.cost) {
+                                lastcost.resize(flowsize);
+                                last.cost = lastcost.data();
+                            }
+                            if (flowdata.backward) {
+                                lastbackward.resize(flowsize);
+                                last.backward = lastbackward.data();
+                            }
+                        }
+                        copyFlow(flowdata, last, flowsize);
+                        havelast = true;
+                    }
+                }
             }
 
-            output[(y * outwidth * 3) + (3 * x)] = pix[0];
-            output[(y * outwidth * 3) + (3 * x) + 1] = pix[1];
-            output[(y * outwidth * 3) + (3 * x) + 2] = pix[2];
+            // The backend keeps its own copy of the frame, so the slot can be refilled right away
+            if (frame.slot != NO_SLOT)
+                freeFrames.push(frame.slot);
+            if (!(computed ? readyFlows.push(flowdata) : freeFlows.push(flowdata)))
+                break;
         }
     }
-}
-
-// Function to initialize NVOF parameters
-NV_OF_INIT_PARAMS initializeOFParameters() {
-    NV_OF_INIT_PARAMS initparams = { 0 };
-    initparams.width = W_BUFF;
-    initparams.height = H_BUFF;
-    initparams.inputBufferFormat = NV_OF_BUFFER_FORMAT_ABGR8;
-    initparams.mode = NV_OF_MODE_OPTICALFLOW;
-    initparams.outGridSize = (NV_OF_OUTPUT_VECTOR_GRID_SIZE)gridsize;
-    initparams.enableOutputCost = NV_OF_FALSE;
-    initparams.predDirection = NV_OF_PRED_DIRECTION_FORWARD;
-    initparams.perfLevel = NV_OF_PERF_LEVEL_SLOW;
-    initparams.enableExternalHints = NV_OF_FALSE;
-    initparams.enableRoi = NV_OF_FALSE;
-    initparams.enableGlobalFlow = NV_OF_FALSE;
-    initparams.hintGridSize = (NV_OF_HINT_VECTOR_GRID_SIZE)0;
-    
-    return initparams;
-}
-
-// Function to create and upload input buffer
-NvOFCudaBuffer* createAndUploadInputBuffer(API* nvofobj, uint8_t* frameData) {
-    NV_OF_BUFFER_DESCRIPTOR bufferDesc;
-    bufferDesc.width = W_BUFF;
-    bufferDesc.height = H_BUFF;
-    bufferDesc.bufferUsage = NV_OF_BUFFER_USAGE_INPUT;
-    bufferDesc.bufferFormat = NV_OF_BUFFER_FORMAT_ABGR8;
-    
-    NvOFCudaBuffer* buffer = new NvOFCudaBuffer(nvofobj, bufferDesc);
-    buffer->UploadData(frameData);
-    
-    return buffer;
-}
-
-// Function to calculate output buffer dimensions
-void calculateOutputDimensions(uint32_t& outwidth, uint32_t& outheight) {
-    outheight = H_BUFF / gridsize;
-    outwidth = W_BUFF / gridsize;
-}
-
-// Function to create output buffer
-NvOFCudaBuffer* createOutputBuffer(API* nvofobj, uint32_t outwidth, uint32_t outheight) {
-    NV_OF_BUFFER_DESCRIPTOR outbufferDesc;
-    outbufferDesc.width = outwidth;
-    outbufferDesc.height = outheight;
-    outbufferDesc.bufferUsage = NV_OF_BUFFER_USAGE_OUTPUT;
-    outbufferDesc.bufferFormat = NV_OF_BUFFER_FORMAT_SHORT2;
-    
-    return new NvOFCudaBuffer(nvofobj, outbufferDesc);
-}
-
-// Function to prepare execution input parameters
-NV_OF_EXECUTE_INPUT_PARAMS prepareExecutionInputParams(NvOFCudaBuffer* inbuffer, NvOFCudaBuffer* refbuffer) {
-    NV_OF_EXECUTE_INPUT_PARAMS inparams;
-    memset(&inparams, 0, sizeof(NV_OF_EXECUTE_INPUT_PARAMS));
-    
-    inparams.inputFrame = inbuffer->getOFBufferHandle();
-    inparams.referenceFrame = refbuffer->getOFBufferHandle();
-    inparams.externalHints = (NvOFGPUBufferHandle)nullptr;
-    inparams.disableTemporalHints = NV_OF_FALSE;
-    inparams.hPrivData = (NvOFPrivDataHandle)nullptr;
-    inparams.numRois = 0;
-    inparams.padding = 0;
-    inparams.padding2 = 0;
-    
-    return inparams;
-}
-
-// Function to prepare execution output parameters
-NV_OF_EXECUTE_OUTPUT_PARAMS prepareExecutionOutputParams(NvOFCudaBuffer* outbuffer) {
-    NV_OF_EXECUTE_OUTPUT_PARAMS outparams;
-    memset(&outparams, 0, sizeof(NV_OF_EXECUTE_OUTPUT_PARAMS));
-    
-    outparams.bwdOutputBuffer = nullptr;
-    outparams.bwdOutputCostBuffer = nullptr;
-    outparams.globalFlowBuffer = nullptr;
-    outparams.hPrivData = nullptr;
-    outparams.outputBuffer = outbuffer->getOFBufferHandle();
-    outparams.outputCostBuffer = nullptr;
-    
-    return outparams;
-}
-
-// Main function to calculate optical flow
-void calculateFlow(uint8_t* frame1, uint8_t* frame2, uint8_t* vecframe, 
-                   CUcontext cuContext, CUstream instream, CUstream outstream) {
-    // Create an instance of the API
-    API* nvofobj = new API(cuContext, instream, outstream);
-    
-    // Initialize the optical flow parameters
-    NV_OF_INIT_PARAMS initparams = initializeOFParameters();
-    NVOF_API_CALL(nvofobj->getAPI()->nvOFInit(nvofobj->getHandle(), &initparams));
-    
-    // Create and upload input buffers
-    NvOFCudaBuffer* inbuffer = createAndUploadInputBuffer(nvofobj, frame1);
-    NvOFCudaBuffer* refbuffer = createAndUploadInputBuffer(nvofobj, frame2);
-    
-    // Calculate output buffer dimensions
-    uint32_t outwidth, outheight;
-    calculateOutputDimensions(outwidth, outheight);
-    
-    // Pointer for storing the flow vectors
-    std::unique_ptr<NV_OF_FLOW_VECTOR[]> flowdata;
-    flowdata.reset(new NV_OF_FLOW_VECTOR[outwidth * outheight * 2]);
-    
-    // Create output buffer
-    NvOFCudaBuffer* outbuffer = createOutputBuffer(nvofobj, outwidth, outheight);
-    
-    // Prepare execution parameters
-    NV_OF_EXECUTE_INPUT_PARAMS inparams = prepareExecutionInputParams(inbuffer, refbuffer);
-    NV_OF_EXECUTE_OUTPUT_PARAMS outparams = prepareExecutionOutputParams(outbuffer);
-    
-    // Run Optical Flow
-    nvofobj->getAPI()->nvOFExecute(nvofobj->getHandle(), &inparams, &outparams);
-    
-    // Download flow vectors
-    outbuffer->DownloadData(flowdata.get());
-    
-    // Post-process vectors
-    postProcessVectors((const NV_OF_FLOW_VECTOR*)flowdata.get(), (uint8_t*)vecframe, outwidth, outheight);
-    
-    // Clean up
-    flowdata.reset();
-    delete inbuffer;
-    delete refbuffer;
-    delete outbuffer;
-    
-    // Destroy NVOF session
-    nvofobj->getAPI()->nvOFDestroy(nvofobj->getHandle());
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    readyFlows.close();
 }
 
 int main(int argc, char* argv[]) {
@@ -288,88 +166,291 @@ int main(int argc, char* argv[]) {
 
     // Give the input video file path and GPU number
     if (argc < 4) {
-        std::cerr << "Usage: " << argv[0] << " <input file path>" << " <GPU number>" << "<Grid Size>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <input file path>" << " <GPU number>" << " <Grid Size>" << " [--queue-depth N] [--backend nvof|blockmatch|lk] [--threads N] [--colors lut|exact] [--post-threads N] [--source auto|libav|pipe|mmap] [--format abgr|nv12|gray] [--downscale 1|2|4] [--size WxH] [--skip-threshold T] [--skip-stride N] [--write-flow PATH] [--encode PATH] [--preview K] [--publish NAME] [--publish-visual NAME] [--cost-threshold T] [--cost-mask zero|flag] [--consistency TOL] [--perf slow|medium|fast] [--hint-grid 0|1|2|4|8]" << std::endl;
         exit(EXIT_FAILURE);
     }
 
     std::string inputVideoFile(argv[1]);
 
-    gridsize = atoi(argv[3]);
+    uint8_t gridsize = atoi(argv[3]);
+
+    // Frames queued between two stages, more depth gives more throughput at the cost of latency
+    uint32_t queuedepth = 2;
+    // Flow engine and the number of threads used by the CPU engines (0 = all hardware threads)
+    std::string backendName = "nvof";
+    uint32_t numthreads = 0;
+    // Colorization through the lookup table or computed per vector like the reference
+    ColorFunc colorize = colorizeLUT;
+    // Threads coloring the flow for display (0 = all hardware threads, 1 = no pool)
+    uint32_t postthreads = 0;
+    // Raw frame files are mapped, videos decoded in process when the build has libav and through an ffmpeg process otherwise
+    std::string sourceName = "auto";
+    // Resolution of raw frame files without a header
+    uint32_t rawwidth = 0, rawheight = 0;
+    // Pixel format the frames are decoded to and uploaded in, NV12 and gray need far less bandwidth than ABGR
+    NV_OF_BUFFER_FORMAT format = NV_OF_BUFFER_FORMAT_ABGR8;
+    // Factor the frames are shrunk by on the CPU before the flow engine sees them
+    uint32_t downscale = 1;
+    // Frames whose mean absolute difference to the reference stays below this get zero flow (0 = never),
+    // and only every N-th pair is computed
+    float skipthreshold = 0.0f;
+    uint32_t skipstride = 1;
+    // File the flow is streamed to, .flo for Middlebury frames and raw S10.5 grids otherwise
+    std::string flowPath;
+    // Video file the colored flow is encoded to, and every how many frames it is shown (0 = no window)
+    std::string videoPath;
+    uint32_t preview = 1;
+    // Shared memory ring the flow is published to for other processes, optionally with the colored flow
+    std::string shmName;
+    bool shmVisual = false;
+    // Vectors the engine rates with a cost above this are zeroed or flagged (negative = no cost output)
+    int costthreshold = -1;
+    CostMask costmask = COST_MASK_FLAG;
+    // Vectors whose forward-backward round trip misses by more than this many pixels are zeroed or flagged like
+    // costly ones (negative = forward flow only)
+    float consistency = -1.0f;
+    // Speed against quality of the hardware engine, and the grid its own last output is fed back on as
+    // external hints (0 = no hints), which keeps the fast levels on track through large motion
+    NV_OF_PERF_LEVEL perflevel = NV_OF_PERF_LEVEL_SLOW;
+    uint32_t hintgrid = 0;
+    for (int i = 4; i + 1 < argc; i += 2) {
+        std::string option(argv[i]);
+        if (option == "--queue-depth")
+            queuedepth = std::max(1, atoi(argv[i + 1]));
+        else if (option == "--backend")
+            backendName = argv[i + 1];
+        else if (option == "--threads")
+            numthreads = std::max(0, atoi(argv[i + 1]));
+        else if (option == "--colors" && std::string(argv[i + 1]) == "lut")
+            colorize = colorizeLUT;
+        else if (option == "--colors" && std::string(argv[i + 1]) == "exact")
+            colorize = selectColorKernel();
+        else if (option == "--post-threads")
+            postthreads = std::max(0, atoi(argv[i + 1]));
+        else if (option == "--source")
+            sourceName = argv[i + 1];
+        else if (option == "--format" && std::string(argv[i + 1]) == "abgr")
+            format = NV_OF_BUFFER_FORMAT_ABGR8;
+        else if (option == "--format" && std::string(argv[i + 1]) == "nv12")
+            format = NV_OF_BUFFER_FORMAT_NV12;
+        else if (option == "--format" && std::string(argv[i + 1]) == "gray")
+            format = NV_OF_BUFFER_FORMAT_GRAYSCALE8;
+        else if (option == "--size" && sscanf(argv[i + 1], "%ux%u", &rawwidth, &rawheight) == 2)
+            continue;
+        else if (option == "--skip-threshold")
+            skipthreshold = std::max(0.0f, (float)atof(argv[i + 1]));
+        else if (option == "--skip-stride")
+            skipstride = std::max(1, atoi(argv[i + 1]));
+        else if (option == "--write-flow")
+            flowPath = argv[i + 1];
+        else if (option == "--encode")
+            videoPath = argv[i + 1];
+        else if (option == "--preview")
+            preview = std::max(0, atoi(argv[i + 1]));
+        else if (option == "--publish" || option == "--publish-visual") {
+            shmName = argv[i + 1];
+            shmVisual = option == "--publish-visual";
+        }
+        else if (option == "--cost-threshold")
+            costthreshold = std::min(std::max(0, atoi(argv[i + 1])), 255);
+        else if (option == "--cost-mask" && std::string(argv[i + 1]) == "zero")
+            costmask = COST_MASK_ZERO;
+        else if (option == "--cost-mask" && std::string(argv[i + 1]) == "flag")
+            costmask = COST_MASK_FLAG;
+        else if (option == "--consistency")
+            consistency = (float)atof(argv[i + 1]);
+        else if (option == "--perf" && std::string(argv[i + 1]) == "slow")
+            perflevel = NV_OF_PERF_LEVEL_SLOW;
+        else if (option == "--perf" && std::string(argv[i + 1]) == "medium")
+            perflevel = NV_OF_PERF_LEVEL_MEDIUM;
+        else if (option == "--perf" && std::string(argv[i + 1]) == "fast")
+            perflevel = NV_OF_PERF_LEVEL_FAST;
+        else if (option == "--hint-grid")
+            hintgrid = std::max(0, atoi(argv[i + 1]));
+        else if (option == "--downscale")
+            downscale = std::max(0, atoi(argv[i + 1]));
+        else {
+            std::cerr << "Unknown option " << option << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
 
     printf("Input video file: %s\n", inputVideoFile.c_str());
 
-    std::string ffmpeg_path = "ffmpeg";
-
-    // command to run ffmpeg
-	std::string command = ffmpeg_path + " -i " + "\"" + inputVideoFile + "\"" + " -f image2pipe -pix_fmt abgr -vcodec rawvideo -";
-	std::FILE* pipe = popen(command.c_str(), "r");
-	if (!pipe) {
-		throw std::runtime_error("Failed to open pipe");
-	}
-
-	// Allocate memory for two frames
-    uint8_t* frame1 = (uint8_t*)malloc(H_BUFF * W_BUFF * 4 * sizeof(uint8_t));
-    uint8_t* frame2 = (uint8_t*)malloc(H_BUFF * W_BUFF * 4 * sizeof(uint8_t));
-    uint8_t* vecframe = (uint8_t*)malloc(H_BUFF / gridsize * W_BUFF / gridsize * 3 * sizeof(uint8_t));
-
-    if (!frame1 || !frame2) {
-        std::cerr << "Failed to allocate memory." << std::endl;
-        pclose(pipe);
-        free(frame1);
-        free(frame2);
-        throw std::runtime_error("Failed to allocate memory");
-    }
+    // Open the video, decoded frames arrive in the selected input format at the probed resolution,
+    // raw frame files keep their own format
+    std::unique_ptr<FrameSource> source(createFrameSource(sourceName, inputVideoFile, format, downscale, rawwidth, rawheight));
+    uint32_t width = source->getWidth();
+    uint32_t height = source->getHeight();
+    format = source->getFormat();
+    printf("Flow resolution: %ux%u\n", width, height);
 
-    // Read the first frame into frame1
-    if (fread(frame1, H_BUFF * W_BUFF * 4, 1, pipe) != 1) {
-        std::cerr << "Failed to read the first frame." << std::endl;
-        free(frame1);
-        free(frame2);
-        pclose(pipe);
-        throw std::runtime_error("Failed to read the first frame");
-    }
-
-    // Create CUDA context
+    // Create CUDA context, only the hardware backend needs one
     CUcontext cuContext = nullptr;
-    CUdevice cuDevice = 0;
-    int device = atoi(argv[2]);
-    cuDeviceGet(&cuDevice, device);
-    cuCtxCreate(&cuContext, 0, cuDevice);
-
-    // Copy the frame data to the input and reference streams
     CUstream instream = nullptr, outstream = nullptr;
+    bool useCuda = backendNeedsCuda(backendName);
+    if (useCuda) {
+        CUdevice cuDevice = 0;
+        int device = atoi(argv[2]);
+        cuDeviceGet(&cuDevice, device);
+        cuCtxCreate(&cuContext, 0, cuDevice);
+
+        // Copy the frame data to the input and reference streams
+        cuStreamCreate(&instream, CU_STREAM_DEFAULT);
+        cuStreamCreate(&outstream, CU_STREAM_DEFAULT);
+    }
 
-    cuStreamCreate(&instream, CU_STREAM_DEFAULT);
-    cuStreamCreate(&outstream, CU_STREAM_DEFAULT);
+    // Create the flow backend once for the whole video
+    bool useCost = costthreshold >= 0;
+    bool useCheck = consistency >= 0;
+    NV_OF_INIT_PARAMS initparams = initializeOFParameters(width, height, gridsize, format, useCost);
+    if (useCheck)
+        initparams.predDirection = NV_OF_PRED_DIRECTION_BOTH;
+    initparams.perfLevel = perflevel;
+    if (hintgrid > 0) {
+        if (!useCuda || (hintgrid & (hintgrid - 1)) || hintgrid > NV_OF_HINT_VECTOR_GRID_SIZE_8 || hintgrid < gridsize) {
+            std::cerr << "Hints need the nvof backend and a hint grid of 1, 2, 4 or 8 no finer than the output grid" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        initparams.enableExternalHints = NV_OF_TRUE;
+        initparams.hintGridSize = (NV_OF_HINT_VECTOR_GRID_SIZE)hintgrid;
+    }
+    FlowBackend* backend = createFlowBackend(backendName, initparams, numthreads, cuContext, instream, outstream);
+    if (useCost && !backend->hasCost()) {
+        std::cerr << "The " << backendName << " backend has no cost output" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    uint32_t outwidth = backend->getOutputWidth();
+    uint32_t outheight = backend->getOutputHeight();
+
+    // Every stage holds one buffer while the queues hold the rest, so nothing is allocated per frame
+    size_t framesize = frameSize(format, width, height);
+    uint32_t numbuffers = queuedepth + 2;
+    // Mapped sources hand out their frames in place and need no slots
+    SlotRing frames(source->isMapped() ? 0 : numbuffers, framesize);
+    std::vector<std::vector<NV_OF_FLOW_VECTOR>> flows(numbuffers, std::vector<NV_OF_FLOW_VECTOR>(outwidth * outheight));
+    // The consistency check marks into the cost grid, so it gets one even without cost output
+    bool useMask = useCost || useCheck;
+    std::vector<std::vector<uint8_t>> costs(useMask ? numbuffers : 0, std::vector<uint8_t>(outwidth * outheight));
+    std::vector<std::vector<NV_OF_FLOW_VECTOR>> backwards(useCheck ? numbuffers : 0, std::vector<NV_OF_FLOW_VECTOR>(outwidth * outheight));
+    // Occluded vectors are FLOW_MASK_OCCLUDED, so with the check the threshold stays below it
+    uint8_t maskthreshold = FLOW_MASK_OCCLUDED - 1;
+    if (useCost)
+        maskthreshold = useCheck ? (uint8_t)std::min(costthreshold, FLOW_MASK_OCCLUDED - 1) : (uint8_t)costthreshold;
+    std::vector<uint8_t> vecframe(outwidth * outheight * 3);
+
+    BoundedQueue<uint32_t> freeFrames(numbuffers);
+    BoundedQueue<FrameRef> readyFrames(queuedepth);
+    BoundedQueue<FlowRef> freeFlows(numbuffers), readyFlows(queuedepth);
+    for (uint32_t i = 0; i < numbuffers; ++i) {
+        freeFrames.push(i);
+        FlowRef flow = { flows[i].data(), useMask ? costs[i].data() : nullptr, useCheck ? backwards[i].data() : nullptr };
+        freeFlows.push(flow);
+    }
+
+    std::unique_ptr<FlowWriter> flowWriter;
+    if (!flowPath.empty())
+        flowWriter.reset(new FlowWriter(flowPath, flowFileFormat(flowPath), outwidth, outheight, gridsize));
+    std::unique_ptr<VideoWriter> videoWriter;
+    if (!videoPath.empty())
+        videoWriter.reset(new VideoWriter(videoPath, outwidth, outheight));
+    std::unique_ptr<FlowShmPublisher> publisher;
+    if (!shmName.empty())
+        publisher.reset(new FlowShmPublisher(shmName, outwidth, outheight, gridsize, shmVisual));
+
+    // Pool for the post processing, created once and reused by every frame
+    std::unique_ptr<ThreadPool> postpool;
+    if (postthreads != 1)
+        postpool.reset(new ThreadPool(postthreads));
+
+    // Reader and flow execution run on their own threads, post processing and display stay on this one
+    std::exception_ptr readError, flowError;
+    std::thread reader(readFrames, std::ref(*source), std::ref(frames), std::ref(freeFrames), std::ref(readyFrames), std::ref(readError));
+    std::unique_ptr<FrameSkipper> skipper;
+    if (skipthreshold > 0 || skipstride > 1)
+        skipper.reset(new FrameSkipper(format, width, height, skipthreshold, skipstride));
+    uint64_t executed = 0;
+    std::thread executor(executeFlow, std::ref(*backend), skipper.get(), std::ref(readyFrames), std::ref(freeFrames),
+                         std::ref(freeFlows), std::ref(readyFlows), std::ref(executed), std::ref(flowError));
 
     // Run inference on each frame till last frame
-	while (fread(frame2, H_BUFF * W_BUFF * 4, 1, pipe) == 1) {
-        
-        // Calculate the flow vectors
-        calculateFlow(frame1, frame2, vecframe, cuContext, instream, outstream);
+    FlowRef flowdata;
+    uint64_t sunk = 0;
+    while (readyFlows.pop(flowdata)) {
+        // Only every preview-th frame is shown, so the window never holds back the flow
+        bool show = preview > 0 && sunk++ % preview == 0;
+
+        // Post-process vectors, straight into the encoder's buffer when there is one
+        uint8_t* vectors = vecframe.data();
+        if (videoWriter)
+            vectors = videoWriter->acquire();
+        // Vectors failing the round trip are marked in the cost grid, cleared first when the engine leaves it alone
+        if (useCheck) {
+            if (!useCost)
+                memset(flowdata.cost, 0, (size_t)outwidth * outheight);
+            checkConsistency(flowdata.flow, flowdata.backward, outwidth, outheight, gridsize, consistency, flowdata.cost, postpool.get());
+        }
+
+        // With a mask the masking is fused into the coloring, zeroed vectors also reach the writer and the ring
+        bool visual = videoWriter || show || shmVisual;
+        if (visual && useMask)
+            postProcessVectors(flowdata.flow, flowdata.cost, maskthreshold, costmask, vectors, outwidth, outheight,
+                               colorize, postpool.get());
+        else if (visual)
+            postProcessVectors(flowdata.flow, vectors, outwidth, outheight, colorize, postpool.get());
+        else if (useMask && costmask == COST_MASK_ZERO)
+            maskVectors(flowdata.flow, flowdata.cost, maskthreshold, outwidth, outheight, postpool.get());
+        if (flowWriter)
+            flowWriter->write(flowdata.flow);
+        if (publisher)
+            publisher->publish(flowdata.flow, vectors);
+        freeFlows.push(flowdata);
 
         // Display
-        cv::imshow("Vectors", cv::Mat(H_BUFF / gridsize, W_BUFF / gridsize, CV_8UC3, vecframe));
+        if (show)
+            cv::imshow("Vectors", cv::Mat(outheight, outwidth, CV_8UC3, vectors));
         // cv::imshow("Original2", out);
+        if (videoWriter)
+            videoWriter->submit(vectors);
 
-        if (cv::waitKey(1) == 27) break;
-
-        // Swap the frames
-        memcpy(frame1, frame2, H_BUFF * W_BUFF * 4);
-
+        if (show && cv::waitKey(1) == 27) break;
     }
 
-    // free memory
-    free(frame1);
-    free(frame2);
-    free(vecframe);
-    pclose(pipe);
-
-    cuStreamDestroy(instream);
-    cuStreamDestroy(outstream);
-    cuCtxDestroy(cuContext);
+    // Unblock the other stages and wait for them to finish
+    freeFrames.close();
+    readyFrames.close();
+    freeFlows.close();
+    readyFlows.close();
+    reader.join();
+    executor.join();
+    if (flowWriter)
+        flowWriter->close();
+    if (videoWriter)
+        videoWriter->close();
+    publisher.reset();
+
+    if (skipper)
+        printf("Frame pairs: %llu executed, %llu skipped as static, %llu skipped by stride\n", (unsigned long long)executed,
+               (unsigned long long)skipper->getStaticFrames(), (unsigned long long)skipper->getStridedFrames());
+
+    source.reset();
+
+    // Destroy the backend before the streams and context it uses
+    delete backend;
+
+    if (useCuda) {
+        cuStreamDestroy(instream);
+        cuStreamDestroy(outstream);
+        cuCtxDestroy(cuContext);
+    }
 
     // Close all windows
-    cv::destroyAllWindows();    
+    if (preview > 0)
+        cv::destroyAllWindows();
+
+    if (readError)
+        std::rethrow_exception(readError);
+    if (flowError)
+        std::rethrow_exception(flowError);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,118 @@
+#include <vector>
+#include <string>
+#include "flowclient.h"
+#include "imgproc.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+// Results of one load generating client
+struct ClientStats {
+    std::vector<double> latencies;  // seconds per frame pair
+    uint64_t failures;
+    std::string error;
+};
+
+// Sends pairs of frames through its own connection as fast as the server answers
+static void runClient(const std::string& path, NV_OF_BUFFER_FORMAT format, uint32_t width, uint32_t height,
+                      uint32_t gridsize, uint32_t pairs, ClientStats& stats) {
+    stats.failures = 0;
+    try
+    {
+        FlowClient client(path);
+        client.configure(format, width, height, gridsize);
+
+        // A texture and the same texture moved by a few pixels, so the engine has motion to find
+        size_t framesize = frameSize(format, width, height);
+        uint8_t* frame1 = client.getFrame1();
+        uint8_t* frame2 = client.getFrame2();
+        for (size_t i = 0; i < framesize; ++i)
+            frame1[i] = (uint8_t)((i * 7) ^ (i >> 9));
+        memcpy(frame2 + 3, frame1, framesize - 3);
+        memcpy(frame2, frame1, 3);
+
+        stats.latencies.reserve(pairs);
+        for (uint32_t n = 0; n < pairs; ++n) {
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                client.compute();
+            }
+            catch(const std::exception& e)
+            {
+                ++stats.failures;
+                stats.error = e.what();
+                continue;
+            }
+            stats.latencies.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    catch(const std::exception& e)
+    {
+        stats.failures += pairs - stats.latencies.size();
+        stats.error = e.what();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <socket path>" << " <clients>" << " <pairs per client>" << " [--size WxH] [--format abgr|nv12|gray] [--grid 1|2|4]" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::string socketPath(argv[1]);
+    uint32_t numclients = std::max(1, atoi(argv[2]));
+    uint32_t pairs = std::max(1, atoi(argv[3]));
+    uint32_t width = 1920, height = 1080, gridsize = 4;
+    NV_OF_BUFFER_FORMAT format = NV_OF_BUFFER_FORMAT_ABGR8;
+    for (int i = 4; i + 1 < argc; i += 2) {
+        std::string option(argv[i]);
+        if (option == "--size" && sscanf(argv[i + 1], "%ux%u", &width, &height) == 2)
+            continue;
+        else if (option == "--format" && std::string(argv[i + 1]) == "abgr")
+            format = NV_OF_BUFFER_FORMAT_ABGR8;
+        else if (option == "--format" && std::string(argv[i + 1]) == "nv12")
+            format = NV_OF_BUFFER_FORMAT_NV12;
+        else if (option == "--format" && std::string(argv[i + 1]) == "gray")
+            format = NV_OF_BUFFER_FORMAT_GRAYSCALE8;
+        else if (option == "--grid")
+            gridsize = std::max(1, atoi(argv[i + 1]));
+        else {
+            std::cerr << "Unknown option " << option << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    std::vector<ClientStats> stats(numclients);
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < numclients; ++i)
+        clients.push_back(std::thread(runClient, socketPath, format, width, height, gridsize, pairs, std::ref(stats[i])));
+    for (uint32_t i = 0; i < numclients; ++i)
+        clients[i].join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> latencies;
+    uint64_t failures = 0;
+    for (uint32_t i = 0; i < numclients; ++i) {
+        latencies.insert(latencies.end(), stats[i].latencies.begin(), stats[i].latencies.end());
+        failures += stats[i].failures;
+        if (!stats[i].error.empty())
+            std::cerr << "Client " << i << ": " << stats[i].error << std::endl;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("%u clients, %zu pairs in %.2f s, %.1f pairs/s, %llu failed\n", numclients, latencies.size(), elapsed,
+           latencies.size() / elapsed, (unsigned long long)failures);
+    if (!latencies.empty()) {
+        printf("Latency ms: p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n", 1e3 * latencies[latencies.size() / 2],
+               1e3 * latencies[latencies.size() * 9 / 10], 1e3 * latencies[latencies.size() * 99 / 100], 1e3 * latencies.back());
+    }
+    return failures ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,87 @@
+#include <string>
+#include "flowbackend.h"
+#include "flowserver.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <signal.h>
+#include <string.h>
+#include "cuda.h"
+
+static FlowServer* server = nullptr;
+
+static void stopServer(int) {
+    if (server)
+        server->stop();
+}
+
+int main(int argc, char* argv[]) {
+    // Initialize CUDA
+    cuInit(0);
+
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <socket path>" << " <GPU number>" << " [--backend nvof|blockmatch|lk] [--threads N] [--batch N]" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::string socketPath(argv[1]);
+
+    // Flow engine, threads of the CPU engines (0 = all hardware threads) and requests run per batch
+    std::string backendName = "nvof";
+    uint32_t numthreads = 0;
+    uint32_t batchsize = FLOW_SERVER_BATCH;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string option(argv[i]);
+        if (option == "--backend")
+            backendName = argv[i + 1];
+        else if (option == "--threads")
+            numthreads = std::max(0, atoi(argv[i + 1]));
+        else if (option == "--batch")
+            batchsize = std::max(1, atoi(argv[i + 1]));
+        else {
+            std::cerr << "Unknown option " << option << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Create CUDA context, only the hardware backend needs one
+    CUcontext cuContext = nullptr;
+    CUstream instream = nullptr, outstream = nullptr;
+    bool useCuda = backendNeedsCuda(backendName);
+    if (useCuda) {
+        CUdevice cuDevice = 0;
+        cuDeviceGet(&cuDevice, atoi(argv[2]));
+        cuCtxCreate(&cuContext, 0, cuDevice);
+        cuStreamCreate(&instream, CU_STREAM_DEFAULT);
+        cuStreamCreate(&outstream, CU_STREAM_DEFAULT);
+    }
+
+    {
+        FlowServer flowServer(backendName, numthreads, cuContext, instream, outstream, batchsize);
+        server = &flowServer;
+
+        // SIGINT and SIGTERM end the accept loop, without SA_RESTART so accept() returns
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = stopServer;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+
+        printf("Serving flow on %s\n", socketPath.c_str());
+        fflush(stdout);
+        flowServer.run(socketPath);
+        server = nullptr;
+
+        uint64_t served = flowServer.getServed(), batches = flowServer.getBatches();
+        printf("Served %llu frame pairs in %llu batches\n", (unsigned long long)served, (unsigned long long)batches);
+    }
+
+    // The server and its sessions are gone, so the streams and context can go too
+    if (useCuda) {
+        cuStreamDestroy(instream);
+        cuStreamDestroy(outstream);
+        cuCtxDestroy(cuContext);
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+// Blocking queue with a fixed capacity used to connect the pipeline stages.
+// push() waits while the queue is full and pop() waits while it is empty, so a
+// slow stage applies back-pressure instead of letting frames pile up.
+// close() wakes everybody up; after that push() fails and pop() drains what is left.
+// The items live in a ring allocated up front, so pushing and popping never allocates.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : m_capacity(capacity), m_closed(false), m_items(capacity), m_head(0), m_count(0) {}
+
+    bool push(const T& item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_closed || m_count < m_capacity; });
+        if (m_closed)
+            return false;
+        m_items[(m_head + m_count) % m_capacity] = item;
+        ++m_count;
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return m_closed || m_count > 0; });
+        if (m_count == 0)
+            return false;
+        item = m_items[m_head];
+        m_head = (m_head + 1) % m_capacity;
+        --m_count;
+        m_notFull.notify_one();
+        return true;
+    }
+
+    // Like pop() but returns false right away instead of waiting for an item
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_count == 0)
+            return false;
+        item = m_items[m_head];
+        m_head = (m_head + 1) % m_capacity;
+        --m_count;
+        m_notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notFull.notify_all();
+        m_notEmpty.notify_all();
+    }
+
+private:
+    size_t m_capacity;
+    bool m_closed;
+    std::vector<T> m_items;
+    size_t m_head;
+    size_t m_count;
+    std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+};
+
+// Fixed set of equally sized frame slots carved out of one allocation made up front.
+// Every slot starts on a page boundary, so reads land on whole pages and uploads see aligned
+// host memory. The stages pass slot indices through their queues and borrow the memory with
+// slot(), nothing is allocated or copied per frame.
+class SlotRing {
+public:
+    SlotRing(uint32_t numslots, size_t slotsize) : m_memory(nullptr), m_numslots(numslots), m_slotsize(slotsize) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        m_pitch = (slotsize + page - 1) / page * page;
+        if (posix_memalign((void**)&m_memory, page, m_pitch * numslots) != 0)
+            throw std::bad_alloc();
+    }
+    ~SlotRing() { free(m_memory); }
+
+    uint32_t getNumSlots() { return m_numslots; }
+    size_t getSlotSize() { return m_slotsize; }
+    uint8_t* slot(uint32_t index) { return m_memory + index * m_pitch; }
+
+private:
+    SlotRing(const SlotRing&);
+    SlotRing& operator=(const SlotRing&);
+
+    uint8_t* m_memory;
+    uint32_t m_numslots;
+    size_t m_slotsize;
+    size_t m_pitch;
+};
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdio.h>
+
+// Minimal checking for the test programs: every failed check is reported with its location and counted,
+// and main returns TEST_RESULT so that make test stops at the first failing program
+static int g_failures = 0;
+
+#define CHECK(cond)                                                                         \
+    do                                                                                      \
+    {                                                                                       \
+        if (!(cond))                                                                        \
+        {                                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);        \
+            ++g_failures;                                                                   \
+        }                                                                                   \
+    } while (0)
+
+#define TEST_RESULT (g_failures ? (fprintf(stderr, "%d checks failed\n", g_failures), 1) : 0)
@@ -0,0 +1,56 @@
+// The few CUDA driver calls of the session code, done on host memory for the tests. Linked instead of
+// libcuda together with the stand-in NVOF library, whose "device" buffers are plain host allocations.
+#include "cuda.h"
+#include "cudastub.h"
+#include <string.h>
+#include <vector>
+
+CUresult CUDAAPI cuGetErrorName(CUresult, const char** name) {
+    *name = "CUDA_ERROR_STUB";
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxPushCurrent(CUcontext) {
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxPopCurrent(CUcontext* ctx) {
+    if (ctx)
+        *ctx = nullptr;
+    return CUDA_SUCCESS;
+}
+
+// Copies into device memory are done at once, which keeps them ordered before the executes like the input
+// stream does. Copies back to the host are queued and only land at the next stream synchronization, so a
+// download read before it sees stale data.
+static std::vector<CUDA_MEMCPY2D> g_pending;
+static int g_synchronizes = 0;
+
+static void copy2D(const CUDA_MEMCPY2D* copy) {
+    const uint8_t* src = copy->srcMemoryType == CU_MEMORYTYPE_HOST ? (const uint8_t*)copy->srcHost : (const uint8_t*)copy->srcDevice;
+    uint8_t* dst = copy->dstMemoryType == CU_MEMORYTYPE_HOST ? (uint8_t*)copy->dstHost : (uint8_t*)copy->dstDevice;
+    src += copy->srcY * copy->srcPitch + copy->srcXInBytes;
+    dst += copy->dstY * copy->dstPitch + copy->dstXInBytes;
+    for (size_t y = 0; y < copy->Height; ++y)
+        memcpy(dst + y * copy->dstPitch, src + y * copy->srcPitch, copy->WidthInBytes);
+}
+
+CUresult CUDAAPI cuMemcpy2DAsync(const CUDA_MEMCPY2D* copy, CUstream) {
+    if (copy->dstMemoryType == CU_MEMORYTYPE_HOST)
+        g_pending.push_back(*copy);
+    else
+        copy2D(copy);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuStreamSynchronize(CUstream) {
+    ++g_synchronizes;
+    for (const CUDA_MEMCPY2D& copy : g_pending)
+        copy2D(&copy);
+    g_pending.clear();
+    return CUDA_SUCCESS;
+}
+
+int cudaStubSynchronizes() {
+    return g_synchronizes;
+}
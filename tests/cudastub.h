@@ -0,0 +1,4 @@
+#pragma once
+
+// Stream synchronizations seen by the host memory stub of the CUDA driver, see cudastub.cpp
+int cudaStubSynchronizes();
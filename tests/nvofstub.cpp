@@ -0,0 +1,195 @@
+// Stand-in for libnvidia-opticalflow.so, see nvofstub.h
+#include "NvOFInterface/nvOpticalFlowCuda.h"
+#include "nvofstub.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define STUB_PITCH_ALIGN 256    // rows are padded like on the GPU, so the pitched copies get exercised
+
+struct StubBuffer {
+    NV_OF_BUFFER_DESCRIPTOR desc;
+    uint32_t pitch;
+    uint8_t* data;
+};
+
+struct StubHandle {
+    NV_OF_INIT_PARAMS initparams;
+    uint32_t executes;
+};
+
+static NvOFStubCounters g_counters;
+// Hints passed to the last hinted execute, without the row padding
+static std::vector<NV_OF_FLOW_VECTOR> g_hints;
+static uint32_t g_hintwidth = 0;
+static uint32_t g_hintheight = 0;
+
+static uint32_t elementSize(NV_OF_BUFFER_FORMAT format) {
+    switch (format)
+    {
+    case NV_OF_BUFFER_FORMAT_ABGR8:
+    case NV_OF_BUFFER_FORMAT_SHORT2:
+    case NV_OF_BUFFER_FORMAT_UINT:
+        return 4;
+    case NV_OF_BUFFER_FORMAT_SHORT:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+static NV_OF_STATUS NVOFAPI stubCreate(CUcontext, NvOFHandle* handle) {
+    ++g_counters.creates;
+    *handle = (NvOFHandle)new StubHandle();
+    return NV_OF_SUCCESS;
+}
+
+static NV_OF_STATUS NVOFAPI stubInit(NvOFHandle handle, const NV_OF_INIT_PARAMS* initparams) {
+    ++g_counters.inits;
+    ((StubHandle*)handle)->initparams = *initparams;
+    return NV_OF_SUCCESS;
+}
+
+static NV_OF_STATUS NVOFAPI stubCreateBuffer(NvOFHandle, const NV_OF_BUFFER_DESCRIPTOR* desc, NV_OF_CUDA_BUFFER_TYPE,
+                                             NvOFGPUBufferHandle* buffer) {
+    if (desc->bufferUsage <= NV_OF_BUFFER_USAGE_UNDEFINED || desc->bufferUsage >= NV_OF_BUFFER_USAGE_MAX)
+        return NV_OF_ERR_INVALID_PARAM;
+    ++g_counters.buffers[desc->bufferUsage];
+
+    StubBuffer* stub = new StubBuffer();
+    stub->desc = *desc;
+    stub->pitch = (desc->width * elementSize(desc->bufferFormat) + STUB_PITCH_ALIGN - 1) / STUB_PITCH_ALIGN * STUB_PITCH_ALIGN;
+    uint32_t rows = desc->bufferFormat == NV_OF_BUFFER_FORMAT_NV12 ? desc->height + (desc->height + 1) / 2 : desc->height;
+    stub->data = (uint8_t*)calloc(rows, stub->pitch);
+    *buffer = (NvOFGPUBufferHandle)stub;
+    return NV_OF_SUCCESS;
+}
+
+static CUarray NVOFAPI stubGetArray(NvOFGPUBufferHandle) {
+    return nullptr;
+}
+
+// The stand-in CUDA driver in tests/ copies device pointers like host pointers
+static CUdeviceptr NVOFAPI stubGetDevicePtr(NvOFGPUBufferHandle buffer) {
+    return (CUdeviceptr)((StubBuffer*)buffer)->data;
+}
+
+static NV_OF_STATUS NVOFAPI stubGetStrideInfo(NvOFGPUBufferHandle buffer, NV_OF_CUDA_BUFFER_STRIDE_INFO* strideinfo) {
+    StubBuffer* stub = (StubBuffer*)buffer;
+    memset(strideinfo, 0, sizeof(*strideinfo));
+    strideinfo->strideInfo[0].strideXInBytes = stub->pitch;
+    strideinfo->strideInfo[0].strideYInBytes = stub->desc.height;
+    strideinfo->numPlanes = 1;
+    return NV_OF_SUCCESS;
+}
+
+static NV_OF_STATUS NVOFAPI stubSetStreams(NvOFHandle, CUstream, CUstream) {
+    return NV_OF_SUCCESS;
+}
+
+static void fillFlow(NvOFGPUBufferHandle buffer, uint32_t execute, int16_t sign) {
+    StubBuffer* stub = (StubBuffer*)buffer;
+    for (uint32_t y = 0; y < stub->desc.height; ++y)
+    {
+        NV_OF_FLOW_VECTOR* row = (NV_OF_FLOW_VECTOR*)(stub->data + (size_t)y * stub->pitch);
+        for (uint32_t x = 0; x < stub->desc.width; ++x)
+        {
+            NV_OF_FLOW_VECTOR v = nvofStubFlow(x, y, execute);
+            row[x].flowx = (int16_t)(sign * v.flowx);
+            row[x].flowy = (int16_t)(sign * v.flowy);
+        }
+    }
+}
+
+static void copyHints(NvOFGPUBufferHandle buffer) {
+    StubBuffer* stub = (StubBuffer*)buffer;
+    g_hintwidth = stub->desc.width;
+    g_hintheight = stub->desc.height;
+    g_hints.resize((size_t)g_hintwidth * g_hintheight);
+    for (uint32_t y = 0; y < g_hintheight; ++y)
+        memcpy(&g_hints[(size_t)y * g_hintwidth], stub->data + (size_t)y * stub->pitch, g_hintwidth * sizeof(NV_OF_FLOW_VECTOR));
+}
+
+static void fillCost(NvOFGPUBufferHandle buffer) {
+    StubBuffer* stub = (StubBuffer*)buffer;
+    for (uint32_t y = 0; y < stub->desc.height; ++y)
+    {
+        for (uint32_t x = 0; x < stub->desc.width; ++x)
+            stub->data[(size_t)y * stub->pitch + x] = nvofStubCost(x, y);
+    }
+}
+
+// Checks the buffers like the driver would and fills the outputs with the known patterns
+static NV_OF_STATUS NVOFAPI stubExecute(NvOFHandle handle, const NV_OF_EXECUTE_INPUT_PARAMS* inparams,
+                                        NV_OF_EXECUTE_OUTPUT_PARAMS* outparams) {
+    StubHandle* stub = (StubHandle*)handle;
+    const NV_OF_INIT_PARAMS& initparams = stub->initparams;
+    if (!inparams->inputFrame || !inparams->referenceFrame || !outparams->outputBuffer)
+        return NV_OF_ERR_INVALID_PARAM;
+    if (initparams.enableOutputCost && !outparams->outputCostBuffer)
+        return NV_OF_ERR_INVALID_PARAM;
+    if (initparams.predDirection == NV_OF_PRED_DIRECTION_BOTH && !outparams->bwdOutputBuffer)
+        return NV_OF_ERR_INVALID_PARAM;
+    if (initparams.enableExternalHints && !inparams->externalHints)
+        return NV_OF_ERR_INVALID_PARAM;
+
+    ++g_counters.executes;
+    if (inparams->externalHints)
+    {
+        ++g_counters.hintedExecutes;
+        copyHints(inparams->externalHints);
+    }
+    fillFlow(outparams->outputBuffer, stub->executes, 1);
+    if (outparams->bwdOutputBuffer)
+        fillFlow(outparams->bwdOutputBuffer, stub->executes, -1);
+    if (outparams->outputCostBuffer)
+        fillCost(outparams->outputCostBuffer);
+    if (outparams->bwdOutputCostBuffer)
+        fillCost(outparams->bwdOutputCostBuffer);
+    ++stub->executes;
+    return NV_OF_SUCCESS;
+}
+
+static NV_OF_STATUS NVOFAPI stubDestroyBuffer(NvOFGPUBufferHandle buffer) {
+    StubBuffer* stub = (StubBuffer*)buffer;
+    ++g_counters.destroyedBuffers;
+    free(stub->data);
+    delete stub;
+    return NV_OF_SUCCESS;
+}
+
+static NV_OF_STATUS NVOFAPI stubDestroy(NvOFHandle handle) {
+    ++g_counters.destroys;
+    delete (StubHandle*)handle;
+    return NV_OF_SUCCESS;
+}
+
+extern "C" NV_OF_STATUS NVOFAPI NvOFGetMaxSupportedApiVersion(uint32_t* version) {
+    *version = NV_OF_API_VERSION;
+    return NV_OF_SUCCESS;
+}
+
+extern "C" NV_OF_STATUS NVOFAPI NvOFAPICreateInstanceCuda(uint32_t, NV_OF_CUDA_API_FUNCTION_LIST* functions) {
+    memset(functions, 0, sizeof(*functions));
+    functions->nvCreateOpticalFlowCuda = stubCreate;
+    functions->nvOFInit = stubInit;
+    functions->nvOFCreateGPUBufferCuda = stubCreateBuffer;
+    functions->nvOFGPUBufferGetCUarray = stubGetArray;
+    functions->nvOFGPUBufferGetCUdeviceptr = stubGetDevicePtr;
+    functions->nvOFGPUBufferGetStrideInfo = stubGetStrideInfo;
+    functions->nvOFSetIOCudaStreams = stubSetStreams;
+    functions->nvOFExecute = stubExecute;
+    functions->nvOFDestroyGPUBufferCuda = stubDestroyBuffer;
+    functions->nvOFDestroy = stubDestroy;
+    return NV_OF_SUCCESS;
+}
+
+extern "C" const NvOFStubCounters* NvOFStubGetCounters() {
+    return &g_counters;
+}
+
+extern "C" const NV_OF_FLOW_VECTOR* NvOFStubGetHints(uint32_t* width, uint32_t* height) {
+    *width = g_hintwidth;
+    *height = g_hintheight;
+    return g_hints.data();
+}
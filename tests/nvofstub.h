@@ -0,0 +1,36 @@
+#pragma once
+#include "NvOFInterface/nvOpticalFlowCommon.h"
+
+// Interface of the stand-in NVOF library built as tests/libnvidia-opticalflow.so. It keeps its GPU buffers in
+// host memory, counts the API calls and fills every output buffer with a known pattern, so the session code
+// can be tested on machines without the hardware.
+
+// Calls seen by the stand-in since it was loaded
+struct NvOFStubCounters {
+    int creates;
+    int inits;
+    int buffers[NV_OF_BUFFER_USAGE_MAX];    // buffers created per usage
+    int destroyedBuffers;
+    int executes;
+    int hintedExecutes;                     // executes that were passed external hints
+    int destroys;
+};
+
+// Forward vector of cell (x, y) written by the execute-th call to nvOFExecute, counting from 0.
+// The backward buffer gets the negated vector.
+inline NV_OF_FLOW_VECTOR nvofStubFlow(uint32_t x, uint32_t y, uint32_t execute) {
+    NV_OF_FLOW_VECTOR v;
+    v.flowx = (int16_t)((int32_t)((x + execute) % 64) * 8 - 256);
+    v.flowy = (int16_t)((int32_t)(y % 32) * 8 - 128);
+    return v;
+}
+
+// Cost of cell (x, y) written into the cost buffers
+inline uint8_t nvofStubCost(uint32_t x, uint32_t y) {
+    return (uint8_t)((x * 7 + y * 3) & 255);
+}
+
+// Exported by the stand-in, looked up with dlsym by the tests. The hints are the ones passed to the last
+// hinted execute, hintwidth x hintheight vectors.
+typedef const NvOFStubCounters* (*PFNNvOFStubGetCounters)();
+typedef const NV_OF_FLOW_VECTOR* (*PFNNvOFStubGetHints)(uint32_t* hintwidth, uint32_t* hintheight);
@@ -0,0 +1,229 @@
+// Forward-backward consistency check on synthetic fields: a constant shift fails only where it leaves the frame,
+// an expanding field fails exactly where it does, and a block moving away fails on its own and colorizes black
+// with the mask as cost. Random fields are compared to the rule of flowcheck.h cell by cell. Widths that are not
+// a multiple of four go through the SSE2 rows and the scalar tail, and every check runs serial and on the pool.
+// The extreme S10.5 vectors get the same answer on both paths.
+#include "flowcheck.h"
+#include "flowcolor.h"
+#include "threadpool.h"
+#include "check.h"
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+static const uint32_t g_widths[] = { 1, 3, 4, 7, 8, 37, 39 };
+
+// One cell of the grid in S10.5 units
+static int16_t cells(int32_t n, uint32_t gridsize)
+{
+    return (int16_t)(n * (int32_t)gridsize * 32);
+}
+
+// The rule of flowcheck.h written out per cell, the landing cell being the nearest one
+static std::vector<uint8_t> referenceMask(const std::vector<NV_OF_FLOW_VECTOR>& forward, const std::vector<NV_OF_FLOW_VECTOR>& backward,
+                                          uint32_t width, uint32_t height, uint32_t gridsize, float tolerance,
+                                          const std::vector<uint8_t>& initial)
+{
+    std::vector<uint8_t> mask = initial;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            const NV_OF_FLOW_VECTOR& f = forward[(size_t)y * width + x];
+            int32_t lx = (int32_t)x + (int32_t)floor(f.flowx / (32.0 * gridsize) + 0.5);
+            int32_t ly = (int32_t)y + (int32_t)floor(f.flowy / (32.0 * gridsize) + 0.5);
+            if (lx < 0 || ly < 0 || lx >= (int32_t)width || ly >= (int32_t)height)
+            {
+                mask[(size_t)y * width + x] = FLOW_MASK_OCCLUDED;
+                continue;
+            }
+            const NV_OF_FLOW_VECTOR& b = backward[(size_t)ly * width + lx];
+            float sx = (float)(f.flowx + b.flowx);
+            float sy = (float)(f.flowy + b.flowy);
+            float len2 = (float)(f.flowx * f.flowx) + (float)(f.flowy * f.flowy) + (float)(b.flowx * b.flowx) +
+                         (float)(b.flowy * b.flowy);
+            if (sx * sx + sy * sy > FLOW_CHECK_ALPHA * len2 + tolerance * tolerance * 1024.0f)
+                mask[(size_t)y * width + x] = FLOW_MASK_OCCLUDED;
+        }
+    }
+    return mask;
+}
+
+// Runs the check serial and on the pool from the same initial mask, both have to give the expected one
+static void checkMask(const std::vector<NV_OF_FLOW_VECTOR>& forward, const std::vector<NV_OF_FLOW_VECTOR>& backward,
+                      uint32_t width, uint32_t height, uint32_t gridsize, float tolerance, const std::vector<uint8_t>& initial,
+                      const std::vector<uint8_t>& expected, ThreadPool& pool)
+{
+    for (ThreadPool* p : { (ThreadPool*)nullptr, &pool })
+    {
+        std::vector<uint8_t> mask = initial;
+        checkConsistency(forward.data(), backward.data(), width, height, gridsize, tolerance, mask.data(), p);
+        CHECK(mask == expected);
+    }
+}
+
+// The whole frame moving by (dx, dy) cells and back: only the cells pushed over the border fail
+static void testShift(ThreadPool& pool)
+{
+    const uint32_t height = 9, gridsize = 4;
+    const int32_t shifts[][2] = { { 2, 0 }, { -3, 1 }, { 0, -2 }, { 0, 0 } };
+    for (uint32_t width : g_widths)
+    {
+        for (const int32_t* shift : shifts)
+        {
+            const size_t count = (size_t)width * height;
+            std::vector<NV_OF_FLOW_VECTOR> forward(count), backward(count);
+            std::vector<uint8_t> initial(count, 0), expected(count, 0);
+            for (size_t n = 0; n < count; ++n)
+            {
+                forward[n].flowx = cells(shift[0], gridsize);
+                forward[n].flowy = cells(shift[1], gridsize);
+                backward[n].flowx = cells(-shift[0], gridsize);
+                backward[n].flowy = cells(-shift[1], gridsize);
+                int32_t lx = (int32_t)(n % width) + shift[0];
+                int32_t ly = (int32_t)(n / width) + shift[1];
+                if (lx < 0 || ly < 0 || lx >= (int32_t)width || ly >= (int32_t)height)
+                    expected[n] = FLOW_MASK_OCCLUDED;
+            }
+            checkMask(forward, backward, width, height, gridsize, 0.0f, initial, expected, pool);
+        }
+    }
+}
+
+// Zoom doubling the distance to the center, the backward field halving it again. The outer cells leave the frame
+// on every side, the inner ones come back exactly, the half cell backward vectors included.
+static void testLeavingFrame(ThreadPool& pool)
+{
+    const uint32_t height = 11, gridsize = 2;
+    for (uint32_t width : g_widths)
+    {
+        const size_t count = (size_t)width * height;
+        const int32_t cx = (int32_t)width / 2, cy = (int32_t)height / 2;
+        std::vector<NV_OF_FLOW_VECTOR> forward(count), backward(count);
+        std::vector<uint8_t> initial(count, 0), expected(count, 0);
+        for (size_t n = 0; n < count; ++n)
+        {
+            int32_t dx = (int32_t)(n % width) - cx;
+            int32_t dy = (int32_t)(n / width) - cy;
+            forward[n].flowx = cells(dx, gridsize);
+            forward[n].flowy = cells(dy, gridsize);
+            backward[n].flowx = (int16_t)(-cells(dx, gridsize) / 2);
+            backward[n].flowy = (int16_t)(-cells(dy, gridsize) / 2);
+            int32_t lx = cx + 2 * dx, ly = cy + 2 * dy;
+            if (lx < 0 || ly < 0 || lx >= (int32_t)width || ly >= (int32_t)height)
+                expected[n] = FLOW_MASK_OCCLUDED;
+        }
+        CHECK(width < 3 || expected[0] == FLOW_MASK_OCCLUDED);
+        CHECK(expected[(size_t)cy * width + cx] == 0);
+        checkMask(forward, backward, width, height, gridsize, 0.0f, initial, expected, pool);
+    }
+}
+
+// A still frame but for a block moving away, whose vectors find nothing bringing them back. The backward vectors
+// are half a pixel off everywhere, which fails without tolerance and passes with one pixel, the block fails either
+// way and the other cells keep the cost they had. The block vectors are the largest of the grid and have to come
+// out black when the forward grid is colorized with the mask as cost.
+static void testOccludedBlock(ThreadPool& pool)
+{
+    const uint32_t height = 13, gridsize = 4;
+    for (uint32_t width : g_widths)
+    {
+        const size_t count = (size_t)width * height;
+        const uint32_t bx = width / 3, bw = std::max(width / 3, 1u);
+        std::vector<NV_OF_FLOW_VECTOR> forward(count), backward(count);
+        std::vector<uint8_t> initial(count), expected(count, FLOW_MASK_OCCLUDED), loose(count);
+        for (size_t n = 0; n < count; ++n)
+        {
+            uint32_t x = (uint32_t)(n % width), y = (uint32_t)(n / width);
+            bool block = x >= bx && x < bx + bw && y >= 4 && y < 8;
+            forward[n].flowx = block ? cells(-6, gridsize) : 0;
+            forward[n].flowy = block ? cells(-5, gridsize) : 0;
+            backward[n].flowx = 16;
+            initial[n] = (uint8_t)(n % 200);
+            loose[n] = block ? FLOW_MASK_OCCLUDED : initial[n];
+        }
+        checkMask(forward, backward, width, height, gridsize, 0.0f, initial, expected, pool);
+        checkMask(forward, backward, width, height, gridsize, 1.0f, initial, loose, pool);
+
+        std::vector<uint8_t> colors(3 * count);
+        for (ThreadPool* p : { (ThreadPool*)nullptr, &pool })
+        {
+            std::vector<NV_OF_FLOW_VECTOR> flow = forward;
+            postProcessVectors(flow.data(), loose.data(), 200, COST_MASK_FLAG, colors.data(), (uint16_t)width, (uint16_t)height,
+                               colorizeLUT, p);
+            for (size_t n = 0; n < count; ++n)
+            {
+                bool black = colors[3 * n] == 0 && colors[3 * n + 1] == 0 && colors[3 * n + 2] == 0;
+                CHECK(black == (loose[n] == FLOW_MASK_OCCLUDED));
+            }
+        }
+    }
+}
+
+// Random noisy fields around a common motion against the reference, on a mask that already holds costs
+static void testRandom(ThreadPool& pool)
+{
+    const uint32_t gridsizes[] = { 1, 2, 4, 8 };
+    for (uint32_t width : g_widths)
+    {
+        for (uint32_t gridsize : gridsizes)
+        {
+            const uint32_t height = 1 + rand() % 17;
+            const size_t count = (size_t)width * height;
+            std::vector<NV_OF_FLOW_VECTOR> forward(count), backward(count);
+            std::vector<uint8_t> initial(count);
+            int32_t mx = rand() % 1001 - 500, my = rand() % 1001 - 500;
+            for (size_t n = 0; n < count; ++n)
+            {
+                // Components stay small enough for the squared sums to be exact in float
+                bool wild = rand() % 4 == 0;
+                forward[n].flowx = (int16_t)(mx + rand() % 101 - 50);
+                forward[n].flowy = (int16_t)(my + rand() % 101 - 50);
+                backward[n].flowx = (int16_t)(wild ? rand() % 2001 - 1000 : -mx + rand() % 101 - 50);
+                backward[n].flowy = (int16_t)(wild ? rand() % 2001 - 1000 : -my + rand() % 101 - 50);
+                initial[n] = (uint8_t)(rand() % 255);
+            }
+            for (float tolerance : { 0.0f, 0.5f, 2.0f })
+            {
+                std::vector<uint8_t> expected = referenceMask(forward, backward, width, height, gridsize, tolerance, initial);
+                checkMask(forward, backward, width, height, gridsize, tolerance, initial, expected, pool);
+            }
+        }
+    }
+}
+
+// The extreme S10.5 vectors: (32767, 32767) cells and the (-32768, -32768) cells 128 cells further on, both
+// in the forward and the backward grid, so every one of them comes back to within one unit. The squares of
+// (-32768, -32768) add up to 2^31, which has to stay positive on the SSE2 rows and in the scalar tail alike.
+static void testExtremes(ThreadPool& pool)
+{
+    const uint32_t width = 133, height = 130, gridsize = 8;
+    const size_t count = (size_t)width * height;
+    std::vector<NV_OF_FLOW_VECTOR> field(count);
+    for (uint32_t y = 0; y < 2; ++y)
+    {
+        for (uint32_t x = 0; x < 5; ++x)
+        {
+            field[(size_t)y * width + x].flowx = field[(size_t)y * width + x].flowy = 32767;
+            field[(size_t)(y + 128) * width + x + 128].flowx = field[(size_t)(y + 128) * width + x + 128].flowy = -32768;
+        }
+    }
+    std::vector<uint8_t> initial(count, 0);
+    std::vector<uint8_t> expected = referenceMask(field, field, width, height, gridsize, 0.0f, initial);
+    CHECK(expected == initial);
+    checkMask(field, field, width, height, gridsize, 0.0f, initial, expected, pool);
+}
+
+int main()
+{
+    srand(1);
+    MakeColorWheel();
+    ThreadPool pool(3);
+    testShift(pool);
+    testLeavingFrame(pool);
+    testOccludedBlock(pool);
+    testRandom(pool);
+    testExtremes(pool);
+    return TEST_RESULT;
+}
@@ -0,0 +1,110 @@
+// FlowEncoder and FlowDecoder round trips on grids of odd sizes, all zero grids and sequences mixing spatial
+// and temporal bands, and packets that were truncated or corrupted, which have to be rejected without
+// disturbing the decoder.
+#include "flowcodec.h"
+#include "threadpool.h"
+#include "check.h"
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define TEST_FRAMES 6
+
+// Smooth motion with a few outliers, frame by frame drifting so temporal prediction wins on some bands.
+// Frame 2 is all zero, which packs every block at zero width.
+static void makeFlow(std::vector<NV_OF_FLOW_VECTOR>& flow, uint32_t width, uint32_t frame) {
+    for (size_t i = 0; i < flow.size(); ++i) {
+        uint32_t x = (uint32_t)(i % width), y = (uint32_t)(i / width);
+        flow[i].flowx = (int16_t)(frame == 2 ? 0 : x * 4 + frame * 3 + (rand() % 16 == 0 ? rand() % 2000 - 1000 : 0));
+        flow[i].flowy = (int16_t)(frame == 2 ? 0 : (int)y * -2 + (int)frame);
+    }
+    if (frame == 5 && !flow.empty()) {
+        flow[0].flowx = 32767;
+        flow.back().flowy = -32768;
+    }
+}
+
+static bool decodes(FlowDecoder& decoder, const std::vector<uint8_t>& packet, std::vector<NV_OF_FLOW_VECTOR>& flow) {
+    try {
+        decoder.decode(packet.data(), packet.size(), flow.data());
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    return true;
+}
+
+static bool sameFlow(const std::vector<NV_OF_FLOW_VECTOR>& a, const std::vector<NV_OF_FLOW_VECTOR>& b) {
+    return memcmp(a.data(), b.data(), a.size() * sizeof(NV_OF_FLOW_VECTOR)) == 0;
+}
+
+static void testRoundTrip(uint32_t width, uint32_t height, ThreadPool* pool) {
+    FlowEncoder encoder(width, height, pool);
+    FlowDecoder decoder(width, height, pool);
+    std::vector<NV_OF_FLOW_VECTOR> flow((size_t)width * height), decoded(flow.size());
+    std::vector<uint8_t> packet;
+    for (uint32_t frame = 0; frame < TEST_FRAMES; ++frame) {
+        makeFlow(flow, width, frame);
+        // Packets are exactly as large as their contents, so any read past a band would leave the buffer
+        encoder.encode(flow.data(), packet, frame == 4);
+        packet.shrink_to_fit();
+        CHECK(decodes(decoder, packet, decoded));
+        CHECK(sameFlow(flow, decoded));
+    }
+}
+
+// Every packet cut short or with a flipped byte is either rejected, leaving the output and the previous grid
+// as they were, or decodes to some grid. Either way the next good temporal packet still decodes exactly.
+static void testCorrupt(uint32_t width, uint32_t height) {
+    FlowEncoder encoder(width, height);
+    std::vector<NV_OF_FLOW_VECTOR> first((size_t)width * height), second(first.size()), third(first.size());
+    makeFlow(first, width, 0);
+    makeFlow(second, width, 1);
+    makeFlow(third, width, 3);
+    std::vector<uint8_t> packet1, packet2, packet3;
+    encoder.encode(first.data(), packet1);
+    encoder.encode(second.data(), packet2);
+    FlowEncoder nextencoder(width, height);
+    nextencoder.encode(first.data(), packet3);
+    nextencoder.encode(third.data(), packet3);
+
+    std::vector<NV_OF_FLOW_VECTOR> decoded(first.size()), marker(first.size());
+    for (size_t i = 0; i < marker.size(); ++i)
+        marker[i].flowx = marker[i].flowy = 0x5a5a;
+    for (size_t cut = 0; cut < packet2.size(); cut += 1 + cut / 8) {
+        FlowDecoder decoder(width, height);
+        CHECK(decodes(decoder, packet1, decoded));
+        std::vector<uint8_t> truncated(packet2.begin(), packet2.begin() + cut);
+        truncated.shrink_to_fit();
+        decoded = marker;
+        CHECK(!decodes(decoder, truncated, decoded));
+        CHECK(sameFlow(decoded, marker));
+        CHECK(decodes(decoder, packet3, decoded));
+        CHECK(sameFlow(decoded, third));
+    }
+    for (size_t pos = sizeof(FlowPacketHeader); pos < packet2.size(); pos += 1 + pos / 16) {
+        FlowDecoder decoder(width, height);
+        CHECK(decodes(decoder, packet1, decoded));
+        std::vector<uint8_t> corrupt = packet2;
+        corrupt[pos] ^= 0xa5;
+        decoded = marker;
+        if (!decodes(decoder, corrupt, decoded)) {
+            CHECK(sameFlow(decoded, marker));
+            CHECK(decodes(decoder, packet3, decoded));
+            CHECK(sameFlow(decoded, third));
+        }
+    }
+}
+
+int main() {
+    srand(1);
+    const uint32_t sizes[][2] = { { 1, 1 }, { 3, 17 }, { 33, 5 }, { 7, 33 }, { 120, 68 }, { 17, 16 } };
+    ThreadPool pool(3);
+    for (const uint32_t* size : sizes) {
+        testRoundTrip(size[0], size[1], nullptr);
+        testRoundTrip(size[0], size[1], &pool);
+    }
+    testCorrupt(33, 37);
+    testCorrupt(5, 3);
+    return TEST_RESULT;
+}
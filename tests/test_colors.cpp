@@ -0,0 +1,285 @@
+// Colorization of flow grids: the single pass postProcessVectors against the earlier two pass version that
+// converted the grid to floats and divided every component by the largest magnitude, the colorization
+// kernels against ComputeColor, and the pooled runs against the serial ones.
+#include "flowcolor.h"
+#include "threadpool.h"
+#include "check.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Largest normalized radius the last colorization produced, computed like ComputeColor does
+static float g_maxNormalized = 0.0f;
+
+// ComputeColor on every vector, the reference the other kernels are measured against
+static void colorizeReference(const NV_OF_FLOW_VECTOR* flow, uint8_t* output, uint32_t count, float scale)
+{
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        float fx = flow[n].flowx * scale;
+        float fy = flow[n].flowy * scale;
+        g_maxNormalized = std::max(g_maxNormalized, sqrtf(fx * fx + fy * fy));
+        ComputeColor(fx, fy, output + 3 * n);
+    }
+}
+
+// The two pass version: (fx / 32) / maxrad with maxrad from sqrt(fx * fx + fy * fy) in pixels.
+// Returns how many of its vectors the rounding pushed outside of the unit disk, they are flagged in outside.
+static uint32_t postProcessTwoPass(const NV_OF_FLOW_VECTOR* flow, uint8_t* output, uint32_t count, std::vector<bool>& outside)
+{
+    std::vector<float> flowvec(2 * count);
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        flowvec[2 * n] = flow[n].flowx / 32.0f;
+        flowvec[2 * n + 1] = flow[n].flowy / 32.0f;
+    }
+    float maxrad = -1.0f;
+    for (uint32_t n = 0; n < count; ++n)
+        maxrad = std::max(maxrad, (float)sqrt(flowvec[2 * n] * flowvec[2 * n] + flowvec[2 * n + 1] * flowvec[2 * n + 1]));
+    maxrad = std::max(maxrad, 1.0f);
+
+    uint32_t num = 0;
+    outside.assign(count, false);
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        float fx = flowvec[2 * n] / maxrad;
+        float fy = flowvec[2 * n + 1] / maxrad;
+        ComputeColor(fx, fy, output + 3 * n);
+        if (sqrtf(fx * fx + fy * fy) > 1.0f)
+        {
+            outside[n] = true;
+            ++num;
+        }
+    }
+    return num;
+}
+
+static void randomFlow(std::vector<NV_OF_FLOW_VECTOR>& flow, int range)
+{
+    for (size_t n = 0; n < flow.size(); ++n)
+    {
+        flow[n].flowx = (int16_t)(rand() % (2 * range + 1) - range);
+        flow[n].flowy = (int16_t)(rand() % (2 * range + 1) - range);
+    }
+}
+
+// The scale folded into one reciprocal and the magnitude reduced in integer S10.5 units round differently
+// from the two pass version, so the colors are not bit-identical: they are within 1 per channel wherever the
+// two pass version kept the vector inside the unit disk. Where its rounding pushed the largest vector out,
+// ComputeColor darkened it by a quarter; the single pass version never does.
+static void testSinglePass()
+{
+    const uint16_t width = 61, height = 37;
+    const int ranges[] = { 16, 200, 2000, 32767 };
+    std::vector<NV_OF_FLOW_VECTOR> flow((size_t)width * height);
+    std::vector<uint8_t> expected(3 * flow.size()), output(3 * flow.size());
+    std::vector<bool> outside;
+    int worst = 0;
+    for (int range : ranges)
+    {
+        for (int round = 0; round < 200; ++round)
+        {
+            randomFlow(flow, range);
+            postProcessTwoPass(flow.data(), expected.data(), (uint32_t)flow.size(), outside);
+            g_maxNormalized = 0.0f;
+            postProcessVectors(flow.data(), output.data(), width, height, colorizeReference);
+            CHECK(g_maxNormalized <= 1.0f);
+            for (size_t i = 0; i < expected.size(); ++i)
+            {
+                if (!outside[i / 3])
+                    worst = std::max(worst, abs((int)expected[i] - (int)output[i]));
+            }
+        }
+    }
+    CHECK(worst <= 1);
+
+    // A vector the two pass version pushes out, the single pass version keeps it inside
+    flow.assign(1, NV_OF_FLOW_VECTOR());
+    flow[0].flowx = 31268;
+    flow[0].flowy = 32223;
+    CHECK(postProcessTwoPass(flow.data(), expected.data(), 1, outside) == 1);
+    g_maxNormalized = 0.0f;
+    postProcessVectors(flow.data(), output.data(), 1, 1, colorizeReference);
+    CHECK(g_maxNormalized <= 1.0f);
+}
+
+// A grid holding a single vector is normalized by that vector itself, which must land on the circle and
+// not outside of it, for every direction and magnitude
+static void testLargestInside()
+{
+    NV_OF_FLOW_VECTOR flow;
+    uint8_t pix[3];
+    for (int fx = -32768; fx <= 32767; fx += 7)
+    {
+        for (int fy = -32768; fy <= 32767; fy += 1031)
+        {
+            flow.flowx = (int16_t)fx;
+            flow.flowy = (int16_t)fy;
+            g_maxNormalized = 0.0f;
+            postProcessVectors(&flow, pix, 1, 1, colorizeReference);
+            if (g_maxNormalized > 1.0f)
+            {
+                CHECK(g_maxNormalized <= 1.0f);
+                return;
+            }
+        }
+    }
+}
+
+// Largest per channel error of a kernel against ComputeColor over the vectors of the unit disk of the given
+// radius in S10.5 units, on a grid of step units. The rows go through the kernel in one call each.
+static int kernelError(ColorFunc colorize, int radius, int step)
+{
+    const float scale = 1.0f / radius;
+    std::vector<NV_OF_FLOW_VECTOR> row;
+    std::vector<uint8_t> expected, output;
+    int worst = 0;
+    for (int fy = -radius; fy <= radius; fy += step)
+    {
+        row.clear();
+        for (int fx = -radius; fx <= radius; fx += step)
+        {
+            if ((int64_t)fx * fx + (int64_t)fy * fy > (int64_t)radius * radius)
+                continue;
+            NV_OF_FLOW_VECTOR v;
+            v.flowx = (int16_t)fx;
+            v.flowy = (int16_t)fy;
+            row.push_back(v);
+        }
+        expected.resize(3 * row.size());
+        output.resize(3 * row.size());
+        for (size_t n = 0; n < row.size(); ++n)
+            ComputeColor(row[n].flowx * scale, row[n].flowy * scale, &expected[3 * n]);
+        colorize(row.data(), output.data(), (uint32_t)row.size(), scale);
+        for (size_t i = 0; i < expected.size(); ++i)
+            worst = std::max(worst, abs((int)expected[i] - (int)output[i]));
+    }
+    return worst;
+}
+
+// The documented error bounds of the kernels: 2 per channel for the lookup table, 1 for the AVX2 kernel
+// (selectColorKernel falls back to ComputeColor itself without AVX2). The sweep is dense at a small radius,
+// which puts several vectors into every table cell, and covers the rim of the largest S10.5 vectors.
+static void testKernelBounds()
+{
+    ColorFunc exact = selectColorKernel();
+    CHECK(kernelError(colorizeLUT, 2048, 1) <= 2);
+    CHECK(kernelError(colorizeLUT, 32767, 61) <= 2);
+    CHECK(kernelError(exact, 2048, 1) <= 1);
+    CHECK(kernelError(exact, 32767, 61) <= 1);
+    CHECK(kernelError(colorizeReference, 2048, 7) == 0);
+}
+
+// Cost grid flagging about one vector in eight above the threshold of testBanded
+static void randomCost(std::vector<uint8_t>& cost)
+{
+    for (size_t n = 0; n < cost.size(); ++n)
+        cost[n] = (uint8_t)(rand() % 8 == 0 ? 200 + rand() % 56 : rand() % 100);
+}
+
+// The pooled post processing against the serial one for every kernel, with and without cost masking, and
+// each kernel fed in odd pieces against one call over the whole grid. All of them give the same bytes.
+// The sizes leave partial vector iterations, table chunks and bands of uneven height.
+static void testBanded()
+{
+    const uint16_t sizes[][2] = { { 61, 37 }, { 160, 90 }, { 7, 3 }, { 1, 129 } };
+    ColorFunc kernels[] = { colorizeLUT, selectColorKernel(), colorizeReference };
+    ThreadPool pool(5);
+    for (const uint16_t* size : sizes)
+    {
+        const uint16_t width = size[0], height = size[1];
+        const size_t count = (size_t)width * height;
+        std::vector<NV_OF_FLOW_VECTOR> flow(count), masked(count), pooledmasked(count);
+        std::vector<uint8_t> cost(count), serial(3 * count), pooled(3 * count);
+        randomFlow(flow, 3000);
+        randomCost(cost);
+        for (ColorFunc colorize : kernels)
+        {
+            postProcessVectors(flow.data(), serial.data(), width, height, colorize);
+            postProcessVectors(flow.data(), pooled.data(), width, height, colorize, &pool);
+            CHECK(serial == pooled);
+
+            for (CostMask mask : { COST_MASK_ZERO, COST_MASK_FLAG })
+            {
+                masked = flow;
+                pooledmasked = flow;
+                postProcessVectors(masked.data(), cost.data(), 150, mask, serial.data(), width, height, colorize);
+                postProcessVectors(pooledmasked.data(), cost.data(), 150, mask, pooled.data(), width, height, colorize, &pool);
+                CHECK(serial == pooled);
+                CHECK(memcmp(masked.data(), pooledmasked.data(), count * sizeof(NV_OF_FLOW_VECTOR)) == 0);
+            }
+
+            const float scale = 1.0f / 3000.0f;
+            colorize(flow.data(), serial.data(), (uint32_t)count, scale);
+            for (size_t first = 0; first < count;)
+            {
+                size_t num = std::min(count - first, (size_t)(1 + rand() % 19));
+                colorize(flow.data() + first, pooled.data() + 3 * first, (uint32_t)num, scale);
+                first += num;
+            }
+            CHECK(serial == pooled);
+        }
+    }
+}
+
+// A few masked vectors far outside of the radius of the rest, in every direction. Left out of the normalization
+// they land well outside of the unit disk, where every kernel still has to produce some color before the flagged
+// pixels are blacked out. The other pixels come out as if the outliers were still vectors, and zeroing them
+// instead gives the grid with still vectors in their place.
+static void testMaskedOutliers()
+{
+    const uint16_t width = 61, height = 37;
+    const size_t count = (size_t)width * height;
+    const int16_t outliers[][2] = { { -30000, -30000 }, { -32768, 0 }, { 0, -32768 }, { 32767, 32767 },
+                                    { -32768, 32767 }, { 32767, -32768 }, { 20000, -1 } };
+    std::vector<NV_OF_FLOW_VECTOR> flow(count), still, masked(count);
+    std::vector<uint8_t> cost(count, 0), expected(3 * count), output(3 * count);
+    randomFlow(flow, 300);
+    still = flow;
+    for (size_t k = 0; k < sizeof(outliers) / sizeof(outliers[0]); ++k)
+    {
+        size_t n = (k * 331 + 17) % count;
+        flow[n].flowx = outliers[k][0];
+        flow[n].flowy = outliers[k][1];
+        still[n].flowx = still[n].flowy = 0;
+        cost[n] = 255;
+    }
+
+    ColorFunc kernels[] = { colorizeLUT, selectColorKernel(), colorizeReference };
+    ThreadPool pool(3);
+    for (ColorFunc colorize : kernels)
+    {
+        for (ThreadPool* p : { (ThreadPool*)nullptr, &pool })
+        {
+            postProcessVectors(still.data(), expected.data(), width, height, colorize);
+            masked = flow;
+            postProcessVectors(masked.data(), cost.data(), 200, COST_MASK_FLAG, output.data(), width, height, colorize, p);
+            for (size_t n = 0; n < count; ++n)
+            {
+                if (cost[n])
+                    CHECK(output[3 * n] == 0 && output[3 * n + 1] == 0 && output[3 * n + 2] == 0);
+                else
+                    CHECK(memcmp(&output[3 * n], &expected[3 * n], 3) == 0);
+            }
+
+            masked = flow;
+            postProcessVectors(masked.data(), cost.data(), 200, COST_MASK_ZERO, output.data(), width, height, colorize, p);
+            CHECK(output == expected);
+            CHECK(memcmp(masked.data(), still.data(), count * sizeof(NV_OF_FLOW_VECTOR)) == 0);
+        }
+    }
+}
+
+int main()
+{
+    srand(1);
+    MakeColorWheel();
+    testSinglePass();
+    testLargestInside();
+    testKernelBounds();
+    testBanded();
+    testMaskedOutliers();
+    return TEST_RESULT;
+}
@@ -0,0 +1,47 @@
+// CPU engines at the edge of their frame size: frames smaller than the matched window or the coarsest level
+// are rejected when the engine is created, the smallest accepted frames compute without leaving the images.
+#include "blockmatch.h"
+#include "lucaskanade.h"
+#include "flowsession.h"
+#include "check.h"
+#include <stdexcept>
+#include <vector>
+
+template <typename Backend>
+static bool rejects(uint32_t width, uint32_t height) {
+    try {
+        Backend backend(initializeOFParameters(width, height, 4, NV_OF_BUFFER_FORMAT_GRAYSCALE8), 2);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+template <typename Backend>
+static void computeSmallest(uint32_t width, uint32_t height) {
+    Backend backend(initializeOFParameters(width, height, 4, NV_OF_BUFFER_FORMAT_GRAYSCALE8), 2);
+    std::vector<uint8_t> frame1((size_t)width * height), frame2(frame1.size());
+    for (size_t i = 0; i < frame1.size(); ++i)
+    {
+        frame1[i] = (uint8_t)(i * 37);
+        frame2[i] = (uint8_t)(i * 37 + 11);
+    }
+    std::vector<NV_OF_FLOW_VECTOR> flow((size_t)backend.getOutputWidth() * backend.getOutputHeight());
+    CHECK(!backend.compute(frame1.data(), flow.data()));
+    CHECK(backend.compute(frame2.data(), flow.data()));
+}
+
+int main() {
+    CHECK(rejects<BlockMatchBackend>(BM_BLOCK_SIZE - 1, 64));
+    CHECK(rejects<BlockMatchBackend>(64, 4));
+    CHECK(!rejects<BlockMatchBackend>(BM_BLOCK_SIZE, BM_BLOCK_SIZE));
+    CHECK(rejects<LucasKanadeBackend>(LK_MIN_LEVEL_SIZE - 1, 64));
+    CHECK(rejects<LucasKanadeBackend>(64, 8));
+    CHECK(!rejects<LucasKanadeBackend>(LK_MIN_LEVEL_SIZE, LK_MIN_LEVEL_SIZE));
+
+    computeSmallest<BlockMatchBackend>(BM_BLOCK_SIZE, BM_BLOCK_SIZE);
+    computeSmallest<BlockMatchBackend>(BM_BLOCK_SIZE + 3, BM_BLOCK_SIZE + 5);
+    computeSmallest<LucasKanadeBackend>(LK_MIN_LEVEL_SIZE, LK_MIN_LEVEL_SIZE);
+    computeSmallest<LucasKanadeBackend>(LK_MIN_LEVEL_SIZE + 3, LK_MIN_LEVEL_SIZE + 1);
+    return TEST_RESULT;
+}
@@ -0,0 +1,110 @@
+// Flow archives written by FlowArchiveWriter and read back in place by FlowArchiveReader, including a
+// reader tailing a growing archive and archives whose index or payloads were truncated or corrupted.
+#include "flowarchive.h"
+#include "check.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdexcept>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#define TEST_WIDTH 7
+#define TEST_HEIGHT 5
+#define TEST_FRAMES 5
+
+static std::vector<NV_OF_FLOW_VECTOR> makeFlow(uint32_t frame) {
+    std::vector<NV_OF_FLOW_VECTOR> flow(TEST_WIDTH * TEST_HEIGHT);
+    for (size_t i = 0; i < flow.size(); ++i) {
+        flow[i].flowx = (int16_t)(i * 3 + frame);
+        flow[i].flowy = (int16_t)(frame * 100 - i);
+    }
+    return flow;
+}
+
+static bool matches(const NV_OF_FLOW_VECTOR* grid, uint32_t frame) {
+    return grid && memcmp(grid, makeFlow(frame).data(), TEST_WIDTH * TEST_HEIGHT * sizeof(NV_OF_FLOW_VECTOR)) == 0;
+}
+
+static void writeAt(const std::string& path, const void* data, size_t size, off_t offset) {
+    int fd = open(path.c_str(), O_WRONLY);
+    CHECK(fd >= 0 && pwrite(fd, data, size, offset) == (ssize_t)size);
+    close(fd);
+}
+
+static uint64_t readAt(const std::string& path, off_t offset) {
+    uint64_t value = 0;
+    int fd = open(path.c_str(), O_RDONLY);
+    CHECK(fd >= 0 && pread(fd, &value, sizeof(value), offset) == (ssize_t)sizeof(value));
+    close(fd);
+    return value;
+}
+
+int main() {
+    char dir[] = "/tmp/ofvec_testXXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    const std::string path = std::string(dir) + "/flow.nvfa";
+
+    {
+        FlowArchiveWriter writer(path, TEST_WIDTH, TEST_HEIGHT, 4);
+        writer.append(makeFlow(0).data());
+        FlowArchiveReader reader(path);
+        CHECK(reader.getNumFrames() == 1);
+        CHECK(matches(reader.frame(0), 0));
+        CHECK(reader.frame(1) == nullptr);
+        // Frames appended later show up after a refresh
+        for (uint32_t i = 1; i < TEST_FRAMES; ++i)
+            writer.append(makeFlow(i).data());
+        CHECK(reader.refresh() == TEST_FRAMES);
+        for (uint32_t i = 0; i < TEST_FRAMES; ++i)
+            CHECK(matches(reader.frame(i), i));
+    }
+
+    const uint64_t block = readAt(path, offsetof(FlowArchiveHeader, blocks));
+    const uint64_t last = readAt(path, block + (TEST_FRAMES - 1) * sizeof(uint64_t));
+    const uint64_t framebytes = TEST_WIDTH * TEST_HEIGHT * sizeof(NV_OF_FLOW_VECTOR);
+
+    // A truncated last payload
+    CHECK(truncate(path.c_str(), (off_t)(last + framebytes - 1)) == 0);
+    {
+        FlowArchiveReader reader(path);
+        CHECK(reader.getNumFrames() == TEST_FRAMES);
+        CHECK(matches(reader.frame(TEST_FRAMES - 2), TEST_FRAMES - 2));
+        CHECK(reader.frame(TEST_FRAMES - 1) == nullptr);
+    }
+
+    // Index entries pointing past the end, off the alignment or at the header
+    const uint64_t entries[] = { last + (1ull << 40), ~0ull - 7, last + 8, 0 };
+    for (uint64_t entry : entries) {
+        writeAt(path, &entry, sizeof(entry), block + sizeof(uint64_t));
+        FlowArchiveReader reader(path);
+        CHECK(reader.frame(1) == nullptr);
+        CHECK(matches(reader.frame(0), 0));
+    }
+
+    // An index block pointing past the end, and a frame count beyond the index blocks
+    const uint64_t badblock = 1ull << 40;
+    writeAt(path, &badblock, sizeof(badblock), offsetof(FlowArchiveHeader, blocks));
+    const uint64_t numframes = (uint64_t)FLOW_ARCHIVE_INDEX_ENTRIES * FLOW_ARCHIVE_MAX_BLOCKS + 10;
+    writeAt(path, &numframes, sizeof(numframes), offsetof(FlowArchiveHeader, numframes));
+    {
+        FlowArchiveReader reader(path);
+        CHECK(reader.frame(0) == nullptr);
+        CHECK(reader.frame(numframes - 1) == nullptr);
+    }
+
+    // A header whose payload size does not match its grid is not an archive
+    const uint64_t badbytes = framebytes * 2;
+    writeAt(path, &badbytes, sizeof(badbytes), offsetof(FlowArchiveHeader, framebytes));
+    bool rejected = false;
+    try {
+        FlowArchiveReader reader(path);
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+
+    unlink(path.c_str());
+    rmdir(dir);
+    return TEST_RESULT;
+}
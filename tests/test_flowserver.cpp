@@ -0,0 +1,135 @@
+// FlowServer on the block matching engine: a FlowClient gets its flow through the sealed shared buffer, and
+// buffers the server must not map (not sealed against shrinking, shorter than claimed, not a memfd) are
+// turned down with an error reply instead of crashing the server on a later access.
+#include "flowserver.h"
+#include "flowclient.h"
+#include "imgproc.h"
+#include "check.h"
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+#define TEST_WIDTH 64
+#define TEST_HEIGHT 48
+#define TEST_GRID 4
+
+static std::string g_path;
+
+// Connects a raw socket to the server, retrying while it starts up
+static int connectServer() {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, g_path.c_str());
+    for (int attempt = 0; attempt < 500; ++attempt) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0)
+            return fd;
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+// Sends one request with the buffer attached and returns the reply status, the error ends up in message
+static int32_t requestWith(int buffer, uint64_t buffersize, std::string& message) {
+    int socket = connectServer();
+    CHECK(socket >= 0);
+    FlowRequest request;
+    memset(&request, 0, sizeof(request));
+    memcpy(request.magic, "NVRQ", 4);
+    request.id = 7;
+    request.flags = FLOW_REQUEST_BUFFER;
+    request.format = NV_OF_BUFFER_FORMAT_GRAYSCALE8;
+    request.width = TEST_WIDTH;
+    request.height = TEST_HEIGHT;
+    request.gridsize = TEST_GRID;
+    request.buffersize = buffersize;
+    request.frame2 = TEST_WIDTH * TEST_HEIGHT;
+    request.flow = 2 * TEST_WIDTH * TEST_HEIGHT;
+    FlowReply reply;
+    int fd = -1;
+    CHECK(sendMessage(socket, &request, sizeof(request), buffer));
+    CHECK(receiveMessage(socket, &reply, sizeof(reply), fd));
+    close(socket);
+    reply.error[FLOW_ERROR_SIZE - 1] = 0;
+    message = reply.error;
+    return reply.status;
+}
+
+int main() {
+    char dir[] = "/tmp/ofvec_testXXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    g_path = std::string(dir) + "/flow.sock";
+
+    FlowServer server("blockmatch", 2, nullptr, nullptr, nullptr);
+    std::thread serving([&]() {
+        try {
+            server.run(g_path);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+        }
+    });
+    int wait = connectServer();
+    CHECK(wait >= 0);
+    close(wait);
+
+    // A regular client, its buffer is sealed
+    {
+        FlowClient client(g_path);
+        client.configure(NV_OF_BUFFER_FORMAT_GRAYSCALE8, TEST_WIDTH, TEST_HEIGHT, TEST_GRID);
+        std::vector<uint8_t> frame((size_t)TEST_WIDTH * TEST_HEIGHT);
+        for (size_t i = 0; i < frame.size(); ++i)
+            frame[i] = (uint8_t)rand();
+        memcpy(client.getFrame1(), frame.data(), frame.size());
+        memcpy(client.getFrame2(), frame.data(), frame.size());
+        const NV_OF_FLOW_VECTOR* flow = client.compute();
+        CHECK(flow != nullptr && client.getOutputWidth() == TEST_WIDTH / TEST_GRID);
+        // Identical frames move by less than a pixel, whatever the sub-pixel fit makes of the noise
+        for (uint32_t i = 0; flow && i < client.getOutputWidth() * client.getOutputHeight(); ++i)
+            CHECK(abs(flow[i].flowx) < 32 && abs(flow[i].flowy) < 32);
+    }
+
+    const size_t size = 3 * TEST_WIDTH * TEST_HEIGHT;
+    std::string message;
+
+    // Not sealed, the client could shrink it at any time
+    int unsealed = memfd_create("unsealed", MFD_CLOEXEC);
+    CHECK(ftruncate(unsealed, (off_t)size) == 0);
+    CHECK(requestWith(unsealed, size, message) != 0);
+    CHECK(message.find("sealed") != std::string::npos);
+    close(unsealed);
+
+    // Sealed, but shorter than the size it comes with
+    int shortfd = memfd_create("short", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    CHECK(ftruncate(shortfd, (off_t)size / 2) == 0 && fcntl(shortfd, F_ADD_SEALS, F_SEAL_SHRINK) == 0);
+    CHECK(requestWith(shortfd, size, message) != 0);
+    CHECK(message.find("smaller") != std::string::npos);
+    close(shortfd);
+
+    // Not a memfd at all
+    std::string filepath = std::string(dir) + "/buffer";
+    int file = open(filepath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    CHECK(ftruncate(file, (off_t)size) == 0);
+    CHECK(requestWith(file, size, message) != 0);
+    close(file);
+    unlink(filepath.c_str());
+
+    // A sealed buffer of the right size still works after the rejected ones
+    int sealed = memfd_create("sealed", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    CHECK(ftruncate(sealed, (off_t)size) == 0 && fcntl(sealed, F_ADD_SEALS, F_SEAL_SHRINK) == 0);
+    CHECK(requestWith(sealed, size, message) == 0);
+    close(sealed);
+
+    server.stop();
+    serving.join();
+    rmdir(dir);
+    return TEST_RESULT;
+}
@@ -0,0 +1,154 @@
+// Shared memory ring between FlowShmPublisher and FlowShmReader: frames are pending until published and ready
+// in place after, a reader lapped by the publisher sees the overrun, wait() returns on publish, close and timeout,
+// and a second publisher under the same name leaves the first ring and its readers alone.
+#include "flowshm.h"
+#include "check.h"
+#include <chrono>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define TEST_WIDTH 13
+#define TEST_HEIGHT 5
+#define TEST_SLOTS 4
+
+static const size_t g_count = (size_t)TEST_WIDTH * TEST_HEIGHT;
+
+// Flow grid and visualization of frame n, every vector and pixel derived from n
+static void makeFrame(uint64_t n, std::vector<NV_OF_FLOW_VECTOR>& flow, std::vector<uint8_t>& visual) {
+    flow.resize(g_count);
+    visual.resize(3 * g_count);
+    for (size_t i = 0; i < g_count; ++i) {
+        flow[i].flowx = (int16_t)(n * 100 + i);
+        flow[i].flowy = (int16_t)-(int16_t)(n * 100 + i);
+    }
+    for (size_t i = 0; i < visual.size(); ++i)
+        visual[i] = (uint8_t)(n * 7 + i);
+}
+
+// Whether frame n is ready in the reader and holds what makeFrame gave the publisher
+static bool holdsFrame(FlowShmReader& reader, uint64_t n) {
+    std::vector<NV_OF_FLOW_VECTOR> flow;
+    std::vector<uint8_t> visual;
+    makeFrame(n, flow, visual);
+    const NV_OF_FLOW_VECTOR* flowdata = nullptr;
+    const uint8_t* visualdata = nullptr;
+    return reader.acquire(n, flowdata, visualdata) == FLOW_SHM_READY &&
+           memcmp(flowdata, flow.data(), g_count * sizeof(NV_OF_FLOW_VECTOR)) == 0 &&
+           visualdata != nullptr && memcmp(visualdata, visual.data(), visual.size()) == 0 && reader.validate(n);
+}
+
+static void publishFrame(FlowShmPublisher& publisher, uint64_t n) {
+    std::vector<NV_OF_FLOW_VECTOR> flow;
+    std::vector<uint8_t> visual;
+    makeFrame(n, flow, visual);
+    publisher.publish(flow.data(), visual.data());
+}
+
+static int elapsedMs(std::chrono::steady_clock::time_point start) {
+    return (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Pending, ready, overrun after a lap, and validate() failing on a frame lapped while it was in use
+static void testRing(const std::string& name) {
+    FlowShmPublisher publisher(name, TEST_WIDTH, TEST_HEIGHT, 4, true, TEST_SLOTS);
+    FlowShmReader reader(name);
+    CHECK(reader.getWidth() == TEST_WIDTH && reader.getHeight() == TEST_HEIGHT && reader.getGridSize() == 4);
+    CHECK(reader.getNumSlots() == TEST_SLOTS && reader.hasVisual());
+    CHECK(reader.getPublished() == 0 && !reader.isClosed());
+
+    const NV_OF_FLOW_VECTOR* flowdata = nullptr;
+    const uint8_t* visual = nullptr;
+    CHECK(reader.acquire(0, flowdata, visual) == FLOW_SHM_PENDING);
+    publishFrame(publisher, 0);
+    CHECK(reader.getPublished() == 1);
+    CHECK(holdsFrame(reader, 0));
+    CHECK(reader.acquire(1, flowdata, visual) == FLOW_SHM_PENDING);
+
+    // Frame 1 is acquired, then the publisher laps the ring and overwrites its slot
+    for (uint64_t n = 1; n < TEST_SLOTS; ++n)
+        publishFrame(publisher, n);
+    CHECK(reader.acquire(1, flowdata, visual) == FLOW_SHM_READY);
+    CHECK(reader.validate(1));
+    for (uint64_t n = TEST_SLOTS; n < 2 * TEST_SLOTS; ++n)
+        publishFrame(publisher, n);
+    CHECK(!reader.validate(1));
+    for (uint64_t n = 0; n < TEST_SLOTS; ++n)
+        CHECK(reader.acquire(n, flowdata, visual) == FLOW_SHM_OVERRUN);
+    for (uint64_t n = TEST_SLOTS; n < 2 * TEST_SLOTS; ++n)
+        CHECK(holdsFrame(reader, n));
+    CHECK(reader.acquire(2 * TEST_SLOTS, flowdata, visual) == FLOW_SHM_PENDING);
+}
+
+// wait() times out without a publish, returns true on one and false once the publisher is gone
+static void testWait(const std::string& name) {
+    FlowShmPublisher* publisher = new FlowShmPublisher(name, TEST_WIDTH, TEST_HEIGHT, 4, false, TEST_SLOTS);
+    FlowShmReader reader(name);
+    CHECK(!reader.hasVisual());
+
+    auto start = std::chrono::steady_clock::now();
+    CHECK(!reader.wait(0, 100));
+    CHECK(elapsedMs(start) >= 90);
+
+    std::vector<NV_OF_FLOW_VECTOR> flow(g_count);
+    std::thread publishing([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        publisher->publish(flow.data(), nullptr);
+    });
+    start = std::chrono::steady_clock::now();
+    CHECK(reader.wait(0, 10000));
+    CHECK(elapsedMs(start) < 5000);
+    publishing.join();
+    CHECK(reader.wait(0, 0));
+
+    std::thread closing([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        delete publisher;
+    });
+    start = std::chrono::steady_clock::now();
+    CHECK(!reader.wait(1, 10000));
+    CHECK(elapsedMs(start) < 5000);
+    closing.join();
+    CHECK(reader.isClosed());
+}
+
+// A second publisher under the name gets a fresh object while the first keeps publishing into its own,
+// closing the first one leaves the name to the second, closing the second frees it
+static void testReplace(const std::string& name) {
+    FlowShmPublisher* first = new FlowShmPublisher(name, TEST_WIDTH, TEST_HEIGHT, 4, true, TEST_SLOTS);
+    FlowShmReader oldreader(name);
+    publishFrame(*first, 0);
+    {
+        FlowShmPublisher second(name, TEST_WIDTH, TEST_HEIGHT, 4, true, 2 * TEST_SLOTS);
+        FlowShmReader newreader(name);
+        CHECK(newreader.getNumSlots() == 2 * TEST_SLOTS && newreader.getPublished() == 0);
+
+        CHECK(holdsFrame(oldreader, 0));
+        publishFrame(*first, 1);
+        CHECK(holdsFrame(oldreader, 1));
+        CHECK(newreader.getPublished() == 0);
+        delete first;
+        CHECK(oldreader.isClosed());
+
+        FlowShmReader later(name);
+        CHECK(later.getNumSlots() == 2 * TEST_SLOTS && !later.isClosed());
+    }
+    bool thrown = false;
+    try {
+        FlowShmReader gone(name);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+int main() {
+    const std::string name = "/ofvec_test_" + std::to_string(getpid());
+    testRing(name);
+    testWait(name);
+    testReplace(name);
+    return TEST_RESULT;
+}
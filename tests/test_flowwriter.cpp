@@ -0,0 +1,60 @@
+// FlowWriter file naming: the first %d or %0Nd of the path numbers per frame files, every other % is taken
+// literally, and a path without a conversion gets all frames appended to one file.
+#include "flowwriter.h"
+#include "check.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#define TEST_WIDTH 5
+#define TEST_HEIGHT 3
+#define TEST_FRAMES 3
+
+static const size_t FRAME_BYTES = sizeof(FlowFrameHeader) + TEST_WIDTH * TEST_HEIGHT * sizeof(NV_OF_FLOW_VECTOR);
+
+static std::string g_dir;
+
+// Writes TEST_FRAMES raw frames to pattern inside the test directory
+static void writeFrames(const std::string& pattern) {
+    std::vector<NV_OF_FLOW_VECTOR> flow(TEST_WIDTH * TEST_HEIGHT);
+    FlowWriter writer(g_dir + "/" + pattern, FLOW_FILE_RAW, TEST_WIDTH, TEST_HEIGHT, 4);
+    for (uint32_t i = 0; i < TEST_FRAMES; ++i)
+        writer.write(flow.data());
+    writer.close();
+}
+
+// Size of a file in the test directory, which is removed, or -1 if it does not exist
+static long takeFile(const std::string& name) {
+    std::string path = g_dir + "/" + name;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return -1;
+    unlink(path.c_str());
+    return (long)info.st_size;
+}
+
+int main() {
+    char dir[] = "/tmp/ofvec_testXXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    g_dir = dir;
+
+    writeFrames("flow_%03d.raw");
+    CHECK(takeFile("flow_000.raw") == (long)FRAME_BYTES);
+    CHECK(takeFile("flow_002.raw") == (long)FRAME_BYTES);
+    CHECK(takeFile("flow_001.raw") == (long)FRAME_BYTES);
+
+    // Conversions other than the frame number stay in the name, as do the ones after it
+    writeFrames("%s%n_%5d_%x_%d_%d.raw");
+    CHECK(takeFile("%s%n_%5d_%x_0_%d.raw") == (long)FRAME_BYTES);
+    CHECK(takeFile("%s%n_%5d_%x_2_%d.raw") == (long)FRAME_BYTES);
+    CHECK(takeFile("%s%n_%5d_%x_1_%d.raw") == (long)FRAME_BYTES);
+
+    // Without a conversion every frame goes into the one file
+    writeFrames("100%_%s.raw");
+    CHECK(takeFile("100%_%s.raw") == (long)(TEST_FRAMES * FRAME_BYTES));
+    writeFrames("flow_%.raw");
+    CHECK(takeFile("flow_%.raw") == (long)(TEST_FRAMES * FRAME_BYTES));
+
+    rmdir(dir);
+    return TEST_RESULT;
+}
@@ -0,0 +1,57 @@
+// FrameSkipper decisions: the same change per color or luma byte is judged the same in every format, the
+// alpha of ABGR frames does not count, and the stride mode computes every stride-th pair.
+#include "frameskip.h"
+#include "imgproc.h"
+#include "check.h"
+#include <string.h>
+#include <vector>
+
+#define TEST_WIDTH 53
+#define TEST_HEIGHT 41
+
+// Frame of the format whose color or luma bytes are level, ABGR alpha is alpha
+static std::vector<uint8_t> makeFrame(NV_OF_BUFFER_FORMAT format, uint8_t level, uint8_t alpha = 255) {
+    std::vector<uint8_t> frame(frameSize(format, TEST_WIDTH, TEST_HEIGHT), level);
+    if (format == NV_OF_BUFFER_FORMAT_ABGR8) {
+        for (size_t i = 0; i < frame.size(); i += 4)
+            frame[i] = alpha;
+    }
+    return frame;
+}
+
+// Action taken on a frame of level after one of base, at the given threshold
+static FrameAction afterChange(NV_OF_BUFFER_FORMAT format, float threshold, uint8_t base, uint8_t level,
+                               uint8_t alpha = 255) {
+    FrameSkipper skipper(format, TEST_WIDTH, TEST_HEIGHT, threshold, 1);
+    CHECK(skipper.classify(makeFrame(format, base).data()) == FRAME_COMPUTE);
+    return skipper.classify(makeFrame(format, level, alpha).data());
+}
+
+int main() {
+    const NV_OF_BUFFER_FORMAT formats[] = { NV_OF_BUFFER_FORMAT_ABGR8, NV_OF_BUFFER_FORMAT_NV12,
+                                            NV_OF_BUFFER_FORMAT_GRAYSCALE8 };
+    for (NV_OF_BUFFER_FORMAT format : formats) {
+        // A change of 3 levels in every byte is static below a threshold of 3 and moving from 3 on
+        CHECK(afterChange(format, 3.5f, 100, 103) == FRAME_STATIC);
+        CHECK(afterChange(format, 3.0f, 100, 103) == FRAME_COMPUTE);
+        CHECK(afterChange(format, 2.5f, 100, 97) == FRAME_COMPUTE);
+    }
+    // Alpha changes alone are not motion
+    CHECK(afterChange(NV_OF_BUFFER_FORMAT_ABGR8, 0.5f, 100, 100, 0) == FRAME_STATIC);
+
+    // Static frames keep the reference, so slow drift adds up until it counts
+    FrameSkipper drift(NV_OF_BUFFER_FORMAT_ABGR8, TEST_WIDTH, TEST_HEIGHT, 2.5f, 1);
+    CHECK(drift.classify(makeFrame(NV_OF_BUFFER_FORMAT_ABGR8, 100).data()) == FRAME_COMPUTE);
+    CHECK(drift.classify(makeFrame(NV_OF_BUFFER_FORMAT_ABGR8, 101).data()) == FRAME_STATIC);
+    CHECK(drift.classify(makeFrame(NV_OF_BUFFER_FORMAT_ABGR8, 102).data()) == FRAME_STATIC);
+    CHECK(drift.classify(makeFrame(NV_OF_BUFFER_FORMAT_ABGR8, 103).data()) == FRAME_COMPUTE);
+    CHECK(drift.getStaticFrames() == 2);
+
+    FrameSkipper strided(NV_OF_BUFFER_FORMAT_GRAYSCALE8, TEST_WIDTH, TEST_HEIGHT, 0.0f, 3);
+    const FrameAction expected[] = { FRAME_COMPUTE, FRAME_COMPUTE, FRAME_ADVANCE, FRAME_ADVANCE, FRAME_COMPUTE };
+    std::vector<uint8_t> frame = makeFrame(NV_OF_BUFFER_FORMAT_GRAYSCALE8, 0);
+    for (FrameAction action : expected)
+        CHECK(strided.classify(frame.data()) == action);
+    CHECK(strided.getStridedFrames() == 2);
+    return TEST_RESULT;
+}
@@ -0,0 +1,132 @@
+// Raw frame files read through MappedFrameSource: .abgr frames are handed out in place, .rgba frames hold
+// the same pixels with their bytes reversed and come out of read() as the same ABGR8 frames. y4m files hand
+// out the luma plane of every frame for the 8 bit colorspaces and are refused for the others.
+#include "framesource.h"
+#include "imgproc.h"
+#include "check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#define TEST_WIDTH 37
+#define TEST_HEIGHT 5
+#define TEST_FRAMES 3
+
+static void writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    FILE* file = fopen(path.c_str(), "wb");
+    CHECK(file != nullptr);
+    if (file) {
+        CHECK(fwrite(data.data(), 1, data.size(), file) == data.size());
+        fclose(file);
+    }
+}
+
+// y4m file of TEST_FRAMES frames in colorspace (none for no C tag), chroma bytes per frame after the luma,
+// every luma plane filled with the frame number
+static std::vector<uint8_t> makeY4M(const char* colorspace, size_t chroma) {
+    std::string header = "YUV4MPEG2 W" + std::to_string(TEST_WIDTH) + " H" + std::to_string(TEST_HEIGHT) + " F30:1";
+    if (colorspace)
+        header += std::string(" C") + colorspace;
+    header += " A1:1\n";
+    std::vector<uint8_t> data(header.begin(), header.end());
+    for (uint32_t i = 0; i < TEST_FRAMES; ++i) {
+        const char marker[] = "FRAME\n";
+        data.insert(data.end(), marker, marker + 6);
+        data.insert(data.end(), (size_t)TEST_WIDTH * TEST_HEIGHT, (uint8_t)(i + 1));
+        data.insert(data.end(), chroma, (uint8_t)0x80);
+    }
+    return data;
+}
+
+// Every 8 bit colorspace gives all of its frames, the deeper ones and the alpha one are refused
+static void testY4M(const std::string& dir) {
+    const size_t luma = (size_t)TEST_WIDTH * TEST_HEIGHT;
+    const size_t quarter = (size_t)((TEST_WIDTH + 1) / 2) * ((TEST_HEIGHT + 1) / 2);
+    const size_t half = (size_t)((TEST_WIDTH + 1) / 2) * TEST_HEIGHT;
+    const struct { const char* colorspace; size_t chroma; } accepted[] = {
+        { nullptr, 2 * quarter }, { "420", 2 * quarter }, { "420jpeg", 2 * quarter }, { "420mpeg2", 2 * quarter },
+        { "420paldv", 2 * quarter }, { "422", 2 * half }, { "444", 2 * luma }, { "mono", 0 }
+    };
+    const std::string path = dir + "/frames.y4m";
+    for (const auto& c : accepted) {
+        writeFile(path, makeY4M(c.colorspace, c.chroma));
+        MappedFrameSource source(path, 0, 0);
+        CHECK(source.getWidth() == TEST_WIDTH && source.getHeight() == TEST_HEIGHT);
+        CHECK(source.getFormat() == NV_OF_BUFFER_FORMAT_GRAYSCALE8);
+        for (uint32_t i = 0; i < TEST_FRAMES; ++i) {
+            const uint8_t* frame = source.next();
+            CHECK(frame != nullptr && frame[0] == i + 1 && frame[luma - 1] == i + 1);
+        }
+        CHECK(source.next() == nullptr);
+    }
+
+    const char* refused[] = { "420p10", "422p12", "444p16", "444alpha", "mono16", "411" };
+    for (const char* colorspace : refused) {
+        writeFile(path, makeY4M(colorspace, 2 * luma));
+        bool thrown = false;
+        try {
+            MappedFrameSource source(path, 0, 0);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+    unlink(path.c_str());
+}
+
+int main() {
+    // The same frames as A, B, G, R and as R, G, B, A bytes
+    const size_t framesize = (size_t)TEST_WIDTH * TEST_HEIGHT * 4;
+    std::vector<uint8_t> abgr(framesize * TEST_FRAMES), rgba(abgr.size());
+    for (size_t i = 0; i < abgr.size(); i += 4) {
+        abgr[i] = 255;
+        abgr[i + 1] = (uint8_t)rand();
+        abgr[i + 2] = (uint8_t)rand();
+        abgr[i + 3] = (uint8_t)rand();
+        rgba[i] = abgr[i + 3];
+        rgba[i + 1] = abgr[i + 2];
+        rgba[i + 2] = abgr[i + 1];
+        rgba[i + 3] = abgr[i];
+    }
+
+    // Every pixel count around the four pixel vector iterations
+    std::vector<uint8_t> swizzled(abgr.size());
+    for (size_t count = 0; count <= 9; ++count) {
+        memset(swizzled.data(), 0, swizzled.size());
+        swizzleRGBAtoABGR(rgba.data(), swizzled.data(), count);
+        CHECK(memcmp(swizzled.data(), abgr.data(), 4 * count) == 0);
+        CHECK(swizzled[4 * count] == 0);
+    }
+
+    char dir[] = "/tmp/ofvec_testXXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    const std::string abgrpath = std::string(dir) + "/frames.abgr";
+    const std::string rgbapath = std::string(dir) + "/frames.RGBA";
+    writeFile(abgrpath, abgr);
+    writeFile(rgbapath, rgba);
+    {
+        MappedFrameSource abgrsource(abgrpath, TEST_WIDTH, TEST_HEIGHT);
+        MappedFrameSource rgbasource(rgbapath, TEST_WIDTH, TEST_HEIGHT);
+        CHECK(abgrsource.isMapped());
+        CHECK(!rgbasource.isMapped());
+        CHECK(rgbasource.getFormat() == NV_OF_BUFFER_FORMAT_ABGR8);
+
+        std::vector<uint8_t> frame(framesize);
+        for (uint32_t i = 0; i < TEST_FRAMES; ++i) {
+            const uint8_t* mapped = abgrsource.next();
+            CHECK(mapped != nullptr && memcmp(mapped, abgr.data() + i * framesize, framesize) == 0);
+            CHECK(rgbasource.read(frame.data()));
+            CHECK(memcmp(frame.data(), abgr.data() + i * framesize, framesize) == 0);
+        }
+        CHECK(abgrsource.next() == nullptr);
+        CHECK(!rgbasource.read(frame.data()));
+    }
+    testY4M(dir);
+    unlink(abgrpath.c_str());
+    unlink(rgbapath.c_str());
+    rmdir(dir);
+    return TEST_RESULT;
+}
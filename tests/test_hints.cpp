@@ -0,0 +1,113 @@
+// Hint downsampling: medianHalve against a 2x2 median taken by sorting, and downsampleHints against the same
+// median repeated level by level, for every factor. Odd widths and heights leave an SSE2 tail and a dropped
+// row or column, and every grid is halved serial and on the pool.
+#include "flowhints.h"
+#include "threadpool.h"
+#include "check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Rounded mean of the two middle values of the sorted four
+static int16_t sortedMedian(int16_t a, int16_t b, int16_t c, int16_t d)
+{
+    int32_t v[4] = { a, b, c, d };
+    std::sort(v, v + 4);
+    return (int16_t)((v[1] + v[2] + 1) >> 1);
+}
+
+static std::vector<NV_OF_FLOW_VECTOR> referenceHalve(const std::vector<NV_OF_FLOW_VECTOR>& src, uint32_t width, uint32_t height)
+{
+    std::vector<NV_OF_FLOW_VECTOR> dst((size_t)(width / 2) * (height / 2));
+    for (uint32_t y = 0; y < height / 2; ++y)
+    {
+        for (uint32_t x = 0; x < width / 2; ++x)
+        {
+            const NV_OF_FLOW_VECTOR* p0 = &src[(size_t)2 * y * width + 2 * x];
+            const NV_OF_FLOW_VECTOR* p1 = p0 + width;
+            NV_OF_FLOW_VECTOR& out = dst[(size_t)y * (width / 2) + x];
+            out.flowx = sortedMedian(p0[0].flowx, p0[1].flowx, p1[0].flowx, p1[1].flowx);
+            out.flowy = sortedMedian(p0[0].flowy, p0[1].flowy, p1[0].flowy, p1[1].flowy);
+        }
+    }
+    return dst;
+}
+
+static bool sameVectors(const NV_OF_FLOW_VECTOR* a, const NV_OF_FLOW_VECTOR* b, size_t count)
+{
+    return memcmp(a, b, count * sizeof(NV_OF_FLOW_VECTOR)) == 0;
+}
+
+// Random grid with the extreme components mixed in, where the biased SSE2 average could go wrong
+static void randomGrid(std::vector<NV_OF_FLOW_VECTOR>& grid)
+{
+    const int16_t extremes[] = { -32768, -32767, -1, 0, 1, 32766, 32767 };
+    for (NV_OF_FLOW_VECTOR& v : grid)
+    {
+        v.flowx = rand() % 8 == 0 ? extremes[rand() % 7] : (int16_t)(rand() % 4001 - 2000);
+        v.flowy = rand() % 8 == 0 ? extremes[rand() % 7] : (int16_t)(rand() % 4001 - 2000);
+    }
+}
+
+static void testHalve(ThreadPool& pool)
+{
+    const uint32_t sizes[][2] = { { 2, 2 }, { 3, 5 }, { 9, 4 }, { 17, 3 }, { 40, 22 }, { 81, 45 } };
+    for (const uint32_t* size : sizes)
+    {
+        const uint32_t width = size[0], height = size[1];
+        std::vector<NV_OF_FLOW_VECTOR> src((size_t)width * height);
+        randomGrid(src);
+        std::vector<NV_OF_FLOW_VECTOR> expected = referenceHalve(src, width, height);
+        for (ThreadPool* p : { (ThreadPool*)nullptr, &pool })
+        {
+            std::vector<NV_OF_FLOW_VECTOR> dst(expected.size() + 1);
+            dst.back().flowx = dst.back().flowy = 12345;
+            medianHalve(src.data(), width, height, dst.data(), p);
+            CHECK(sameVectors(dst.data(), expected.data(), expected.size()));
+            CHECK(dst.back().flowx == 12345 && dst.back().flowy == 12345);
+        }
+    }
+}
+
+static void testDownsample(ThreadPool& pool)
+{
+    const uint32_t sizes[][2] = { { 8, 8 }, { 23, 17 }, { 41, 35 }, { 160, 90 }, { 97, 61 } };
+    const uint32_t factors[] = { 1, 2, 4, 8 };
+    // The scratch is reused across grids and factors like the session does
+    std::vector<NV_OF_FLOW_VECTOR> scratch;
+    for (const uint32_t* size : sizes)
+    {
+        const uint32_t width = size[0], height = size[1];
+        std::vector<NV_OF_FLOW_VECTOR> flow((size_t)width * height);
+        randomGrid(flow);
+        for (uint32_t factor : factors)
+        {
+            std::vector<NV_OF_FLOW_VECTOR> expected = flow;
+            uint32_t w = width, h = height;
+            for (uint32_t f = factor; f > 1; f /= 2)
+            {
+                expected = referenceHalve(expected, w, h);
+                w /= 2;
+                h /= 2;
+            }
+            if (expected.empty())
+                continue;
+            for (ThreadPool* p : { (ThreadPool*)nullptr, &pool })
+            {
+                std::vector<NV_OF_FLOW_VECTOR> hints(expected.size());
+                downsampleHints(flow.data(), width, height, factor, hints.data(), scratch, p);
+                CHECK(sameVectors(hints.data(), expected.data(), expected.size()));
+            }
+        }
+    }
+}
+
+int main()
+{
+    srand(1);
+    ThreadPool pool(3);
+    testHalve(pool);
+    testDownsample(pool);
+    return TEST_RESULT;
+}
@@ -0,0 +1,246 @@
+// FlowSession against the stand-in NVOF library: the handle and the buffers are created once per stream,
+// every pair only executes, and the downloaded grids are the ones the library wrote. The cost grid and the
+// backward grid come down with the flow on one synchronization, and the cost masks exactly the vectors above
+// the threshold. With external hints every execute is hinted with the median of the flow before it, and
+// independent pairs and the pairs after skipped frames start from zero hints.
+#include "flowsession.h"
+#include "flowcolor.h"
+#include "flowhints.h"
+#include "imgproc.h"
+#include "check.h"
+#include "cudastub.h"
+#include "nvofstub.h"
+#include <dlfcn.h>
+#include <string.h>
+#include <vector>
+
+#define TEST_WIDTH 160
+#define TEST_HEIGHT 96
+#define TEST_FRAMES 6
+
+static const NvOFStubCounters* g_counters = nullptr;
+static PFNNvOFStubGetHints g_getHints = nullptr;
+
+// Whether the grid holds the vectors of the execute-th call, negated for the backward grid with a sign of -1
+static bool matchesStubFlow(const std::vector<NV_OF_FLOW_VECTOR>& flow, uint32_t width, uint32_t height, uint32_t execute,
+                            int sign = 1) {
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            NV_OF_FLOW_VECTOR expected = nvofStubFlow(x, y, execute);
+            const NV_OF_FLOW_VECTOR& v = flow[(size_t)y * width + x];
+            if (v.flowx != sign * expected.flowx || v.flowy != sign * expected.flowy)
+                return false;
+        }
+    }
+    return true;
+}
+
+static void testStream(NV_OF_BUFFER_FORMAT format) {
+    NvOFStubCounters before = *g_counters;
+    std::vector<uint8_t> frame(frameSize(format, TEST_WIDTH, TEST_HEIGHT), 128);
+    {
+        FlowSession session(nullptr, nullptr, nullptr, initializeOFParameters(TEST_WIDTH, TEST_HEIGHT, 4, format));
+        uint32_t outwidth = session.getOutputWidth();
+        uint32_t outheight = session.getOutputHeight();
+        CHECK(outwidth == TEST_WIDTH / 4 && outheight == TEST_HEIGHT / 4);
+
+        std::vector<NV_OF_FLOW_VECTOR> flow(outwidth * outheight);
+        CHECK(!session.compute(frame.data(), flow.data()));
+        for (uint32_t i = 1; i < TEST_FRAMES; ++i)
+        {
+            CHECK(session.compute(frame.data(), flow.data()));
+            CHECK(matchesStubFlow(flow, outwidth, outheight, i - 1));
+        }
+        // An independent pair still reuses the handle and the buffers
+        session.compute(frame.data(), frame.data(), flow.data());
+        CHECK(matchesStubFlow(flow, outwidth, outheight, TEST_FRAMES - 1));
+    }
+    const NvOFStubCounters& after = *g_counters;
+    CHECK(after.creates - before.creates == 1);
+    CHECK(after.inits - before.inits == 1);
+    CHECK(after.buffers[NV_OF_BUFFER_USAGE_INPUT] - before.buffers[NV_OF_BUFFER_USAGE_INPUT] == NUM_INPUT_BUFFERS);
+    CHECK(after.buffers[NV_OF_BUFFER_USAGE_OUTPUT] - before.buffers[NV_OF_BUFFER_USAGE_OUTPUT] == 1);
+    CHECK(after.executes - before.executes == TEST_FRAMES);
+    CHECK(after.destroyedBuffers - before.destroyedBuffers == NUM_INPUT_BUFFERS + 1);
+    CHECK(after.destroys - before.destroys == 1);
+}
+
+static bool matchesStubCost(const std::vector<uint8_t>& cost, uint32_t width, uint32_t height) {
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            if (cost[(size_t)y * width + x] != nvofStubCost(x, y))
+                return false;
+        }
+    }
+    return true;
+}
+
+// A session outputting cost: one cost buffer, the cost downloaded next to the flow with a single stream
+// synchronization per pair, and the masking zeroing or flagging exactly the vectors above the threshold
+static void testCost() {
+    const uint8_t threshold = 100;
+    NvOFStubCounters before = *g_counters;
+    std::vector<uint8_t> frame(frameSize(NV_OF_BUFFER_FORMAT_ABGR8, TEST_WIDTH, TEST_HEIGHT), 128);
+    FlowSession session(nullptr, nullptr, nullptr, initializeOFParameters(TEST_WIDTH, TEST_HEIGHT, 4, NV_OF_BUFFER_FORMAT_ABGR8, true));
+    CHECK(session.hasCost());
+    CHECK(g_counters->buffers[NV_OF_BUFFER_USAGE_COST] - before.buffers[NV_OF_BUFFER_USAGE_COST] == 1);
+    CHECK(g_counters->buffers[NV_OF_BUFFER_USAGE_OUTPUT] - before.buffers[NV_OF_BUFFER_USAGE_OUTPUT] == 1);
+
+    const uint32_t outwidth = session.getOutputWidth(), outheight = session.getOutputHeight();
+    const size_t count = (size_t)outwidth * outheight;
+    std::vector<NV_OF_FLOW_VECTOR> flow(count), masked(count);
+    std::vector<uint8_t> cost(count), colors(3 * count);
+    CHECK(!session.compute(frame.data(), flow.data(), cost.data()));
+    for (uint32_t i = 1; i < TEST_FRAMES; ++i)
+    {
+        int synchronizes = cudaStubSynchronizes();
+        CHECK(session.compute(frame.data(), flow.data(), cost.data()));
+        CHECK(cudaStubSynchronizes() - synchronizes == 1);
+        CHECK(matchesStubFlow(flow, outwidth, outheight, i - 1));
+        CHECK(matchesStubCost(cost, outwidth, outheight));
+    }
+
+    masked = flow;
+    maskVectors(masked.data(), cost.data(), threshold, (uint16_t)outwidth, (uint16_t)outheight);
+    for (size_t n = 0; n < count; ++n)
+    {
+        bool zero = masked[n].flowx == 0 && masked[n].flowy == 0;
+        bool kept = masked[n].flowx == flow[n].flowx && masked[n].flowy == flow[n].flowy;
+        CHECK(cost[n] > threshold ? zero : kept);
+    }
+    std::vector<NV_OF_FLOW_VECTOR> zeroed = flow;
+    postProcessVectors(zeroed.data(), cost.data(), threshold, COST_MASK_ZERO, colors.data(), (uint16_t)outwidth, (uint16_t)outheight);
+    CHECK(memcmp(zeroed.data(), masked.data(), count * sizeof(NV_OF_FLOW_VECTOR)) == 0);
+
+    masked = flow;
+    postProcessVectors(masked.data(), cost.data(), threshold, COST_MASK_FLAG, colors.data(), (uint16_t)outwidth, (uint16_t)outheight);
+    CHECK(memcmp(masked.data(), flow.data(), count * sizeof(NV_OF_FLOW_VECTOR)) == 0);
+    for (size_t n = 0; n < count; ++n)
+    {
+        bool black = colors[3 * n] == 0 && colors[3 * n + 1] == 0 && colors[3 * n + 2] == 0;
+        CHECK(black == (cost[n] > threshold));
+    }
+}
+
+// A session predicting in both directions: a second output buffer, and a backward cost buffer when the session
+// outputs cost, with the backward grid holding the negated vectors the library wrote on the same synchronization
+static void testBackward(bool outputcost) {
+    NvOFStubCounters before = *g_counters;
+    std::vector<uint8_t> frame(frameSize(NV_OF_BUFFER_FORMAT_GRAYSCALE8, TEST_WIDTH, TEST_HEIGHT), 128);
+    {
+        NV_OF_INIT_PARAMS initparams = initializeOFParameters(TEST_WIDTH, TEST_HEIGHT, 2, NV_OF_BUFFER_FORMAT_GRAYSCALE8, outputcost);
+        initparams.predDirection = NV_OF_PRED_DIRECTION_BOTH;
+        FlowSession session(nullptr, nullptr, nullptr, initparams);
+        CHECK(g_counters->buffers[NV_OF_BUFFER_USAGE_OUTPUT] - before.buffers[NV_OF_BUFFER_USAGE_OUTPUT] == 2);
+        CHECK(g_counters->buffers[NV_OF_BUFFER_USAGE_COST] - before.buffers[NV_OF_BUFFER_USAGE_COST] == (outputcost ? 2 : 0));
+
+        const uint32_t outwidth = session.getOutputWidth(), outheight = session.getOutputHeight();
+        const size_t count = (size_t)outwidth * outheight;
+        std::vector<NV_OF_FLOW_VECTOR> flow(count), backward(count);
+        std::vector<uint8_t> cost(count);
+        CHECK(!session.compute(frame.data(), flow.data(), cost.data(), backward.data()));
+        for (uint32_t i = 1; i < TEST_FRAMES; ++i)
+        {
+            int synchronizes = cudaStubSynchronizes();
+            CHECK(session.compute(frame.data(), flow.data(), outputcost ? cost.data() : nullptr, backward.data()));
+            CHECK(cudaStubSynchronizes() - synchronizes == 1);
+            CHECK(matchesStubFlow(flow, outwidth, outheight, i - 1));
+            CHECK(matchesStubFlow(backward, outwidth, outheight, i - 1, -1));
+            CHECK(!outputcost || matchesStubCost(cost, outwidth, outheight));
+        }
+        session.compute(frame.data(), frame.data(), flow.data(), nullptr, backward.data());
+        CHECK(matchesStubFlow(backward, outwidth, outheight, TEST_FRAMES - 1, -1));
+    }
+    CHECK(g_counters->destroyedBuffers - before.destroyedBuffers == NUM_INPUT_BUFFERS + (outputcost ? 4 : 2));
+}
+
+// Whether the last hinted execute got the expected hints in a buffer of hintwidth x hintheight
+static bool lastHintsAre(const std::vector<NV_OF_FLOW_VECTOR>& expected, uint32_t hintwidth, uint32_t hintheight) {
+    uint32_t width = 0, height = 0;
+    const NV_OF_FLOW_VECTOR* hints = g_getHints(&width, &height);
+    return width == hintwidth && height == hintheight &&
+           memcmp(hints, expected.data(), expected.size() * sizeof(NV_OF_FLOW_VECTOR)) == 0;
+}
+
+// A session taking external hints on a grid hintgrid / outgrid times coarser than its output: one hint buffer
+// of the hint grid, every execute hinted, zero hints for the first pair, the pair after skipped frames and an
+// independent pair, and the downsampled previous flow for every other pair
+static void testHints(uint8_t outgrid, uint8_t hintgrid) {
+    NvOFStubCounters before = *g_counters;
+    std::vector<uint8_t> frame(frameSize(NV_OF_BUFFER_FORMAT_GRAYSCALE8, TEST_WIDTH, TEST_HEIGHT), 128);
+    NV_OF_INIT_PARAMS initparams = initializeOFParameters(TEST_WIDTH, TEST_HEIGHT, outgrid, NV_OF_BUFFER_FORMAT_GRAYSCALE8);
+    initparams.enableExternalHints = NV_OF_TRUE;
+    initparams.hintGridSize = (NV_OF_HINT_VECTOR_GRID_SIZE)hintgrid;
+    {
+        FlowSession session(nullptr, nullptr, nullptr, initparams);
+        CHECK(g_counters->buffers[NV_OF_BUFFER_USAGE_HINT] - before.buffers[NV_OF_BUFFER_USAGE_HINT] == 1);
+
+        const uint32_t outwidth = session.getOutputWidth(), outheight = session.getOutputHeight();
+        const uint32_t hintwidth = TEST_WIDTH / hintgrid, hintheight = TEST_HEIGHT / hintgrid;
+        std::vector<NV_OF_FLOW_VECTOR> flow((size_t)outwidth * outheight), previous;
+        std::vector<NV_OF_FLOW_VECTOR> zero((size_t)hintwidth * hintheight), expected(zero.size()), scratch;
+        auto predicted = [&]() {
+            downsampleHints(previous.data(), outwidth, outheight, hintgrid / outgrid, expected.data(), scratch);
+            return expected;
+        };
+
+        CHECK(!session.compute(frame.data(), flow.data()));
+        CHECK(session.compute(frame.data(), flow.data()));
+        CHECK(lastHintsAre(zero, hintwidth, hintheight));
+        for (uint32_t i = 1; i < TEST_FRAMES; ++i)
+        {
+            previous = flow;
+            CHECK(session.compute(frame.data(), flow.data()));
+            CHECK(lastHintsAre(predicted(), hintwidth, hintheight));
+        }
+
+        // Frames only advanced over leave the last flow behind
+        session.advance(frame.data());
+        session.advance(frame.data());
+        CHECK(session.compute(frame.data(), flow.data()));
+        CHECK(lastHintsAre(zero, hintwidth, hintheight));
+        previous = flow;
+        CHECK(session.compute(frame.data(), flow.data()));
+        CHECK(lastHintsAre(predicted(), hintwidth, hintheight));
+
+        // An independent pair starts over, the stream after it follows its flow
+        session.compute(frame.data(), frame.data(), flow.data());
+        CHECK(lastHintsAre(zero, hintwidth, hintheight));
+        previous = flow;
+        CHECK(session.compute(frame.data(), flow.data()));
+        CHECK(lastHintsAre(predicted(), hintwidth, hintheight));
+    }
+    int executes = g_counters->executes - before.executes;
+    CHECK(executes == TEST_FRAMES + 4);
+    CHECK(g_counters->hintedExecutes - before.hintedExecutes == executes);
+    CHECK(g_counters->destroyedBuffers - before.destroyedBuffers == NUM_INPUT_BUFFERS + 2);
+}
+
+int main() {
+    // Holding a reference keeps the stand-in and its counters loaded while the sessions load and unload it
+    void* lib = dlopen("libnvidia-opticalflow.so", RTLD_LAZY);
+    PFNNvOFStubGetCounters getCounters = lib ? (PFNNvOFStubGetCounters)dlsym(lib, "NvOFStubGetCounters") : nullptr;
+    if (!getCounters) {
+        fprintf(stderr, "the stand-in NVOF library was not found, run through make test\n");
+        return 1;
+    }
+    g_counters = getCounters();
+    g_getHints = (PFNNvOFStubGetHints)dlsym(lib, "NvOFStubGetHints");
+
+    testStream(NV_OF_BUFFER_FORMAT_ABGR8);
+    testStream(NV_OF_BUFFER_FORMAT_NV12);
+    testStream(NV_OF_BUFFER_FORMAT_GRAYSCALE8);
+    MakeColorWheel();
+    testCost();
+    testBackward(false);
+    testBackward(true);
+    testHints(4, 8);
+    testHints(1, 4);
+    testHints(2, 2);
+    dlclose(lib);
+    return TEST_RESULT;
+}
@@ -0,0 +1,36 @@
+// VideoWriter with an encoder that dies: the broken pipe surfaces as an exception, the process keeps the
+// default SIGPIPE action it started with and no SIGPIPE is left pending.
+#include "videowriter.h"
+#include "check.h"
+#include <signal.h>
+#include <stdexcept>
+#include <string.h>
+
+#define TEST_WIDTH 640
+#define TEST_HEIGHT 480
+#define TEST_MAX_FRAMES 1000
+
+int main() {
+    signal(SIGPIPE, SIG_DFL);
+
+    // ffmpeg cannot create a file in a directory that does not exist, without ffmpeg the shell exits at once
+    bool failed = false;
+    try {
+        VideoWriter writer("/nonexistent/ofvec/flow.mp4", TEST_WIDTH, TEST_HEIGHT);
+        for (int i = 0; i < TEST_MAX_FRAMES; ++i) {
+            uint8_t* frame = writer.acquire();
+            memset(frame, i, TEST_WIDTH * TEST_HEIGHT * 3);
+            writer.submit(frame);
+        }
+        writer.close();
+    } catch (const std::runtime_error&) {
+        failed = true;
+    }
+    CHECK(failed);
+
+    struct sigaction action;
+    CHECK(sigaction(SIGPIPE, nullptr, &action) == 0 && action.sa_handler == SIG_DFL);
+    sigset_t pending;
+    CHECK(sigpending(&pending) == 0 && !sigismember(&pending, SIGPIPE));
+    return TEST_RESULT;
+}
@@ -0,0 +1,73 @@
+#include "threadpool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t numthreads)
+    : m_task(nullptr), m_count(0), m_chunk(1), m_next(0), m_generation(0), m_busy(0), m_stop(false)
+{
+    if (numthreads == 0)
+        numthreads = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t i = 1; i < numthreads; ++i)
+        m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+}
+
+void ThreadPool::runChunks() {
+    uint32_t begin;
+    while ((begin = m_next.fetch_add(m_chunk)) < m_count)
+        (*m_task)(begin, std::min(begin + m_chunk, m_count));
+}
+
+void ThreadPool::workerLoop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+        if (m_stop)
+            return;
+        seen = m_generation;
+
+        lock.unlock();
+        runChunks();
+        lock.lock();
+
+        if (--m_busy == 0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& fn) {
+    if (count == 0)
+        return;
+    if (m_workers.empty() || count == 1) {
+        fn(0, count);
+        return;
+    }
+
+    // A few chunks per thread keeps the load balanced when some rows are more expensive than others
+    uint32_t numchunks = getNumThreads() * 4;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &fn;
+        m_count = count;
+        m_chunk = std::max(1u, (count + numchunks - 1) / numchunks);
+        m_next = 0;
+        m_busy = (uint32_t)m_workers.size();
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_busy == 0; });
+    m_task = nullptr;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads for data-parallel loops over image rows.
+// The threads are created once and parked between calls, so it is cheap to use every frame.
+// Only one thread may call parallelFor() at a time.
+class ThreadPool {
+public:
+    // numthreads counts the calling thread too, 0 picks the number of hardware threads
+    explicit ThreadPool(uint32_t numthreads = 0);
+    ~ThreadPool();
+
+    uint32_t getNumThreads() { return (uint32_t)m_workers.size() + 1; }
+
+    // Splits [0, count) into contiguous chunks and runs fn(begin, end) on them in parallel.
+    // Returns once every chunk is done.
+    void parallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& fn);
+
+private:
+    void workerLoop();
+    void runChunks();
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(uint32_t, uint32_t)>* m_task;
+    uint32_t m_count;
+    uint32_t m_chunk;
+    std::atomic<uint32_t> m_next;
+    uint64_t m_generation;
+    uint32_t m_busy;
+    bool m_stop;
+};
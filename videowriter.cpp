@@ -0,0 +1,103 @@
+#include "videowriter.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdexcept>
+#include <time.h>
+#include <unistd.h>
+
+VideoWriter::VideoWriter(const std::string& path, uint32_t width, uint32_t height)
+    : m_path(path), m_framesize((size_t)width * height * 3), m_pipe(nullptr), m_fd(-1),
+      m_buffers(VIDEO_WRITER_BUFFERS, std::vector<uint8_t>(m_framesize)),
+      m_free(VIDEO_WRITER_BUFFERS), m_ready(VIDEO_WRITER_BUFFERS), m_closed(false) {
+    // yuv420p needs even dimensions, odd grids get one padding row or column
+    std::string command = "ffmpeg -loglevel error -y -f rawvideo -pix_fmt bgr24 -s " + std::to_string(width) + "x" +
+                          std::to_string(height) + " -r " + std::to_string(VIDEO_WRITER_FPS) +
+                          " -i - -vf \"pad=ceil(iw/2)*2:ceil(ih/2)*2\" -pix_fmt yuv420p \"" + path + "\"";
+    m_pipe = popen(command.c_str(), "w");
+    if (!m_pipe)
+        throw std::runtime_error("Failed to open pipe");
+    m_fd = fileno(m_pipe);
+
+    for (uint32_t i = 0; i < VIDEO_WRITER_BUFFERS; ++i)
+        m_free.push(m_buffers[i].data());
+    m_thread = std::thread(&VideoWriter::writerLoop, this);
+}
+
+VideoWriter::~VideoWriter() {
+    try
+    {
+        close();
+    }
+    catch(const std::exception&)
+    {
+    }
+}
+
+uint8_t* VideoWriter::acquire() {
+    uint8_t* frame;
+    if (!m_free.pop(frame)) {
+        // The writer thread only gives up on failure
+        close();
+        throw std::runtime_error("Failed to encode " + m_path);
+    }
+    return frame;
+}
+
+void VideoWriter::submit(uint8_t* frame) {
+    m_ready.push(frame);
+}
+
+void VideoWriter::close() {
+    if (!m_closed) {
+        m_closed = true;
+        m_ready.close();
+        m_thread.join();
+        // ffmpeg finishes the file once its input ends
+        int status = pclose(m_pipe);
+        m_pipe = nullptr;
+        if (status != 0 && !m_error)
+            m_error = std::make_exception_ptr(std::runtime_error("ffmpeg failed to encode " + m_path));
+    }
+    if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+// Writes bypass stdio and go straight from the frame into the pipe.
+// A dying ffmpeg has to surface as a failed write instead of killing the process, so SIGPIPE is blocked on
+// this thread only and the signal a broken pipe leaves pending is taken back; how the rest of the process
+// handles SIGPIPE stays up to main().
+void VideoWriter::writerLoop() {
+    sigset_t pipeset;
+    sigemptyset(&pipeset);
+    sigaddset(&pipeset, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeset, nullptr);
+    try
+    {
+        uint8_t* frame;
+        while (m_ready.pop(frame)) {
+            size_t done = 0;
+            while (done < m_framesize) {
+                ssize_t written = ::write(m_fd, frame + done, m_framesize - done);
+                if (written < 0 && errno == EINTR)
+                    continue;
+                if (written < 0 && errno == EPIPE) {
+                    const struct timespec poll = { 0, 0 };
+                    while (sigtimedwait(&pipeset, nullptr, &poll) < 0 && errno == EINTR) {}
+                }
+                if (written <= 0)
+                    throw std::runtime_error("Failed to write to the ffmpeg pipe");
+                done += written;
+            }
+            m_free.push(frame);
+        }
+    }
+    catch(...)
+    {
+        m_error = std::current_exception();
+    }
+    m_free.close();
+}
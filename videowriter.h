@@ -0,0 +1,44 @@
+#pragma once
+#include "pipeline.h"
+#include <exception>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define VIDEO_WRITER_BUFFERS 4      // colorized frames that may wait for the encoder
+#define VIDEO_WRITER_FPS 30         // frame rate stamped on the encoded video
+
+// Encodes BGR24 frames to a video file through an ffmpeg process fed from a background thread.
+// The caller colors straight into a buffer from acquire() and hands it back with submit(), the
+// thread writes it into the pipe, so neither copies nor the encoder run on the caller's thread
+// unless ffmpeg falls behind by more than VIDEO_WRITER_BUFFERS frames.
+class VideoWriter {
+public:
+    VideoWriter(const std::string& path, uint32_t width, uint32_t height);
+    ~VideoWriter();
+
+    // Returns an empty frame of width * height * 3 bytes, rethrows a failure of the writer thread
+    uint8_t* acquire();
+
+    // Queues a frame returned by acquire()
+    void submit(uint8_t* frame);
+
+    // Encodes everything queued and waits for ffmpeg to finish the file, rethrows any failure
+    void close();
+
+private:
+    void writerLoop();
+
+    std::string m_path;
+    size_t m_framesize;
+    FILE* m_pipe;
+    int m_fd;
+    std::vector<std::vector<uint8_t> > m_buffers;
+    BoundedQueue<uint8_t*> m_free;
+    BoundedQueue<uint8_t*> m_ready;
+    std::thread m_thread;
+    std::exception_ptr m_error;
+    bool m_closed;
+};